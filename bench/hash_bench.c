@@ -0,0 +1,231 @@
+// apachejuice, 18.10.2026
+// See LICENSE for details.
+//
+// Compares the string hashes on identifiers and on longer payloads taken from
+// the given files: throughput, and probe lengths in a linear-probing table
+// sized like the VM's (power of two, at most 75% full).
+//
+//     meson compile -C build hash_bench
+//     ./build/bench/hash_bench src/*.c src/*.h
+#include "common.h"
+#include "hash.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+    const char *data;
+    size        len;
+} slice;
+
+typedef struct {
+    slice *items;
+    size   count;
+    size   capacity;
+    size   bytes;
+} corpus;
+
+typedef uint32 (*hash_fn) (const char *data, size len);
+
+static void add_slice (corpus *c, const char *data, size len) {
+    if (c->count == c->capacity) {
+        c->capacity = c->capacity ? c->capacity * 2 : 1024;
+        c->items    = realloc (c->items, sizeof (slice) * c->capacity);
+        if (c->items == NULL) exit (1);
+    }
+
+    c->items[c->count++] = (slice) {data, len};
+    c->bytes += len;
+}
+
+static char *read_file (const char *path, size *len) {
+    FILE *file = fopen (path, "rb");
+    if (file == NULL) return NULL;
+
+    fseek (file, 0, SEEK_END);
+    *len = (size) ftell (file);
+    rewind (file);
+
+    char *data = malloc (*len + 1);
+    if (data == NULL || fread (data, 1, *len, file) != *len) exit (1);
+    data[*len] = 0;
+
+    fclose (file);
+    return data;
+}
+
+static void split (const char *data, size len, corpus *idents,
+                   corpus *payloads) {
+    const char *line = data;
+    for (size i = 0; i <= len; i++) {
+        if (i == len || data[i] == '\n') {
+            if (data + i > line) add_slice (payloads, line, data + i - line);
+            line = data + i + 1;
+        }
+    }
+
+    for (size i = 0; i < len;) {
+        if (isalpha ((uint8) data[i]) || data[i] == '_') {
+            size start = i;
+            while (i < len && (isalnum ((uint8) data[i]) || data[i] == '_')) {
+                i++;
+            }
+
+            add_slice (idents, data + start, i - start);
+        } else {
+            i++;
+        }
+    }
+
+    add_slice (payloads, data, len);
+}
+
+static bool slice_equal (slice a, slice b) {
+    return a.len == b.len && memcmp (a.data, b.data, a.len) == 0;
+}
+
+// Drops duplicates, so probe lengths are measured on distinct keys.
+static corpus unique (const corpus *c) {
+    corpus out = {0};
+    size   cap = 16;
+    while (cap < c->count * 2) cap *= 2;
+
+    slice *set = calloc (cap, sizeof (slice));
+    if (set == NULL) exit (1);
+
+    for (size i = 0; i < c->count; i++) {
+        size idx = hash_fnv1a (c->items[i].data, c->items[i].len) & (cap - 1);
+        while (set[idx].data != NULL && !slice_equal (set[idx], c->items[i])) {
+            idx = (idx + 1) & (cap - 1);
+        }
+
+        if (set[idx].data == NULL) {
+            set[idx] = c->items[i];
+            add_slice (&out, c->items[i].data, c->items[i].len);
+        }
+    }
+
+    free (set);
+    return out;
+}
+
+static double now_s (void) {
+    struct timespec ts;
+    timespec_get (&ts, TIME_UTC);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+static void throughput (const char *name, hash_fn fn, const corpus *c) {
+    volatile uint32 sink   = 0;
+    size            rounds = 0;
+    double          start  = now_s ();
+    double          elapsed;
+
+    do {
+        for (size i = 0; i < c->count; i++) {
+            sink ^= fn (c->items[i].data, c->items[i].len);
+        }
+
+        rounds++;
+        elapsed = now_s () - start;
+    } while (elapsed < 0.25);
+
+    double keys = (double) rounds * (double) c->count;
+    printf ("  %-14s %9.1f MB/s %8.2f ns/key\n", name,
+            (double) rounds * (double) c->bytes / elapsed / 1e6,
+            elapsed / keys * 1e9);
+}
+
+static void probes (const char *name, hash_fn fn, const corpus *c) {
+    size capacity = 8;
+    while ((double) c->count > (double) capacity * 0.75) capacity *= 2;
+
+    uint8 *used = calloc (capacity, 1);
+    if (used == NULL) exit (1);
+
+    size total = 0, longest = 0;
+    for (size i = 0; i < c->count; i++) {
+        size idx = fn (c->items[i].data, c->items[i].len) % capacity;
+        size len = 1;
+        while (used[idx]) {
+            idx = (idx + 1) % capacity;
+            len++;
+        }
+
+        used[idx] = 1;
+        total    += len;
+        if (len > longest) longest = len;
+    }
+
+    printf ("  %-14s %9.3f avg %8zu max\n", name,
+            c->count ? (double) total / (double) c->count : 0.0, longest);
+    free (used);
+}
+
+static bool paths_agree (const corpus *c) {
+    bool ok = true;
+    for (size i = 0; i < c->count && ok; i++) {
+        hash_set_isa (HASH_ISA_SCALAR);
+        uint32 expect = hash_words (c->items[i].data, c->items[i].len);
+
+        for (hash_isa isa = HASH_ISA_SSE2; isa <= HASH_ISA_AVX2; isa++) {
+            if (!hash_set_isa (isa)) continue;
+            if (hash_words (c->items[i].data, c->items[i].len) != expect) {
+                ok = false;
+            }
+        }
+    }
+
+    return ok;
+}
+
+static void report (const char *title, const corpus *c) {
+    static const char *const isa_names[] = {"words/scalar", "words/sse2",
+                                            "words/avx2"};
+
+    corpus distinct = unique (c);
+    printf ("%s: %zu keys (%zu distinct), %.1f bytes on average\n", title,
+            c->count, distinct.count,
+            c->count ? (double) c->bytes / (double) c->count : 0.0);
+
+    throughput ("fnv1a", hash_fnv1a, c);
+    for (hash_isa isa = HASH_ISA_SCALAR; isa <= HASH_ISA_AVX2; isa++) {
+        if (hash_set_isa (isa)) throughput (isa_names[isa], hash_words, c);
+    }
+
+    printf (" probe length\n");
+    probes ("fnv1a", hash_fnv1a, &distinct);
+    probes ("words", hash_words, &distinct);
+
+    printf (" vector paths agree: %s\n\n", paths_agree (c) ? "yes" : "NO");
+    free (distinct.items);
+}
+
+int main (int argc, char **argv) {
+    if (argc < 2) {
+        fprintf (stderr, "Usage: %s FILE...\n", argv[0]);
+        return 64;
+    }
+
+    corpus idents = {0}, payloads = {0};
+    for (int i = 1; i < argc; i++) {
+        size  len;
+        char *data = read_file (argv[i], &len);
+        if (data == NULL) {
+            fprintf (stderr, "Could not read '%s'\n", argv[i]);
+            return 74;
+        }
+
+        split (data, len, &idents, &payloads);
+    }
+
+    report ("identifiers", &idents);
+    report ("payloads", &payloads);
+
+    free (idents.items);
+    free (payloads.items);
+    return 0;
+}
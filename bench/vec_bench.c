@@ -0,0 +1,173 @@
+// apachejuice, 18.10.2026
+// See LICENSE for details.
+//
+// Times the f64 kernels on each instruction set against a plain loop, and
+// checks that every vector path gives the same bits as the scalar one.
+//
+//     meson compile -C build vec_bench
+//     ./build/bench/vec_bench [elements]
+#include "common.h"
+#include "vec.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char *const isa_names[] = {"scalar", "sse2", "avx2"};
+
+static double now_s (void) {
+    struct timespec ts;
+    timespec_get (&ts, TIME_UTC);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+static double *random_array (size n, uint64 seed) {
+    double *x = malloc (n * sizeof (double));
+    if (x == NULL) exit (1);
+
+    for (size i = 0; i < n; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        x[i] = (double) (int64) (seed >> 11) / (double) (1ull << 40);
+    }
+
+    return x;
+}
+
+static double loop_sum (const double *x, size n) {
+    double sum = 0;
+    for (size i = 0; i < n; i++) sum += x[i];
+    return sum;
+}
+
+typedef enum {
+    K_SUM,
+    K_MIN,
+    K_DOT,
+    K_AXPY,
+    K_ADD,
+    K_PREFIX,
+    K_SORT,
+    K_COUNT,
+} kernel;
+
+static const char *const kernel_names[] = {
+    "sum", "min", "dot", "axpy", "add", "prefix_sum", "sort",
+};
+
+// Runs one kernel into `out`, from the same inputs every time.
+static double run (kernel k, const double *x, const double *y, double *out,
+                   size n) {
+    switch (k) {
+        case K_SUM: return vec_sum (x, n);
+        case K_MIN: return vec_min (x, n);
+        case K_DOT: return vec_dot (x, y, n);
+        case K_AXPY:
+            memcpy (out, y, n * sizeof (double));
+            vec_axpy (0.5, x, out, n);
+            return out[n - 1];
+        case K_ADD: vec_add (out, x, y, n); return out[n - 1];
+        case K_PREFIX: vec_prefix_sum (out, x, n); return out[n - 1];
+        case K_SORT:
+            memcpy (out, x, n * sizeof (double));
+            vec_sort (out, n);
+            return out[0];
+        case K_COUNT: break;
+    }
+
+    return 0;
+}
+
+static void timing (kernel k, const double *x, const double *y, double *out,
+                    size n) {
+    printf ("  %-12s", kernel_names[k]);
+    for (vec_isa isa = VEC_ISA_SCALAR; isa <= VEC_ISA_AVX2; isa++) {
+        if (!vec_set_isa (isa)) continue;
+
+        volatile double sink   = 0;
+        size            rounds = 0;
+        double          start  = now_s ();
+        double          elapsed;
+        do {
+            sink += run (k, x, y, out, n);
+            rounds++;
+            elapsed = now_s () - start;
+        } while (elapsed < 0.2);
+
+        printf (" %s %8.3f ns/elt", isa_names[isa],
+                elapsed / (double) rounds / (double) n * 1e9);
+    }
+
+    printf ("\n");
+}
+
+static bool agree (kernel k, const double *x, const double *y, size n) {
+    double *expect = calloc (n, sizeof (double));
+    double *got    = calloc (n, sizeof (double));
+    if (expect == NULL || got == NULL) exit (1);
+
+    vec_set_isa (VEC_ISA_SCALAR);
+    double want = run (k, x, y, expect, n);
+    bool   ok   = true;
+
+    for (vec_isa isa = VEC_ISA_SSE2; isa <= VEC_ISA_AVX2; isa++) {
+        if (!vec_set_isa (isa)) continue;
+
+        double res = run (k, x, y, got, n);
+        if (memcmp (&res, &want, sizeof (double)) != 0 ||
+            memcmp (got, expect, n * sizeof (double)) != 0) {
+            ok = false;
+        }
+    }
+
+    free (expect);
+    free (got);
+    return ok;
+}
+
+int main (int argc, char **argv) {
+    size n = argc > 1 ? (size) strtoull (argv[1], NULL, 10) : 1 << 20;
+    if (n == 0) {
+        fprintf (stderr, "Usage: %s [elements]\n", argv[0]);
+        return 64;
+    }
+
+    double *x   = random_array (n, 0x9e3779b97f4a7c15ull);
+    double *y   = random_array (n, 0xc2b2ae3d27d4eb4full);
+    double *out = malloc (n * sizeof (double));
+    if (out == NULL) exit (1);
+
+    printf ("%zu elements\n", n);
+    volatile double sink  = 0;
+    size            loops = 0;
+    double          start = now_s ();
+    do {
+        sink += loop_sum (x, n);
+        loops++;
+    } while (now_s () - start < 0.2);
+    printf ("  %-12s plain   %8.3f ns/elt\n", "loop sum",
+            (now_s () - start) / (double) loops / (double) n * 1e9);
+
+    for (kernel k = K_SUM; k < K_COUNT; k++) timing (k, x, y, out, n);
+
+    // Odd lengths exercise the tails, and NaN and signed zeros the corner
+    // cases of min and sort.
+    bool ok = true;
+    for (size len = 1; len <= 67 && len <= n; len++) {
+        for (kernel k = K_SUM; k < K_COUNT; k++) ok &= agree (k, x, y, len);
+    }
+
+    x[n / 2] = -0.0;
+    x[n / 3] = NAN;
+    for (kernel k = K_SUM; k < K_COUNT; k++) ok &= agree (k, x, y, n);
+
+    printf ("vector paths agree: %s\n", ok ? "yes" : "NO");
+
+    free (x);
+    free (y);
+    free (out);
+    return ok ? 0 : 1;
+}
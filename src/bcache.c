@@ -0,0 +1,631 @@
+// apachejuice, 18.10.2026
+// See LICENSE for details.
+#define _DEFAULT_SOURCE
+
+#include "bcache.h"
+#include "compiler.h"
+#include "hash.h"
+#include "memory.h"
+#include "vm.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BCACHE_MAGIC 0x42584c41u  // "ALXB" on little endian machines
+#define BCACHE_ALIGN 8
+#define BCACHE_NO_NAME (-1)
+
+// Hashed with STRING_HASH and stored in every file, so that files written by
+// a build with a different string hash are not trusted.
+#define BCACHE_PROBE "aloxotl bytecode"
+
+// All offsets are from the start of the file. The string and function tables
+// follow the header; everything they point to comes after them.
+typedef struct {
+    uint32 magic;
+    uint32 version;
+    uint32 hash_probe;
+    uint32 word_size;
+    uint32 string_count;
+    uint32 func_count;
+    uint32 lazy;  // whether function bodies were left to their first call
+    uint32 pad;
+    uint64 source_key;
+    uint64 source_len;
+    uint64 file_size;
+    uint64 checksum;  // of everything after the header
+    uint64 strings_offset;
+    uint64 funcs_offset;
+} bcache_header;
+
+typedef struct {
+    uint32 len;
+    uint32 hash;
+    uint64 data_offset;  // `len` bytes and a terminating 0
+} bcache_string;
+
+typedef struct {
+    int32  arity;
+    int32  upvalue_count;
+    int32  name;  // string index, or BCACHE_NO_NAME for the script
+    uint32 const_count;
+    uint64 const_offset;
+    uint64 code_len;
+    uint64 code_offset;
+    uint64 line_count;
+    uint64 lines_offset;  // `line_count` line_runs
+} bcache_func;
+
+typedef enum {
+    BCACHE_CONST_BOOL,
+    BCACHE_CONST_FUNC,
+    BCACHE_CONST_INT,
+    BCACHE_CONST_NIL,
+    BCACHE_CONST_NUMBER,
+    BCACHE_CONST_STRING,
+} bcache_const_tag;
+
+// Strings and functions are referred to by their index in the tables, and a
+// function only ever refers to functions before it.
+typedef struct {
+    uint32 tag;
+    uint32 pad;
+    uint64 payload;
+} bcache_const;
+
+typedef struct {
+    void *base;
+    size  len;
+} mapping;
+
+static mapping *mappings;
+static size     mapping_count;
+static size     mapping_capacity;
+
+char *bcache_path (const char *script_path, const char *source, size len) {
+    const char *dir = getenv ("ALOXOTL_CACHE_DIR");
+    size        cap = strlen (script_path) + 2;
+    if (dir != NULL && *dir) cap = strlen (dir) + 32;
+
+    char *path = malloc (cap);
+    if (path == NULL) return NULL;
+
+    if (dir != NULL && *dir) {
+        snprintf (path, cap, "%s/%016llx.loxc", dir,
+                  (unsigned long long) hash_checksum (source, len));
+    } else {
+        snprintf (path, cap, "%sc", script_path);
+    }
+
+    return path;
+}
+
+// Loading.
+
+static bool in_file (uint64 offset, uint64 len, uint64 file_size) {
+    return offset <= file_size && len <= file_size - offset;
+}
+
+static bool check_header (const bcache_header *header, uint64 file_size,
+                          const char *source, size len) {
+    if (header->magic != BCACHE_MAGIC) return false;
+    if (header->version != BCACHE_VERSION) return false;
+    if (header->word_size != sizeof (size)) return false;
+    if (header->lazy != lazy_compile_enabled ()) return false;
+    if (header->hash_probe !=
+        STRING_HASH (BCACHE_PROBE, sizeof (BCACHE_PROBE) - 1)) {
+        return false;
+    }
+
+    if (header->file_size != file_size) return false;
+    if (header->source_len != len) return false;
+    if (header->source_key != hash_checksum (source, len)) return false;
+
+    return header->func_count > 0 &&
+           in_file (header->strings_offset,
+                    (uint64) header->string_count * sizeof (bcache_string),
+                    file_size) &&
+           in_file (header->funcs_offset,
+                    (uint64) header->func_count * sizeof (bcache_func),
+                    file_size) &&
+           header->strings_offset % BCACHE_ALIGN == 0 &&
+           header->funcs_offset % BCACHE_ALIGN == 0;
+}
+
+// Checks every offset and index in the file, so that loading it cannot read
+// outside the mapping or build a cyclic function tree.
+static bool check_tables (const uint8 *base, const bcache_header *header) {
+    uint64               file_size = header->file_size;
+    const bcache_string *strings =
+        (const bcache_string *) (base + header->strings_offset);
+    const bcache_func *funcs =
+        (const bcache_func *) (base + header->funcs_offset);
+
+    for (uint32 i = 0; i < header->string_count; i++) {
+        if (!in_file (strings[i].data_offset, (uint64) strings[i].len + 1,
+                      file_size)) {
+            return false;
+        }
+    }
+
+    for (uint32 i = 0; i < header->func_count; i++) {
+        const bcache_func *func = &funcs[i];
+
+        if (func->name != BCACHE_NO_NAME &&
+            (func->name < 0 || (uint32) func->name >= header->string_count)) {
+            return false;
+        }
+
+        if (func->code_len > file_size ||
+            func->const_offset % BCACHE_ALIGN != 0 ||
+            func->lines_offset % BCACHE_ALIGN != 0 ||
+            !in_file (func->code_offset, func->code_len, file_size) ||
+            func->line_count > func->code_len ||
+            !in_file (func->lines_offset,
+                      func->line_count * sizeof (line_run), file_size) ||
+            !in_file (func->const_offset,
+                      (uint64) func->const_count * sizeof (bcache_const),
+                      file_size)) {
+            return false;
+        }
+
+        const bcache_const *consts =
+            (const bcache_const *) (base + func->const_offset);
+        for (uint32 j = 0; j < func->const_count; j++) {
+            switch (consts[j].tag) {
+                case BCACHE_CONST_BOOL:
+                case BCACHE_CONST_INT:
+                case BCACHE_CONST_NIL:
+                case BCACHE_CONST_NUMBER: break;
+                case BCACHE_CONST_FUNC:
+                    if (consts[j].payload >= i) return false;
+                    break;
+                case BCACHE_CONST_STRING:
+                    if (consts[j].payload >= header->string_count) {
+                        return false;
+                    }
+                    break;
+                default: return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static void keep_mapping (void *base, size len) {
+    if (mapping_count == mapping_capacity) {
+        mapping_capacity = GROW_CAPACITY (mapping_capacity);
+        mappings =
+            realloc (mappings, mapping_capacity * sizeof (mapping));
+        if (mappings == NULL) exit (1);
+    }
+
+    mappings[mapping_count].base = base;
+    mappings[mapping_count].len  = len;
+    mapping_count++;
+}
+
+static void root (obj_list *roots, obj *object) {
+    push (OBJ_VAL (object));
+    write_value_array (&roots->items, OBJ_VAL (object));
+    pop ();
+}
+
+// Builds the function tree described by a checked file. Everything created
+// so far is kept in `roots`, so collections during loading free nothing.
+static obj_func *build (uint8 *base, const bcache_header *header,
+                        obj_module *module) {
+    const bcache_string *strings =
+        (const bcache_string *) (base + header->strings_offset);
+    const bcache_func *funcs =
+        (const bcache_func *) (base + header->funcs_offset);
+
+    obj_list *roots = new_list ();
+    push (OBJ_VAL ((obj *) roots));
+
+    for (uint32 i = 0; i < header->string_count; i++) {
+        obj_string *str = copy_string_hashed (
+            (const char *) base + strings[i].data_offset, strings[i].len,
+            strings[i].hash);
+        root (roots, (obj *) str);
+    }
+
+    for (uint32 i = 0; i < header->func_count; i++) {
+        const bcache_func *record = &funcs[i];
+        obj_func          *func   = new_func ();
+        root (roots, (obj *) func);
+
+        func->arity         = record->arity;
+        func->upvalue_count = record->upvalue_count;
+        func->module        = module;
+        if (record->name != BCACHE_NO_NAME) {
+            func->name = AS_STRING (roots->items.values[record->name]);
+        }
+
+        func->chk.code          = base + record->code_offset;
+        func->chk.lines         = (line_run *) (base + record->lines_offset);
+        func->chk.count         = record->code_len;
+        func->chk.capacity      = record->code_len;
+        func->chk.line_count    = record->line_count;
+        func->chk.line_capacity = record->line_count;
+        func->chk.mapped        = true;
+
+        const bcache_const *consts =
+            (const bcache_const *) (base + record->const_offset);
+        for (uint32 j = 0; j < record->const_count; j++) {
+            value  val;
+            uint64 payload = consts[j].payload;
+
+            switch ((bcache_const_tag) consts[j].tag) {
+                case BCACHE_CONST_BOOL: val = BOOL_VAL (payload != 0); break;
+                case BCACHE_CONST_FUNC:
+                    val = roots->items.values[header->string_count + payload];
+                    break;
+                case BCACHE_CONST_INT: val = INT_VAL ((int64) payload); break;
+                case BCACHE_CONST_NIL: val = NIL_VAL (); break;
+                case BCACHE_CONST_NUMBER: {
+                    double num;
+                    memcpy (&num, &payload, sizeof (num));
+                    val = NUMBER_VAL (num);
+                    break;
+                }
+                case BCACHE_CONST_STRING:
+                    val = roots->items.values[payload];
+                    break;
+                default: val = NIL_VAL (); break;
+            }
+
+            write_value_array (&func->chk.consts, val);
+        }
+    }
+
+    obj_func *script = AS_FUNC (roots->items.values[roots->items.count - 1]);
+    pop ();
+
+    return script;
+}
+
+// Returns the script compiled from `source` if `cache_path` holds it, or
+// NULL if the file is missing, stale or was written by another version. The
+// functions are attached to `module`, which the cache file does not record.
+obj_func *bcache_load (const char *cache_path, const char *source, size len,
+                       obj_module *module) {
+    if (cache_path == NULL) return NULL;
+
+    int fd = open (cache_path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat (fd, &st) != 0 || (uint64) st.st_size < sizeof (bcache_header)) {
+        close (fd);
+        return NULL;
+    }
+
+    size  file_size = (size) st.st_size;
+    void *base      = mmap (NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (base == MAP_FAILED) return NULL;
+
+    // The tables are checked for offsets and indices, but not the code, so
+    // a corrupted file is only caught by its checksum.
+    const bcache_header *header = (const bcache_header *) base;
+    if (!check_header (header, file_size, source, len) ||
+        header->checksum !=
+            hash_checksum (header + 1, file_size - sizeof (*header)) ||
+        !check_tables (base, header)) {
+        munmap (base, file_size);
+        return NULL;
+    }
+
+    keep_mapping (base, file_size);
+    return build (base, header, module);
+}
+
+void bcache_release (void) {
+    for (size i = 0; i < mapping_count; i++) {
+        munmap (mappings[i].base, mappings[i].len);
+    }
+
+    free (mappings);
+    mappings         = NULL;
+    mapping_count    = 0;
+    mapping_capacity = 0;
+}
+
+// Storing.
+
+typedef struct {
+    uint8 *data;
+    size   count;
+    size   capacity;
+} buffer;
+
+// Maps the strings and functions of a script to their table index.
+typedef struct {
+    obj   *key;
+    uint32 index;
+} index_entry;
+
+typedef struct {
+    index_entry *entries;
+    size         capacity;
+    size         count;
+    obj_string **strings;
+    size         string_count;
+    obj_func   **funcs;
+    size         func_count;
+    size         object_capacity;
+} writer;
+
+static bool reserve (buffer *buf, size len) {
+    if (buf->count + len <= buf->capacity) return true;
+
+    size capacity = buf->capacity < 256 ? 256 : buf->capacity;
+    while (capacity < buf->count + len) capacity *= 2;
+
+    uint8 *data = realloc (buf->data, capacity);
+    if (data == NULL) return false;
+
+    buf->data     = data;
+    buf->capacity = capacity;
+    return true;
+}
+
+// Appends `len` bytes at the next aligned offset and returns that offset.
+static bool append (buffer *buf, const void *data, size len, uint64 *offset) {
+    size start = (buf->count + BCACHE_ALIGN - 1) & ~(size) (BCACHE_ALIGN - 1);
+    if (!reserve (buf, start - buf->count + len)) return false;
+
+    memset (buf->data + buf->count, 0, start - buf->count);
+    if (len) memcpy (buf->data + start, data, len);
+    buf->count = start + len;
+
+    if (offset != NULL) *offset = start;
+    return true;
+}
+
+static index_entry *find_entry (writer *w, obj *key) {
+    size idx = ((uintptr_t) key >> 3) & (w->capacity - 1);
+    while (w->entries[idx].key != NULL && w->entries[idx].key != key) {
+        idx = (idx + 1) & (w->capacity - 1);
+    }
+
+    return &w->entries[idx];
+}
+
+// Returns the index of `object` in its table, adding it if it is new.
+static bool add_object (writer *w, obj *object, uint32 *index) {
+    if ((w->count + 1) * 2 > w->capacity) {
+        index_entry *old          = w->entries;
+        size         old_capacity = w->capacity;
+
+        w->capacity = old_capacity ? old_capacity * 2 : 64;
+        w->entries  = calloc (w->capacity, sizeof (index_entry));
+        if (w->entries == NULL) return false;
+
+        for (size i = 0; i < old_capacity; i++) {
+            if (old[i].key != NULL) *find_entry (w, old[i].key) = old[i];
+        }
+
+        free (old);
+    }
+
+    index_entry *entry = find_entry (w, object);
+    if (entry->key != NULL) {
+        *index = entry->index;
+        return true;
+    }
+
+    if (w->string_count + w->func_count == w->object_capacity) {
+        w->object_capacity = GROW_CAPACITY (w->object_capacity);
+        obj_string **strings =
+            realloc (w->strings, w->object_capacity * sizeof (obj_string *));
+        if (strings != NULL) w->strings = strings;
+        obj_func **funcs =
+            realloc (w->funcs, w->object_capacity * sizeof (obj_func *));
+        if (funcs != NULL) w->funcs = funcs;
+        if (strings == NULL || funcs == NULL) return false;
+    }
+
+    if (OBJ_TYPEOF (object) == OBJ_STRING) {
+        *index                        = (uint32) w->string_count;
+        w->strings[w->string_count++] = (obj_string *) object;
+    } else {
+        *index                    = (uint32) w->func_count;
+        w->funcs[w->func_count++] = (obj_func *) object;
+    }
+
+    entry->key   = object;
+    entry->index = *index;
+    w->count++;
+    return true;
+}
+
+// Numbers the strings and functions reachable from `func`, each function
+// after the ones it contains.
+static bool collect (writer *w, obj_func *func) {
+    uint32 index;
+
+    if (func->name != NULL && !add_object (w, (obj *) func->name, &index)) {
+        return false;
+    }
+
+    for (size i = 0; i < func->chk.consts.count; i++) {
+        value val = func->chk.consts.values[i];
+        if (!IS_OBJ (val)) continue;
+
+        if (IS_FUNC (val)) {
+            if (!collect (w, AS_FUNC (val))) return false;
+        } else if (IS_STRING (val)) {
+            if (!add_object (w, AS_OBJ (val), &index)) return false;
+        } else {
+            return false;
+        }
+    }
+
+    return add_object (w, (obj *) func, &index);
+}
+
+static bool encode_const (writer *w, value val, bcache_const *out) {
+    uint32 index = 0;
+
+    out->pad     = 0;
+    out->payload = 0;
+    switch (val.type) {
+        case VALUE_BOOL:
+            out->tag     = BCACHE_CONST_BOOL;
+            out->payload = AS_BOOL (val);
+            return true;
+        case VALUE_INT:
+            out->tag     = BCACHE_CONST_INT;
+            out->payload = (uint64) AS_INT (val);
+            return true;
+        case VALUE_NIL: out->tag = BCACHE_CONST_NIL; return true;
+        case VALUE_NUMBER: {
+            double num = AS_NUMBER (val);
+            out->tag   = BCACHE_CONST_NUMBER;
+            memcpy (&out->payload, &num, sizeof (num));
+            return true;
+        }
+        case VALUE_OBJ:
+            if (!add_object (w, AS_OBJ (val), &index)) return false;
+            out->tag =
+                IS_FUNC (val) ? BCACHE_CONST_FUNC : BCACHE_CONST_STRING;
+            out->payload = index;
+            return true;
+        default: break;
+    }
+
+    return false;
+}
+
+static bool serialize (writer *w, buffer *buf, const char *source, size len) {
+    bcache_header header;
+    memset (&header, 0, sizeof (header));
+    header.magic        = BCACHE_MAGIC;
+    header.version      = BCACHE_VERSION;
+    header.hash_probe   = STRING_HASH (BCACHE_PROBE, sizeof (BCACHE_PROBE) - 1);
+    header.word_size    = sizeof (size);
+    header.lazy         = lazy_compile_enabled ();
+    header.string_count = (uint32) w->string_count;
+    header.func_count   = (uint32) w->func_count;
+    header.source_key   = hash_checksum (source, len);
+    header.source_len   = len;
+
+    // The tables are filled in after everything they point to is appended.
+    if (!append (buf, &header, sizeof (header), NULL) ||
+        !append (buf, NULL, 0, &header.strings_offset) ||
+        !reserve (buf, w->string_count * sizeof (bcache_string))) {
+        return false;
+    }
+
+    buf->count += w->string_count * sizeof (bcache_string);
+    if (!append (buf, NULL, 0, &header.funcs_offset) ||
+        !reserve (buf, w->func_count * sizeof (bcache_func))) {
+        return false;
+    }
+
+    buf->count += w->func_count * sizeof (bcache_func);
+
+    for (size i = 0; i < w->string_count; i++) {
+        obj_string   *str = w->strings[i];
+        bcache_string record;
+
+        record.len  = (uint32) str->len;
+        record.hash = IS_INTERNED (str) ? str->hash
+                                        : STRING_HASH (str->data, str->len);
+        if (!append (buf, str->data, str->len + 1, &record.data_offset)) {
+            return false;
+        }
+
+        memcpy (buf->data + header.strings_offset + i * sizeof (record),
+                &record, sizeof (record));
+    }
+
+    for (size i = 0; i < w->func_count; i++) {
+        obj_func   *func = w->funcs[i];
+        bcache_func record;
+        uint32      name = 0;
+
+        if (func->name != NULL) add_object (w, (obj *) func->name, &name);
+        record.arity         = func->arity;
+        record.upvalue_count = func->upvalue_count;
+        record.name          = func->name ? (int32) name : BCACHE_NO_NAME;
+        record.const_count   = (uint32) func->chk.consts.count;
+        record.code_len      = func->chk.count;
+        record.line_count    = func->chk.line_count;
+
+        if (!append (buf, NULL, 0, &record.const_offset)) return false;
+        for (size j = 0; j < func->chk.consts.count; j++) {
+            bcache_const entry;
+            if (!encode_const (w, func->chk.consts.values[j], &entry) ||
+                !append (buf, &entry, sizeof (entry), NULL)) {
+                return false;
+            }
+        }
+
+        if (!append (buf, func->chk.code, func->chk.count,
+                     &record.code_offset) ||
+            !append (buf, func->chk.lines,
+                     func->chk.line_count * sizeof (line_run),
+                     &record.lines_offset)) {
+            return false;
+        }
+
+        memcpy (buf->data + header.funcs_offset + i * sizeof (record),
+                &record, sizeof (record));
+    }
+
+    header.file_size = buf->count;
+    header.checksum  = hash_checksum (buf->data + sizeof (header),
+                                      buf->count - sizeof (header));
+    memcpy (buf->data, &header, sizeof (header));
+    return true;
+}
+
+// Writes the cache file for `script`, compiled from `source`. The file is
+// written under a temporary name and renamed into place, so a concurrent
+// reader never sees half of it.
+bool bcache_store (const char *cache_path, const char *source, size len,
+                   obj_func *script) {
+    if (cache_path == NULL) return false;
+
+    writer w;
+    buffer buf = {NULL, 0, 0};
+    memset (&w, 0, sizeof (w));
+
+    bool ok = collect (&w, script) && serialize (&w, &buf, source, len);
+    if (ok) {
+        size  tmp_len = strlen (cache_path) + 32;
+        char *tmp     = malloc (tmp_len);
+        FILE *file    = NULL;
+
+        if (tmp != NULL) {
+            snprintf (tmp, tmp_len, "%s.%ld.tmp", cache_path,
+                      (long) getpid ());
+            file = fopen (tmp, "wb");
+        }
+
+        ok = file != NULL;
+        if (ok) {
+            ok = fwrite (buf.data, 1, buf.count, file) == buf.count;
+            ok = fclose (file) == 0 && ok;
+            ok = ok && rename (tmp, cache_path) == 0;
+            if (!ok) remove (tmp);
+        }
+
+        free (tmp);
+    }
+
+    free (buf.data);
+    free (w.entries);
+    free (w.strings);
+    free (w.funcs);
+    return ok;
+}
@@ -0,0 +1,31 @@
+// apachejuice, 18.10.2026
+// See LICENSE for details.
+#ifndef __ALOXOTL_BCACHE__
+#define __ALOXOTL_BCACHE__
+
+#include "common.h"
+#include "obj.h"
+
+// Compiled scripts are cached on disk, keyed by a hash of their source and
+// whether functions are compiled lazily. A cache file holds the whole
+// function tree of a script: interned strings with their hashes, then every
+// function after the functions it contains. Loading maps the file and points
+// each chunk's code and lines straight into the mapping; the mappings stay
+// alive until bcache_release. The code is run without being verified, so
+// files whose checksum does not match are ignored.
+//
+// Bump whenever an opcode is added, removed or reordered, an instruction's
+// encoding changes, or the file layout below changes.
+#define BCACHE_VERSION 6
+
+// Returns the cache file for the script at `script_path`: under
+// $ALOXOTL_CACHE_DIR if that is set, next to the script otherwise. The caller
+// frees the result.
+char     *bcache_path (const char *script_path, const char *source, size len);
+obj_func *bcache_load (const char *cache_path, const char *source, size len,
+                       obj_module *module);
+bool      bcache_store (const char *cache_path, const char *source, size len,
+                        obj_func *script);
+void      bcache_release (void);
+
+#endif
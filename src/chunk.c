@@ -7,37 +7,27 @@
 #include "vm.h"
 
 void init_chunk (chunk *chunk) {
-    chunk->count    = 0;
-    chunk->capacity = 0;
-    chunk->code     = NULL;
-    chunk->lines    = NULL;
+    chunk->count         = 0;
+    chunk->capacity      = 0;
+    chunk->code          = NULL;
+    chunk->lines         = NULL;
+    chunk->line_count    = 0;
+    chunk->line_capacity = 0;
+    chunk->mapped        = false;
 
     init_value_array (&chunk->consts);
 }
 
 void free_chunk (chunk *chunk) {
-    FREE_ARRAY (uint8, chunk->code, chunk->capacity);
-    FREE_ARRAY (size, chunk->lines, chunk->capacity);
+    if (!chunk->mapped) {
+        FREE_ARRAY (uint8, chunk->code, chunk->capacity);
+        FREE_ARRAY (line_run, chunk->lines, chunk->line_capacity);
+    }
 
     free_value_array (&chunk->consts);
     init_chunk (chunk);
 }
 
-void write_chunk (chunk *chunk, uint8 byte, size line) {
-    if (chunk->capacity < chunk->count + 1) {
-        size old_capacity = chunk->capacity;
-        chunk->capacity   = GROW_CAPACITY (old_capacity);
-        chunk->code =
-            GROW_ARRAY (uint8, chunk->code, old_capacity, chunk->capacity);
-        chunk->lines =
-            GROW_ARRAY (size, chunk->lines, old_capacity, chunk->capacity);
-    }
-
-    chunk->code[chunk->count]  = byte;
-    chunk->lines[chunk->count] = line;
-    chunk->count++;
-}
-
 int add_constant (chunk *chunk, value val) {
     push (val);
     write_value_array (&chunk->consts, val);
@@ -45,3 +35,22 @@ int add_constant (chunk *chunk, value val) {
 
     return chunk->consts.count - 1;
 }
+
+// Finds the run holding `offset` by binary search. Offsets past the last
+// run, which a damaged cache file could produce, get the last line.
+size get_line (const chunk *chunk, size offset) {
+    if (chunk->line_count == 0) return 0;
+
+    size low  = 0;
+    size high = chunk->line_count - 1;
+    while (low < high) {
+        size mid = low + (high - low) / 2;
+        if (chunk->lines[mid].end > offset) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+
+    return chunk->lines[low].line;
+}
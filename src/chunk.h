@@ -8,6 +8,12 @@
 
 typedef enum {
     OP_ADD,
+    OP_BIND_MODULE,
+    OP_BIT_AND,
+    OP_BIT_NOT,
+    OP_BIT_OR,
+    OP_BIT_XOR,
+    OP_BUILD_LIST,
     OP_CALL,
     OP_CLASS,
     OP_CLOSE_UPVALUE,
@@ -18,15 +24,21 @@ typedef enum {
     OP_EQUAL,
     OP_FALSE,
     OP_GET_GLOBAL,
+    OP_GET_INDEX,
     OP_GET_LOCAL,
     OP_GET_PROPERTY,
+    OP_GET_SUPER,
     OP_GET_UPVALUE,
     OP_GREATER,
+    OP_IMPORT,
+    OP_INHERIT,
+    OP_INT_DIVIDE,
     OP_JUMP_IF_FALSE,
     OP_JUMP,
     OP_LESS,
     OP_LOOP,
     OP_METHOD,
+    OP_MODULO,
     OP_MULTIPLY,
     OP_NEGATE,
     OP_NIL,
@@ -35,24 +47,42 @@ typedef enum {
     OP_PRINT,
     OP_RETURN,
     OP_SET_GLOBAL,
+    OP_SET_INDEX,
     OP_SET_LOCAL,
     OP_SET_PROPERTY,
     OP_SET_UPVALUE,
+    OP_SHIFT_LEFT,
+    OP_SHIFT_RIGHT,
     OP_SUBTRACT,
+    OP_SUPER_INVOKE,
     OP_TRUE,
 } opcode;
 
+// The line table is run-length encoded: a run holds the line of the code
+// from the end of the run before it up to `end`. Statements compile to
+// several bytes each, so this is far smaller than a line per byte, and it
+// is only read to report errors and to disassemble.
+typedef struct {
+    uint32 line;
+    uint32 end;
+} line_run;
+
+// A chunk loaded from a bytecode cache file has `mapped` set: its code and
+// lines point into the file mapping and are not freed with the chunk.
 typedef struct {
     size        count;
     size        capacity;
     uint8      *code;
     value_array consts;
-    size       *lines;
+    line_run   *lines;
+    size        line_count;
+    size        line_capacity;
+    bool        mapped;
 } chunk;
 
 void init_chunk (chunk *chunk);
 void free_chunk (chunk *chunk);
-void write_chunk (chunk *chunk, uint8 byte, size line);
 int  add_constant (chunk *chunk, value val);
+size get_line (const chunk *chunk, size offset);
 
 #endif
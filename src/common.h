@@ -12,6 +12,10 @@
 #define DEBUG_STRESS_GC
 // #define DEBUG_LOG_GC
 
+// Strings built at runtime are only hashed and interned once they are used
+// as a key. Comment out to intern every string as soon as it is created.
+#define LAZY_INTERN
+
 #define UINT8_COUNT (UINT8_MAX + 1)
 
 // Friendlier names.
@@ -1,26 +1,50 @@
 // apachejuice, 27.02.2024
 // See LICENSE for details.
+#define _DEFAULT_SOURCE
+
 #include "compiler.h"
 #include "chunk.h"
 #include "common.h"
 #include "debug.h"
+#include "hash.h"
 #include "memory.h"
 #include "scanner.h"
 #include "obj.h"
+#include "vm.h"
 
+#include <errno.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-
-struct {
-    token current;
-    token previous;
-    bool  had_error;
-    bool  panic_mode;
-} parser;
-chunk *cur_chunk;
+#include <unistd.h>
+
+// At most this many threads compile at once, the calling one included.
+#define COMPILE_THREADS_MAX 64
+
+// A function compiled lazily has no code until its first call. Until then
+// its constants describe the body, so the collector, the bytecode cache and
+// heap images treat it like any other function:
+//   LAZY_TEXT    the source of the parameter list and body
+//   LAZY_INFO    an int: the func_type and the LAZY_ flags of the class
+//                around it
+//   LAZY_LINE    an int: the line the text starts at
+//   LAZY_COLUMN  an int: the column the text starts at
+//   LAZY_NAMES   and on, the name each upvalue captures, in upvalue order
+#define LAZY_TEXT 0
+#define LAZY_INFO 1
+#define LAZY_LINE 2
+#define LAZY_COLUMN 3
+#define LAZY_NAMES 4
+
+#define LAZY_FTYPE_MASK 0x3
+#define LAZY_IN_CLASS 0x4
+#define LAZY_HAS_SUPER 0x8
+
+static bool lazy_compile = true;
 
 typedef enum {
     PREC_NONE,
@@ -29,6 +53,10 @@ typedef enum {
     PREC_AND,
     PREC_EQ,
     PREC_COMP,
+    PREC_BIT_OR,
+    PREC_BIT_XOR,
+    PREC_BIT_AND,
+    PREC_SHIFT,
     PREC_TERM,
     PREC_FACTOR,
     PREC_UNARY,
@@ -36,13 +64,37 @@ typedef enum {
     PREC_PRIMARY,
 } precedence;
 
-typedef void (*parse_fn) (bool can_assign);
+typedef enum {
+    PCONST_FUNC,
+    PCONST_STRING,
+    PCONST_VALUE,
+} pconst_kind;
 
+// Strings point into the source. Functions are owned by the proto whose
+// constant they are.
 typedef struct {
-    parse_fn   prefix;
-    parse_fn   infix;
-    precedence prec;
-} parse_rule;
+    pconst_kind kind;
+    value       val;
+    const char *chars;
+    size        len;
+    func_proto *func;
+} proto_const;
+
+struct _func_proto {
+    int32        arity;
+    int32        upvalue_count;
+    const char  *name;  // NULL for scripts
+    size         name_len;
+    uint8       *code;
+    size         count;
+    size         capacity;
+    line_run    *lines;
+    size         line_count;
+    size         line_capacity;
+    proto_const *consts;
+    size         const_count;
+    size         const_capacity;
+};
 
 typedef struct {
     token name;
@@ -53,6 +105,7 @@ typedef struct {
 typedef struct {
     uint8 index;
     bool  is_local;
+    token name;
 } upvalue;
 
 #define LOCALS_MAX UINT8_COUNT
@@ -64,42 +117,100 @@ typedef enum {
     FTYPE_SCRIPT,
 } func_type;
 
+// An entry of the index from strings and values to their slot in the
+// constant pool. `slot` is -1 in empty entries.
+typedef struct {
+    uint32 hash;
+    int32  slot;
+} const_entry;
+
 typedef struct _comp {
     struct _comp *enclosing;
 
-    obj_func *func;
-    func_type ftype;
+    func_proto *proto;
+    func_type   ftype;
 
     localvar locals[LOCALS_MAX];
     int32    local_count;
     upvalue  upvalues[UINT8_COUNT];
     int32    scope_depth;
+
+    const_entry *const_index;
+    size         index_capacity;
 } compiler_t;
 
 typedef struct _classcomp {
     struct _classcomp *enclosing;
+    bool               has_superclass;
 } class_compiler;
 
-compiler_t     *current       = NULL;
-class_compiler *current_class = NULL;
+// Everything one compilation works on. Nothing else is shared, so separate
+// compilations can run on separate threads. When a lazy function body is
+// compiled, `captures` names the upvalues of the outermost function. While
+// `checking`, code is only counted, not stored, so that a lazy body reports
+// the same errors as compiling it would, including code that is too large.
+typedef struct {
+    scanner_t       scanner;
+    token           current;
+    token           previous;
+    bool            had_error;
+    bool            panic_mode;
+    bool            report;
+    bool            lazy;
+    bool            checking;
+    compiler_t     *compiler;
+    class_compiler *klass;
+    token          *captures;
+    int32           capture_count;
+} parser_t;
+
+typedef void (*parse_fn) (parser_t *parser, bool can_assign);
 
-static void        expression (void);
-static void        statement (void);
-static void        declaration (void);
-static void        parse_precedence (precedence prec);
+typedef struct {
+    parse_fn   prefix;
+    parse_fn   infix;
+    precedence prec;
+} parse_rule;
+
+static void        expression (parser_t *parser);
+static void        statement (parser_t *parser);
+static void        declaration (parser_t *parser);
+static void        parse_precedence (parser_t *parser, precedence prec);
 static parse_rule *get_rule (token_type type);
-static uint8       identifier_constant (token *name);
-static int32       resolve_local (compiler_t *compiler, token *name);
-static int32       resolve_upvalue (compiler_t *compiler, token *name);
+static uint8       identifier_constant (parser_t *parser, token *name);
+static int32       resolve_local (parser_t *parser, compiler_t *compiler,
+                                  token *name);
+static int32       resolve_upvalue (parser_t *parser, compiler_t *compiler,
+                                    token *name);
+
+// Compiling stays off the heap, so it grows its arrays with plain realloc.
+static void *resize (void *data, size bytes) {
+    data = realloc (data, bytes);
+    if (data == NULL) exit (1);
+
+    return data;
+}
+
+// Trims an array grown by doubling to `bytes`.
+static void *shrink (void *data, size bytes) {
+    if (bytes > 0) return resize (data, bytes);
+
+    free (data);
+    return NULL;
+}
 
-static chunk *current_chunk (void) {
-    return &current->func->chk;
+static func_proto *current_proto (parser_t *parser) {
+    return parser->compiler->proto;
 }
 
-static void error_at (token *tok, const char *msg, va_list ap) {
-    if (parser.panic_mode) return;
+static void error_at (parser_t *parser, token *tok, const char *msg,
+                      va_list ap) {
+    if (parser->panic_mode) return;
+
+    parser->panic_mode = true;
+    parser->had_error  = true;
+    if (!parser->report) return;
 
-    parser.panic_mode = true;
     fprintf (stderr, "[%zu:%zu] Error", tok->line, tok->column);
 
     if (tok->type == TOKEN_EOF) {
@@ -111,144 +222,281 @@ static void error_at (token *tok, const char *msg, va_list ap) {
     fprintf (stderr, ": ");
     vfprintf (stderr, msg, ap);
     fprintf (stderr, "\n");
-
-    parser.had_error = true;
 }
 
-static void error_at_current (const char *msg, ...) {
+static void error_at_current (parser_t *parser, const char *msg, ...) {
     va_list ap;
     va_start (ap, msg);
 
-    error_at (&parser.current, msg, ap);
+    error_at (parser, &parser->current, msg, ap);
     va_end (ap);
 }
 
-static void error (const char *msg, ...) {
+static void error (parser_t *parser, const char *msg, ...) {
     va_list ap;
     va_start (ap, msg);
 
-    error_at (&parser.previous, msg, ap);
+    error_at (parser, &parser->previous, msg, ap);
     va_end (ap);
 }
 
-static void advance (void) {
-    parser.previous = parser.current;
+static void advance (parser_t *parser) {
+    parser->previous = parser->current;
 
     while (1) {
-        parser.current = scan_token ();
-        if (parser.current.type != TOKEN_ERROR) break;
+        parser->current = scan_token (&parser->scanner);
+        if (parser->current.type != TOKEN_ERROR) break;
 
-        error_at_current (parser.current.start);
+        error_at_current (parser, parser->current.start);
 
         // Error tokens require freeing the lexeme.
-        FREE (char, (char *) parser.current.start);
+        free ((char *) parser->current.start);
     }
 }
 
-static void consumev (token_type type, const char *msg, va_list ap) {
-    if (parser.current.type == type) {
-        advance ();
+static void consumev (parser_t *parser, token_type type, const char *msg,
+                      va_list ap) {
+    if (parser->current.type == type) {
+        advance (parser);
         return;
     }
 
-    error_at (&parser.current, msg, ap);
+    error_at (parser, &parser->current, msg, ap);
 }
 
-static void consume (token_type type, const char *msg, ...) {
+static void consume (parser_t *parser, token_type type, const char *msg,
+                     ...) {
     va_list ap;
     va_start (ap, msg);
-    consumev (type, msg, ap);
+    consumev (parser, type, msg, ap);
     va_end (ap);
 }
 
-static bool check (token_type type) {
-    return parser.current.type == type;
+static bool check (parser_t *parser, token_type type) {
+    return parser->current.type == type;
 }
 
-static bool match (token_type type) {
-    if (!check (type)) return false;
+static bool match (parser_t *parser, token_type type) {
+    if (!check (parser, type)) return false;
 
-    advance ();
+    advance (parser);
     return true;
 }
 
-static void emit_byte (uint8 byte) {
-    write_chunk (current_chunk (), byte, parser.previous.line);
+static void emit_byte (parser_t *parser, uint8 byte) {
+    func_proto *proto = current_proto (parser);
+    uint32      line  = (uint32) parser->previous.line;
+    if (parser->checking) {
+        proto->count++;
+        return;
+    }
+
+    if (proto->capacity < proto->count + 1) {
+        proto->capacity = GROW_CAPACITY (proto->capacity);
+        proto->code     = resize (proto->code, proto->capacity);
+    }
+
+    proto->code[proto->count++] = byte;
+    if (proto->line_count > 0 &&
+        proto->lines[proto->line_count - 1].line == line) {
+        proto->lines[proto->line_count - 1].end = (uint32) proto->count;
+        return;
+    }
+
+    if (proto->line_capacity < proto->line_count + 1) {
+        proto->line_capacity = GROW_CAPACITY (proto->line_capacity);
+        proto->lines         = resize (
+            proto->lines, proto->line_capacity * sizeof (line_run));
+    }
+
+    line_run run                      = {line, (uint32) proto->count};
+    proto->lines[proto->line_count++] = run;
 }
 
-static inline void emit_bytes (uint8 b1, uint8 b2) {
-    emit_byte (b1);
-    emit_byte (b2);
+static inline void emit_bytes (parser_t *parser, uint8 b1, uint8 b2) {
+    emit_byte (parser, b1);
+    emit_byte (parser, b2);
 }
 
-static void emit_loop (int32 loop_start) {
-    emit_byte (OP_LOOP);
+static void emit_loop (parser_t *parser, int32 loop_start) {
+    emit_byte (parser, OP_LOOP);
 
-    int32 offset = current_chunk ()->count - loop_start + 2;
+    int32 offset = current_proto (parser)->count - loop_start + 2;
     if (offset > UINT16_MAX)
-        error ("Loop body too large! Maximum %d ops\n", UINT16_MAX);
+        error (parser, "Loop body too large! Maximum %d ops\n", UINT16_MAX);
 
-    emit_byte ((offset >> 8) & 0xff);
-    emit_byte (offset & 0xff);
+    emit_byte (parser, (offset >> 8) & 0xff);
+    emit_byte (parser, offset & 0xff);
 }
 
-static int32 emit_jump (uint8 instruction) {
-    emit_byte (instruction);
-    emit_bytes (0xff, 0xff);
-    return current_chunk ()->count - 2;
+static int32 emit_jump (parser_t *parser, uint8 instruction) {
+    emit_byte (parser, instruction);
+    emit_bytes (parser, 0xff, 0xff);
+    return current_proto (parser)->count - 2;
 }
 
-static void implicit_return (void) {
-    if (current->ftype == FTYPE_INITIALIZER) {
-        emit_bytes (OP_GET_LOCAL, 0);
+static void implicit_return (parser_t *parser) {
+    if (parser->compiler->ftype == FTYPE_INITIALIZER) {
+        emit_bytes (parser, OP_GET_LOCAL, 0);
     } else {
-        emit_byte (OP_NIL);
+        emit_byte (parser, OP_NIL);
     }
 
-    emit_byte (OP_NIL);
-    emit_byte (OP_RETURN);
+    emit_byte (parser, OP_RETURN);
 }
 
-static uint8 make_constant (value val) {
-    int32 constant = add_constant (current_chunk (), val);
-    if (constant > UINT8_MAX) {
-        error ("Too many constants in one chunk! Maximum %d\n", UINT8_MAX);
+static uint8 make_constant (parser_t *parser, proto_const constant) {
+    func_proto *proto = current_proto (parser);
+    if (proto->const_capacity < proto->const_count + 1) {
+        proto->const_capacity = GROW_CAPACITY (proto->const_capacity);
+        proto->consts         = resize (
+            proto->consts, proto->const_capacity * sizeof (proto_const));
+    }
+
+    proto->consts[proto->const_count] = constant;
+    size index                        = proto->const_count++;
+    if (index > UINT8_MAX) {
+        error (parser, "Too many constants in one chunk! Maximum %d\n",
+               UINT8_MAX);
         return 0;
     }
 
-    return (uint8) constant;
+    return (uint8) index;
+}
+
+// Literals only ever make ints and doubles. Doubles are compared by their
+// bits, which keeps 0.0 and -0.0 apart.
+static uint64 value_bits (value val) {
+    uint64 bits = 0;
+    if (IS_INT (val)) {
+        bits = (uint64) AS_INT (val);
+    } else if (IS_NUMBER (val)) {
+        double num = AS_NUMBER (val);
+        memcpy (&bits, &num, sizeof (bits));
+    }
+
+    return bits;
 }
 
-static void emit_constant (value val) {
-    emit_bytes (OP_CONSTANT, make_constant (val));
+static uint32 constant_hash (const proto_const *constant) {
+    if (constant->kind == PCONST_STRING) {
+        return hash_fnv1a (constant->chars, constant->len);
+    }
+
+    uint64 bits = value_bits (constant->val);
+    return hash_fnv1a ((const char *) &bits, sizeof (bits)) ^
+           (uint32) constant->val.type;
+}
+
+static bool constants_equal (const proto_const *a, const proto_const *b) {
+    if (a->kind != b->kind) return false;
+    if (a->kind == PCONST_STRING) {
+        return a->len == b->len && memcmp (a->chars, b->chars, a->len) == 0;
+    }
+
+    return a->val.type == b->val.type &&
+           value_bits (a->val) == value_bits (b->val);
 }
 
-static void patch_jump (int32 offset) {
-    int32 jump = current_chunk ()->count - offset - 2;
+static void grow_index (compiler_t *compiler) {
+    const_entry *old          = compiler->const_index;
+    size         old_capacity = compiler->index_capacity;
+    size         capacity     = old_capacity < 16 ? 16 : old_capacity * 2;
+
+    compiler->const_index    = resize (NULL, capacity * sizeof (const_entry));
+    compiler->index_capacity = capacity;
+    for (size i = 0; i < capacity; i++) compiler->const_index[i].slot = -1;
+
+    for (size i = 0; i < old_capacity; i++) {
+        if (old[i].slot < 0) continue;
+
+        size idx = old[i].hash & (capacity - 1);
+        while (compiler->const_index[idx].slot >= 0) {
+            idx = (idx + 1) & (capacity - 1);
+        }
+
+        compiler->const_index[idx] = old[i];
+    }
+
+    free (old);
+}
+
+// Returns the slot of an equal string or value already in the pool, and
+// only adds `constant` if there is none. A name mentioned forty times still
+// takes one slot.
+static uint8 unique_constant (parser_t *parser, proto_const constant) {
+    compiler_t *compiler = parser->compiler;
+    func_proto *proto    = compiler->proto;
+
+    // Functions are not in the index, so this overestimates the load.
+    if ((proto->const_count + 1) * 4 > compiler->index_capacity * 3) {
+        grow_index (compiler);
+    }
+
+    uint32 hash = constant_hash (&constant);
+    size   mask = compiler->index_capacity - 1;
+    for (size idx = hash & mask;; idx = (idx + 1) & mask) {
+        const_entry *entry = &compiler->const_index[idx];
+        if (entry->slot < 0) {
+            uint8 slot  = make_constant (parser, constant);
+            entry->hash = hash;
+            entry->slot = (int32) proto->const_count - 1;
+            return slot;
+        }
+
+        if (entry->hash == hash &&
+            constants_equal (&proto->consts[entry->slot], &constant)) {
+            return (uint8) entry->slot;
+        }
+    }
+}
+
+static uint8 value_constant (parser_t *parser, value val) {
+    proto_const constant = {.kind = PCONST_VALUE, .val = val};
+    return unique_constant (parser, constant);
+}
+
+static uint8 string_constant (parser_t *parser, const char *chars, size len) {
+    proto_const constant = {.kind = PCONST_STRING, .chars = chars, .len = len};
+    return unique_constant (parser, constant);
+}
+
+static void emit_constant (parser_t *parser, value val) {
+    emit_bytes (parser, OP_CONSTANT, value_constant (parser, val));
+}
+
+static void patch_jump (parser_t *parser, int32 offset) {
+    func_proto *proto = current_proto (parser);
+    int32       jump  = proto->count - offset - 2;
 
     if (jump > UINT16_MAX) {
-        error ("Too much code to jump over! offset = %d", jump);
+        error (parser, "Too much code to jump over! offset = %d", jump);
     }
 
-    current_chunk ()->code[offset]     = (jump >> 8) & 0xff;
-    current_chunk ()->code[offset + 1] = jump & 0xff;
+    if (parser->checking) return;
+
+    proto->code[offset]     = (jump >> 8) & 0xff;
+    proto->code[offset + 1] = jump & 0xff;
 }
 
-static void init_compiler (compiler_t *compiler, func_type ftype) {
-    compiler->enclosing   = current;
-    compiler->func        = NULL;
-    compiler->local_count = 0;
-    compiler->scope_depth = 0;
-    compiler->ftype       = ftype;
-    compiler->func        = new_func ();
-    current               = compiler;
+static void init_compiler (parser_t *parser, compiler_t *compiler,
+                           func_type ftype) {
+    compiler->enclosing      = parser->compiler;
+    compiler->local_count    = 0;
+    compiler->scope_depth    = 0;
+    compiler->ftype          = ftype;
+    compiler->const_index    = NULL;
+    compiler->index_capacity = 0;
+    compiler->proto          = calloc (1, sizeof (func_proto));
+    if (compiler->proto == NULL) exit (1);
+    parser->compiler = compiler;
 
     if (ftype != FTYPE_SCRIPT) {
-        current->func->name =
-            copy_string (parser.previous.start, parser.previous.len);
+        compiler->proto->name     = parser->previous.start;
+        compiler->proto->name_len = parser->previous.len;
     }
 
-    localvar *local = &current->locals[current->local_count++];
+    localvar *local = &compiler->locals[compiler->local_count++];
     local->depth    = 0;
     local->captured = false;
 
@@ -262,255 +510,374 @@ static void init_compiler (compiler_t *compiler, func_type ftype) {
     }
 }
 
-static obj_func *end_compiler (void) {
-    implicit_return ();
-    obj_func *func = current->func;
+// A finished proto stays around until it is published, for a whole batch
+// of them when modules are compiled in parallel, so it gives back the room
+// its arrays grew into.
+static void shrink_proto (func_proto *proto) {
+    proto->code           = shrink (proto->code, proto->count);
+    proto->capacity       = proto->count;
+    proto->lines          = shrink (proto->lines,
+                                    proto->line_count * sizeof (line_run));
+    proto->line_capacity  = proto->line_count;
+    proto->consts         = shrink (proto->consts,
+                                    proto->const_count * sizeof (proto_const));
+    proto->const_capacity = proto->const_count;
+}
 
-#ifdef DEBUG_PRINT_CODE
-    if (!parser.had_error) {
-        disassemble_chunk (current_chunk (),
-                           func->name != NULL ? func->name->data : "<script>");
-    }
-#endif
+static func_proto *end_compiler (parser_t *parser) {
+    implicit_return (parser);
+    func_proto *proto = parser->compiler->proto;
+    shrink_proto (proto);
 
-    current = current->enclosing;
-    return func;
+    free (parser->compiler->const_index);
+    parser->compiler = parser->compiler->enclosing;
+    return proto;
 }
 
-static void begin_scope (void) {
-    current->scope_depth++;
+static void begin_scope (parser_t *parser) {
+    parser->compiler->scope_depth++;
 }
 
-static void end_scope (void) {
+static void end_scope (parser_t *parser) {
+    compiler_t *current = parser->compiler;
     current->scope_depth--;
 
     while (current->local_count > 0 &&
            current->locals[current->local_count - 1].depth >
                current->scope_depth) {
         if (current->locals[current->local_count - 1].captured) {
-            emit_byte (OP_CLOSE_UPVALUE);
+            emit_byte (parser, OP_CLOSE_UPVALUE);
         } else {
-            emit_byte (OP_POP);
+            emit_byte (parser, OP_POP);
         }
         current->local_count--;
     }
 }
 
-static void binary (bool can_assign) {
-    token_type  op_type = parser.previous.type;
+static void binary (parser_t *parser, bool can_assign) {
+    token_type  op_type = parser->previous.type;
     parse_rule *rule    = get_rule (op_type);
-    parse_precedence (rule->prec + 1);
+    parse_precedence (parser, rule->prec + 1);
 
     switch (op_type) {
-        case TOKEN_BANG_EQUAL: emit_bytes (OP_EQUAL, OP_NOT); break;
-        case TOKEN_EQUAL_EQUAL: emit_byte (OP_EQUAL); break;
-        case TOKEN_GREATER: emit_byte (OP_GREATER); break;
-        case TOKEN_GREATER_EQUAL: emit_bytes (OP_LESS, OP_NOT); break;
-        case TOKEN_LESS: emit_byte (OP_LESS); break;
-        case TOKEN_LESS_EQUAL: emit_bytes (OP_GREATER, OP_NOT); break;
-        case TOKEN_PLUS: emit_byte (OP_ADD); break;
-        case TOKEN_MINUS: emit_byte (OP_SUBTRACT); break;
-        case TOKEN_STAR: emit_byte (OP_MULTIPLY); break;
-        case TOKEN_SLASH: emit_byte (OP_DIVIDE); break;
+        case TOKEN_BANG_EQUAL: emit_bytes (parser, OP_EQUAL, OP_NOT); break;
+        case TOKEN_EQUAL_EQUAL: emit_byte (parser, OP_EQUAL); break;
+        case TOKEN_GREATER: emit_byte (parser, OP_GREATER); break;
+        case TOKEN_GREATER_EQUAL:
+            emit_bytes (parser, OP_LESS, OP_NOT);
+            break;
+        case TOKEN_LESS: emit_byte (parser, OP_LESS); break;
+        case TOKEN_LESS_EQUAL: emit_bytes (parser, OP_GREATER, OP_NOT); break;
+        case TOKEN_PLUS: emit_byte (parser, OP_ADD); break;
+        case TOKEN_MINUS: emit_byte (parser, OP_SUBTRACT); break;
+        case TOKEN_STAR: emit_byte (parser, OP_MULTIPLY); break;
+        case TOKEN_SLASH: emit_byte (parser, OP_DIVIDE); break;
+        case TOKEN_TILDE_SLASH: emit_byte (parser, OP_INT_DIVIDE); break;
+        case TOKEN_PERCENT: emit_byte (parser, OP_MODULO); break;
+        case TOKEN_AMPERSAND: emit_byte (parser, OP_BIT_AND); break;
+        case TOKEN_PIPE: emit_byte (parser, OP_BIT_OR); break;
+        case TOKEN_CARET: emit_byte (parser, OP_BIT_XOR); break;
+        case TOKEN_LESS_LESS: emit_byte (parser, OP_SHIFT_LEFT); break;
+        case TOKEN_GREATER_GREATER:
+            emit_byte (parser, OP_SHIFT_RIGHT);
+            break;
 
         default: return;
     }
 }
 
-static uint8 argument_list (void) {
+static uint8 argument_list (parser_t *parser) {
     uint8 argc = 0;
-    if (!check (TOKEN_RIGHT_PAREN)) {
+    if (!check (parser, TOKEN_RIGHT_PAREN)) {
         do {
-            expression ();
+            expression (parser);
             if (argc == UINT8_MAX) {
-                error ("Function cannot have more than 255 arguments");
+                error (parser,
+                       "Function cannot have more than 255 arguments");
             }
 
             argc++;
-        } while (match (TOKEN_COMMA));
+        } while (match (parser, TOKEN_COMMA));
     }
 
-    consume (TOKEN_RIGHT_PAREN, "Expected ')' after argument list");
+    consume (parser, TOKEN_RIGHT_PAREN, "Expected ')' after argument list");
     return argc;
 }
 
-static void call (bool can_assign) {
-    uint8 argc = argument_list ();
-    emit_bytes (OP_CALL, argc);
+static void call (parser_t *parser, bool can_assign) {
+    uint8 argc = argument_list (parser);
+    emit_bytes (parser, OP_CALL, argc);
+}
+
+static void dot (parser_t *parser, bool can_assign) {
+    consume (parser, TOKEN_IDENTIFIER,
+             "Expected property name to follow `.`");
+    uint8 name = identifier_constant (parser, &parser->previous);
+
+    if (can_assign && match (parser, TOKEN_EQUAL)) {
+        expression (parser);
+        emit_bytes (parser, OP_SET_PROPERTY, name);
+    } else {
+        emit_bytes (parser, OP_GET_PROPERTY, name);
+    }
+}
+
+static void list (parser_t *parser, bool can_assign) {
+    int32 count = 0;
+    if (!check (parser, TOKEN_RIGHT_BRACKET)) {
+        do {
+            // Trailing comma.
+            if (check (parser, TOKEN_RIGHT_BRACKET)) break;
+
+            expression (parser);
+            if (++count > UINT8_MAX) {
+                error (parser,
+                       "List literal cannot have more than 255 elements");
+            }
+        } while (match (parser, TOKEN_COMMA));
+    }
+
+    consume (parser, TOKEN_RIGHT_BRACKET,
+             "Expected ']' to end a list literal");
+    emit_bytes (parser, OP_BUILD_LIST, (uint8) count);
 }
 
-static void dot (bool can_assign) {
-    consume (TOKEN_IDENTIFIER, "Expected property name to follow `.`");
-    uint8 name = identifier_constant (&parser.previous);
+static void subscript (parser_t *parser, bool can_assign) {
+    expression (parser);
+    consume (parser, TOKEN_RIGHT_BRACKET, "Expected ']' after an index");
 
-    if (can_assign && match (TOKEN_EQUAL)) {
-        expression ();
-        emit_bytes (OP_SET_PROPERTY, name);
+    if (can_assign && match (parser, TOKEN_EQUAL)) {
+        expression (parser);
+        emit_byte (parser, OP_SET_INDEX);
     } else {
-        emit_bytes (OP_GET_PROPERTY, name);
+        emit_byte (parser, OP_GET_INDEX);
     }
 }
 
-static void literal (bool can_assign) {
-    switch (parser.previous.type) {
-        case TOKEN_FALSE: emit_byte (OP_FALSE); break;
-        case TOKEN_NIL: emit_byte (OP_NIL); break;
-        case TOKEN_TRUE: emit_byte (OP_TRUE); break;
+static void literal (parser_t *parser, bool can_assign) {
+    switch (parser->previous.type) {
+        case TOKEN_FALSE: emit_byte (parser, OP_FALSE); break;
+        case TOKEN_NIL: emit_byte (parser, OP_NIL); break;
+        case TOKEN_TRUE: emit_byte (parser, OP_TRUE); break;
 
         default: return;
     }
 }
 
-static void grouping (bool can_assign) {
-    expression ();
-    consume (TOKEN_RIGHT_PAREN, "Expected ')' to end parentheses");
+static void grouping (parser_t *parser, bool can_assign) {
+    expression (parser);
+    consume (parser, TOKEN_RIGHT_PAREN, "Expected ')' to end parentheses");
 }
 
-static void number (bool can_assign) {
-    double value = strtod (parser.previous.start, NULL);
-    emit_constant (NUMBER_VAL (value));
+// Literals without a fraction are integers, unless they do not fit, in which
+// case decimal ones fall back to doubles.
+static void number (parser_t *parser, bool can_assign) {
+    const char *start = parser->previous.start;
+    if (memchr (start, '.', parser->previous.len) == NULL) {
+        bool hex =
+            parser->previous.len > 2 && (start[1] == 'x' || start[1] == 'X');
+
+        errno         = 0;
+        long long val = strtoll (start, NULL, hex ? 16 : 10);
+        if (errno == 0) {
+            emit_constant (parser, INT_VAL ((int64) val));
+            return;
+        }
+
+        if (hex) {
+            error (parser, "Integer literal does not fit in 64 bits");
+            return;
+        }
+    }
+
+    emit_constant (parser, NUMBER_VAL (strtod (start, NULL)));
 }
 
-static void and_ (bool can_assign) {
-    int32 end_jump = emit_jump (OP_JUMP_IF_FALSE);
+static void and_ (parser_t *parser, bool can_assign) {
+    int32 end_jump = emit_jump (parser, OP_JUMP_IF_FALSE);
 
-    emit_byte (OP_POP);
-    parse_precedence (PREC_AND);
+    emit_byte (parser, OP_POP);
+    parse_precedence (parser, PREC_AND);
 
-    patch_jump (end_jump);
+    patch_jump (parser, end_jump);
 }
 
-static void or_ (bool can_assign) {
-    int32 else_jump = emit_jump (OP_JUMP_IF_FALSE);
-    int32 end_jump  = emit_jump (OP_JUMP);
+static void or_ (parser_t *parser, bool can_assign) {
+    int32 else_jump = emit_jump (parser, OP_JUMP_IF_FALSE);
+    int32 end_jump  = emit_jump (parser, OP_JUMP);
 
-    patch_jump (else_jump);
-    emit_byte (OP_POP);
+    patch_jump (parser, else_jump);
+    emit_byte (parser, OP_POP);
 
-    parse_precedence (PREC_OR);
-    patch_jump (end_jump);
+    parse_precedence (parser, PREC_OR);
+    patch_jump (parser, end_jump);
 }
 
-static void string (bool can_assign) {
-    emit_constant (OBJ_VAL ((obj *) copy_string (parser.previous.start + 1,
-                                                 parser.previous.len - 1)));
+static void string (parser_t *parser, bool can_assign) {
+    uint8 constant = string_constant (parser, parser->previous.start + 1,
+                                      parser->previous.len - 1);
+    emit_bytes (parser, OP_CONSTANT, constant);
 }
 
-static void named_variable (token name, bool can_assign) {
+static void named_variable (parser_t *parser, token name, bool can_assign) {
     uint8 get_op, set_op;
-    int32 arg = resolve_local (current, &name);
+    int32 arg = resolve_local (parser, parser->compiler, &name);
     if (arg != -1) {
         get_op = OP_GET_LOCAL;
         set_op = OP_SET_LOCAL;
-    } else if ((arg = resolve_upvalue (current, &name)) != -1) {
+    } else if ((arg = resolve_upvalue (parser, parser->compiler, &name)) !=
+               -1) {
         get_op = OP_GET_UPVALUE;
         set_op = OP_SET_UPVALUE;
     } else {
-        arg    = identifier_constant (&name);
+        arg    = identifier_constant (parser, &name);
         get_op = OP_GET_GLOBAL;
         set_op = OP_SET_GLOBAL;
     }
 
-    if (can_assign && match (TOKEN_EQUAL)) {
-        expression ();
-        emit_bytes (set_op, (uint8) arg);
+    if (can_assign && match (parser, TOKEN_EQUAL)) {
+        expression (parser);
+        emit_bytes (parser, set_op, (uint8) arg);
     } else {
-        emit_bytes (get_op, (uint8) arg);
+        emit_bytes (parser, get_op, (uint8) arg);
     }
 }
 
-static void variable (bool can_assign) {
-    named_variable (parser.previous, can_assign);
+static void variable (parser_t *parser, bool can_assign) {
+    named_variable (parser, parser->previous, can_assign);
+}
+
+static token synthetic_token (parser_t *parser, const char *text) {
+    token tok = parser->previous;
+    tok.start = text;
+    tok.len   = strlen (text);
+    return tok;
+}
+
+// `super.name (args)` calls the superclass method directly, without binding
+// it first. Only a bare `super.name` creates a bound method.
+static void super_ (parser_t *parser, bool can_assign) {
+    if (!parser->klass) {
+        error (parser, "`super` reference outside of class body");
+    } else if (!parser->klass->has_superclass) {
+        error (parser, "`super` reference in a class with no superclass");
+    }
+
+    consume (parser, TOKEN_DOT, "Expected '.' after `super`");
+    consume (parser, TOKEN_IDENTIFIER, "Expected superclass method name");
+    uint8 name = identifier_constant (parser, &parser->previous);
+
+    named_variable (parser, synthetic_token (parser, "this"), false);
+    if (match (parser, TOKEN_LEFT_PAREN)) {
+        uint8 argc = argument_list (parser);
+        named_variable (parser, synthetic_token (parser, "super"), false);
+        emit_bytes (parser, OP_SUPER_INVOKE, name);
+        emit_byte (parser, argc);
+    } else {
+        named_variable (parser, synthetic_token (parser, "super"), false);
+        emit_bytes (parser, OP_GET_SUPER, name);
+    }
 }
 
-static void this_ (bool can_assign) {
-    if (!current_class) {
-        error ("`this` reference outside of class body");
+static void this_ (parser_t *parser, bool can_assign) {
+    if (!parser->klass) {
+        error (parser, "`this` reference outside of class body");
         return;
     }
 
-    variable (false);
+    variable (parser, false);
 }
 
-static void unary (bool can_assign) {
-    token_type op_type = parser.previous.type;
+static void unary (parser_t *parser, bool can_assign) {
+    token_type op_type = parser->previous.type;
 
-    parse_precedence (PREC_UNARY);
+    parse_precedence (parser, PREC_UNARY);
     switch (op_type) {
-        case TOKEN_BANG: emit_byte (OP_NOT); break;
-        case TOKEN_MINUS: emit_byte (OP_NEGATE); break;
+        case TOKEN_BANG: emit_byte (parser, OP_NOT); break;
+        case TOKEN_MINUS: emit_byte (parser, OP_NEGATE); break;
+        case TOKEN_TILDE: emit_byte (parser, OP_BIT_NOT); break;
         default: return;
     }
 }
 
 parse_rule rules[] = {
-    [TOKEN_AND]           = {NULL, and_, PREC_AND},
-    [TOKEN_BANG_EQUAL]    = {NULL, binary, PREC_EQ},
-    [TOKEN_BANG]          = {unary, NULL, PREC_NONE},
-    [TOKEN_CLASS]         = {NULL, NULL, PREC_NONE},
-    [TOKEN_COMMA]         = {NULL, NULL, PREC_NONE},
-    [TOKEN_DOT]           = {NULL, dot, PREC_CALL},
-    [TOKEN_ELSE]          = {NULL, NULL, PREC_NONE},
-    [TOKEN_EOF]           = {NULL, NULL, PREC_NONE},
-    [TOKEN_EQUAL_EQUAL]   = {NULL, binary, PREC_EQ},
-    [TOKEN_EQUAL]         = {NULL, NULL, PREC_NONE},
-    [TOKEN_ERROR]         = {NULL, NULL, PREC_NONE},
-    [TOKEN_FALSE]         = {literal, NULL, PREC_NONE},
-    [TOKEN_FOR]           = {NULL, NULL, PREC_NONE},
-    [TOKEN_FUN]           = {NULL, NULL, PREC_NONE},
-    [TOKEN_GREATER_EQUAL] = {NULL, binary, PREC_COMP},
-    [TOKEN_GREATER]       = {NULL, binary, PREC_COMP},
-    [TOKEN_IDENTIFIER]    = {variable, NULL, PREC_NONE},
-    [TOKEN_IF]            = {NULL, NULL, PREC_NONE},
-    [TOKEN_LEFT_BRACE]    = {NULL, NULL, PREC_NONE},
-    [TOKEN_LEFT_PAREN]    = {grouping, call, PREC_CALL},
-    [TOKEN_LESS_EQUAL]    = {NULL, binary, PREC_COMP},
-    [TOKEN_LESS]          = {NULL, binary, PREC_COMP},
-    [TOKEN_MINUS]         = {unary, binary, PREC_TERM},
-    [TOKEN_NIL]           = {literal, NULL, PREC_NONE},
-    [TOKEN_NUMBER]        = {number, NULL, PREC_NONE},
-    [TOKEN_OR]            = {NULL, or_, PREC_OR},
-    [TOKEN_PLUS]          = {NULL, binary, PREC_TERM},
-    [TOKEN_PRINT]         = {NULL, NULL, PREC_NONE},
-    [TOKEN_RETURN]        = {NULL, NULL, PREC_NONE},
-    [TOKEN_RIGHT_BRACE]   = {NULL, NULL, PREC_NONE},
-    [TOKEN_RIGHT_PAREN]   = {NULL, NULL, PREC_NONE},
-    [TOKEN_SEMICOLON]     = {NULL, NULL, PREC_NONE},
-    [TOKEN_SLASH]         = {NULL, binary, PREC_FACTOR},
-    [TOKEN_STAR]          = {NULL, binary, PREC_FACTOR},
-    [TOKEN_STRING]        = {string, NULL, PREC_NONE},
-    [TOKEN_SUPER]         = {NULL, NULL, PREC_NONE},
-    [TOKEN_THIS]          = {this_, NULL, PREC_NONE},
-    [TOKEN_TRUE]          = {literal, NULL, PREC_NONE},
-    [TOKEN_VAR]           = {NULL, NULL, PREC_NONE},
-    [TOKEN_WHILE]         = {NULL, NULL, PREC_NONE},
+    [TOKEN_AMPERSAND]       = {NULL, binary, PREC_BIT_AND},
+    [TOKEN_AND]             = {NULL, and_, PREC_AND},
+    [TOKEN_BANG_EQUAL]      = {NULL, binary, PREC_EQ},
+    [TOKEN_BANG]            = {unary, NULL, PREC_NONE},
+    [TOKEN_CARET]           = {NULL, binary, PREC_BIT_XOR},
+    [TOKEN_CLASS]           = {NULL, NULL, PREC_NONE},
+    [TOKEN_COMMA]           = {NULL, NULL, PREC_NONE},
+    [TOKEN_DOT]             = {NULL, dot, PREC_CALL},
+    [TOKEN_ELSE]            = {NULL, NULL, PREC_NONE},
+    [TOKEN_EOF]             = {NULL, NULL, PREC_NONE},
+    [TOKEN_EQUAL_EQUAL]     = {NULL, binary, PREC_EQ},
+    [TOKEN_EQUAL]           = {NULL, NULL, PREC_NONE},
+    [TOKEN_ERROR]           = {NULL, NULL, PREC_NONE},
+    [TOKEN_FALSE]           = {literal, NULL, PREC_NONE},
+    [TOKEN_FOR]             = {NULL, NULL, PREC_NONE},
+    [TOKEN_FUN]             = {NULL, NULL, PREC_NONE},
+    [TOKEN_GREATER_EQUAL]   = {NULL, binary, PREC_COMP},
+    [TOKEN_GREATER_GREATER] = {NULL, binary, PREC_SHIFT},
+    [TOKEN_GREATER]         = {NULL, binary, PREC_COMP},
+    [TOKEN_IDENTIFIER]      = {variable, NULL, PREC_NONE},
+    [TOKEN_IF]              = {NULL, NULL, PREC_NONE},
+    [TOKEN_IMPORT]          = {NULL, NULL, PREC_NONE},
+    [TOKEN_LEFT_BRACE]      = {NULL, NULL, PREC_NONE},
+    [TOKEN_LEFT_BRACKET]    = {list, subscript, PREC_CALL},
+    [TOKEN_LEFT_PAREN]      = {grouping, call, PREC_CALL},
+    [TOKEN_LESS_EQUAL]      = {NULL, binary, PREC_COMP},
+    [TOKEN_LESS_LESS]       = {NULL, binary, PREC_SHIFT},
+    [TOKEN_LESS]            = {NULL, binary, PREC_COMP},
+    [TOKEN_MINUS]           = {unary, binary, PREC_TERM},
+    [TOKEN_NIL]             = {literal, NULL, PREC_NONE},
+    [TOKEN_NUMBER]          = {number, NULL, PREC_NONE},
+    [TOKEN_OR]              = {NULL, or_, PREC_OR},
+    [TOKEN_PERCENT]         = {NULL, binary, PREC_FACTOR},
+    [TOKEN_PIPE]            = {NULL, binary, PREC_BIT_OR},
+    [TOKEN_PLUS]            = {NULL, binary, PREC_TERM},
+    [TOKEN_PRINT]           = {NULL, NULL, PREC_NONE},
+    [TOKEN_RETURN]          = {NULL, NULL, PREC_NONE},
+    [TOKEN_RIGHT_BRACE]     = {NULL, NULL, PREC_NONE},
+    [TOKEN_RIGHT_BRACKET]   = {NULL, NULL, PREC_NONE},
+    [TOKEN_RIGHT_PAREN]     = {NULL, NULL, PREC_NONE},
+    [TOKEN_SEMICOLON]       = {NULL, NULL, PREC_NONE},
+    [TOKEN_SLASH]           = {NULL, binary, PREC_FACTOR},
+    [TOKEN_STAR]            = {NULL, binary, PREC_FACTOR},
+    [TOKEN_STRING]          = {string, NULL, PREC_NONE},
+    [TOKEN_SUPER]           = {super_, NULL, PREC_NONE},
+    [TOKEN_THIS]            = {this_, NULL, PREC_NONE},
+    [TOKEN_TILDE_SLASH]     = {NULL, binary, PREC_FACTOR},
+    [TOKEN_TILDE]           = {unary, NULL, PREC_NONE},
+    [TOKEN_TRUE]            = {literal, NULL, PREC_NONE},
+    [TOKEN_VAR]             = {NULL, NULL, PREC_NONE},
+    [TOKEN_WHILE]           = {NULL, NULL, PREC_NONE},
 };
 
-static void parse_precedence (precedence prec) {
-    advance ();
-    parse_fn prefix_rule = get_rule (parser.previous.type)->prefix;
+static void parse_precedence (parser_t *parser, precedence prec) {
+    advance (parser);
+    parse_fn prefix_rule = get_rule (parser->previous.type)->prefix;
     if (prefix_rule == NULL) {
-        error ("Expected expression");
+        error (parser, "Expected expression");
         return;
     }
 
     bool can_assign = prec <= PREC_ASG;
-    prefix_rule (can_assign);
+    prefix_rule (parser, can_assign);
 
-    while (prec <= get_rule (parser.current.type)->prec) {
-        advance ();
-        parse_fn infix_rule = get_rule (parser.previous.type)->infix;
-        infix_rule (can_assign);
+    while (prec <= get_rule (parser->current.type)->prec) {
+        advance (parser);
+        parse_fn infix_rule = get_rule (parser->previous.type)->infix;
+        infix_rule (parser, can_assign);
     }
 
-    if (can_assign && match (TOKEN_EQUAL)) {
-        error ("Invalid assignment target");
+    if (can_assign && match (parser, TOKEN_EQUAL)) {
+        error (parser, "Invalid assignment target");
     }
 }
 
-static uint8 identifier_constant (token *name) {
-    return make_constant (
-        OBJ_VAL ((obj *) copy_string (name->start, name->len)));
+static uint8 identifier_constant (parser_t *parser, token *name) {
+    return string_constant (parser, name->start, name->len);
 }
 
 static bool identifiers_equal (token *a, token *b) {
@@ -518,13 +885,15 @@ static bool identifiers_equal (token *a, token *b) {
     return memcmp (a->start, b->start, a->len) == 0;
 }
 
-static int32 resolve_local (compiler_t *compiler, token *name) {
+static int32 resolve_local (parser_t *parser, compiler_t *compiler,
+                            token *name) {
     for (int32 i = compiler->local_count - 1; i >= 0; i--) {
         localvar *local = &compiler->locals[i];
         printf ("local: %.*s\n", (int) local->name.len, local->name.start);
         if (identifiers_equal (name, &local->name)) {
             if (local->depth == -1) {
-                error ("Self-referencing local variable '%.*s' in initializer",
+                error (parser,
+                       "Self-referencing local variable '%.*s' in initializer",
                        local->name.len, local->name.start);
             }
             return i;
@@ -534,8 +903,9 @@ static int32 resolve_local (compiler_t *compiler, token *name) {
     return -1;
 }
 
-static int32 add_upvalue (compiler_t *compiler, uint8 index, bool is_local) {
-    int32 upvalue_count = compiler->func->upvalue_count;
+static int32 add_upvalue (parser_t *parser, compiler_t *compiler, uint8 index,
+                          bool is_local, token *name) {
+    int32 upvalue_count = compiler->proto->upvalue_count;
 
     for (int32 i = 0; i < upvalue_count; i++) {
         upvalue *upval = &compiler->upvalues[i];
@@ -545,36 +915,48 @@ static int32 add_upvalue (compiler_t *compiler, uint8 index, bool is_local) {
     }
 
     if (upvalue_count == UINT8_COUNT) {
-        error ("Too many captured variables in closure");
+        error (parser, "Too many captured variables in closure");
         return 0;
     }
 
     compiler->upvalues[upvalue_count].is_local = is_local;
     compiler->upvalues[upvalue_count].index    = index;
+    compiler->upvalues[upvalue_count].name     = *name;
 
-    return compiler->func->upvalue_count++;
+    return compiler->proto->upvalue_count++;
 }
 
-static int32 resolve_upvalue (compiler_t *compiler, token *name) {
-    if (compiler->enclosing == NULL) return -1;
+static int32 resolve_capture (parser_t *parser, token *name) {
+    for (int32 i = 0; i < parser->capture_count; i++) {
+        if (identifiers_equal (name, &parser->captures[i])) return i;
+    }
+
+    return -1;
+}
+
+static int32 resolve_upvalue (parser_t *parser, compiler_t *compiler,
+                              token *name) {
+    if (compiler->enclosing == NULL) return resolve_capture (parser, name);
 
-    int32 local = resolve_local (compiler->enclosing, name);
+    int32 local = resolve_local (parser, compiler->enclosing, name);
     if (local != -1) {
         compiler->enclosing->locals[local].captured = true;
-        return add_upvalue (compiler, (uint8) local, true);
+        return add_upvalue (parser, compiler, (uint8) local, true, name);
     }
 
-    int32 upvalue = resolve_upvalue (compiler->enclosing, name);
+    int32 upvalue = resolve_upvalue (parser, compiler->enclosing, name);
     if (upvalue != -1) {
-        return add_upvalue (compiler, (uint8) upvalue, false);
+        return add_upvalue (parser, compiler, (uint8) upvalue, false, name);
     }
 
     return -1;
 }
 
-static void add_local (token name) {
+static void add_local (parser_t *parser, token name) {
+    compiler_t *current = parser->compiler;
     if (current->local_count == LOCALS_MAX) {
-        error ("Too many local variables in function, limit %d", LOCALS_MAX);
+        error (parser, "Too many local variables in function, limit %d",
+               LOCALS_MAX);
         return;
     }
 
@@ -584,10 +966,11 @@ static void add_local (token name) {
     local->captured = false;
 }
 
-static void declare_variable (void) {
+static void declare_variable (parser_t *parser) {
+    compiler_t *current = parser->compiler;
     if (current->scope_depth == 0) return;
 
-    token *name = &parser.previous;
+    token *name = &parser->previous;
     for (int32 i = current->local_count - 1; i >= 0; i--) {
         localvar *local = &current->locals[i];
         if (local->depth != -1 && local->depth < current->scope_depth) {
@@ -595,267 +978,387 @@ static void declare_variable (void) {
         }
 
         if (identifiers_equal (name, &local->name)) {
-            error ("Redeclaration of variable '%.*s'", name->len, name->start);
+            error (parser, "Redeclaration of variable '%.*s'", name->len,
+                   name->start);
         }
     }
 
-    add_local (*name);
+    add_local (parser, *name);
 }
 
-static uint8 parse_variable (const char *errmsg, ...) {
+static uint8 parse_variable (parser_t *parser, const char *errmsg, ...) {
     va_list ap;
     va_start (ap, errmsg);
 
-    consumev (TOKEN_IDENTIFIER, errmsg, ap);
+    consumev (parser, TOKEN_IDENTIFIER, errmsg, ap);
     va_end (ap);
 
-    declare_variable ();
-    if (current->scope_depth > 0) return 0;
+    declare_variable (parser);
+    if (parser->compiler->scope_depth > 0) return 0;
 
-    return identifier_constant (&parser.previous);
+    return identifier_constant (parser, &parser->previous);
 }
 
-static void mark_initialized (void) {
+static void mark_initialized (parser_t *parser) {
+    compiler_t *current = parser->compiler;
     if (current->scope_depth == 0) return;
 
     current->locals[current->local_count - 1].depth = current->scope_depth;
 }
 
-static void define_variable (uint8 global) {
-    if (current->scope_depth > 0) {
-        mark_initialized ();
+static void define_variable (parser_t *parser, uint8 global) {
+    if (parser->compiler->scope_depth > 0) {
+        mark_initialized (parser);
         return;
     }
 
-    emit_bytes (OP_DEFINE_GLOBAL, global);
+    emit_bytes (parser, OP_DEFINE_GLOBAL, global);
 }
 
 static parse_rule *get_rule (token_type type) {
     return &rules[type];
 }
 
-static void expression (void) {
-    parse_precedence (PREC_ASG);
+static void expression (parser_t *parser) {
+    parse_precedence (parser, PREC_ASG);
 }
 
-static void block (void) {
-    while (!check (TOKEN_RIGHT_BRACE) && !check (TOKEN_EOF)) {
-        declaration ();
+static void block (parser_t *parser) {
+    while (!check (parser, TOKEN_RIGHT_BRACE) &&
+           !check (parser, TOKEN_EOF)) {
+        declaration (parser);
     }
 
-    consume (TOKEN_RIGHT_BRACE, "Expected '}' to end a block");
+    consume (parser, TOKEN_RIGHT_BRACE, "Expected '}' to end a block");
 }
 
-static void function (func_type type) {
-    compiler_t compiler;
-    init_compiler (&compiler, type);
-    begin_scope ();
+static void count_parameter (parser_t *parser) {
+    func_proto *proto = current_proto (parser);
+    if (++proto->arity > UINT8_MAX) {
+        error_at_current (parser,
+                          "Function %.*s cannot have more than 255 parameters",
+                          (int) proto->name_len, proto->name);
+    }
+}
 
-    consume (TOKEN_LEFT_PAREN, "Expected '(' after a function name");
-    if (!check (TOKEN_RIGHT_PAREN)) {
+static void function_body (parser_t *parser) {
+    consume (parser, TOKEN_LEFT_PAREN, "Expected '(' after a function name");
+    if (!check (parser, TOKEN_RIGHT_PAREN)) {
         do {
-            current->func->arity++;
-            if (current->func->arity > UINT8_MAX) {
-                error_at_current (
-                    "Function %s cannot have more than 255 parameters",
-                    current->func->name->data);
-            }
+            count_parameter (parser);
+            uint8 constant =
+                parse_variable (parser, "Expected parameter name");
+            define_variable (parser, constant);
+        } while (match (parser, TOKEN_COMMA));
+    }
+
+    consume (parser, TOKEN_RIGHT_PAREN,
+             "Expected ')' to end a parameter list");
+    consume (parser, TOKEN_LEFT_BRACE, "Expected '{' for a function body");
+
+    block (parser);
+}
+
+// Throws away what checking a lazy body put into the current proto.
+static void discard_check (parser_t *parser) {
+    compiler_t *compiler = parser->compiler;
+    func_proto *proto    = compiler->proto;
+
+    for (size i = 0; i < proto->const_count; i++) {
+        if (proto->consts[i].kind == PCONST_FUNC) {
+            free_proto (proto->consts[i].func);
+        }
+    }
 
-            uint8 constant = parse_variable ("Expected parameter name");
-            define_variable (constant);
-        } while (match (TOKEN_COMMA));
+    free (compiler->const_index);
+    compiler->const_index    = NULL;
+    compiler->index_capacity = 0;
+    proto->const_count       = 0;
+    proto->count             = 0;
+}
+
+// Parses the parameters and body like function_body, so errors are reported
+// as early as with eager compiling, but keeps no code. What is kept is the
+// text of the function and the name of every variable it captures from
+// enclosing functions, as compiling the body later cannot see their locals.
+static void skip_body (parser_t *parser, func_type type) {
+    token  start    = parser->current;
+    uint32 flags    = (uint32) type;
+    bool   checking = parser->checking;
+
+    parser->checking = true;
+    function_body (parser);
+    parser->checking = checking;
+    discard_check (parser);
+
+    bool in_class  = parser->klass != NULL;
+    bool has_super = in_class && parser->klass->has_superclass;
+    if (in_class) flags |= LAZY_IN_CLASS;
+    if (has_super) flags |= LAZY_HAS_SUPER;
+
+    // The layout is fixed, so these bypass the constant index.
+    const char *end    = parser->previous.start + parser->previous.len;
+    int64       column = (int64) (start.column - start.len);
+    proto_const text   = {.kind  = PCONST_STRING,
+                          .chars = start.start,
+                          .len   = (size) (end - start.start)};
+    proto_const info   = {.kind = PCONST_VALUE, .val = INT_VAL (flags)};
+    proto_const line   = {.kind = PCONST_VALUE,
+                          .val  = INT_VAL ((int64) start.line)};
+    proto_const col    = {.kind = PCONST_VALUE, .val = INT_VAL (column)};
+    make_constant (parser, text);
+    make_constant (parser, info);
+    make_constant (parser, line);
+    make_constant (parser, col);
+
+    compiler_t *compiler = parser->compiler;
+    for (int32 i = 0; i < compiler->proto->upvalue_count; i++) {
+        proto_const name = {.kind  = PCONST_STRING,
+                            .chars = compiler->upvalues[i].name.start,
+                            .len   = compiler->upvalues[i].name.len};
+        make_constant (parser, name);
     }
+}
 
-    consume (TOKEN_RIGHT_PAREN, "Expected ')' to end a parameter list");
-    consume (TOKEN_LEFT_BRACE, "Expected '{' for a function body");
+static void function (parser_t *parser, func_type type) {
+    compiler_t compiler;
+    init_compiler (parser, &compiler, type);
+    begin_scope (parser);
+
+    func_proto *proto = compiler.proto;
+    if (parser->lazy) {
+        skip_body (parser, type);
+        shrink_proto (proto);
+        parser->compiler = compiler.enclosing;
+    } else {
+        function_body (parser);
+        end_compiler (parser);
+    }
 
-    block ();
-    obj_func *func = end_compiler ();
-    emit_bytes (OP_CLOSURE, make_constant (OBJ_VAL ((obj *) func)));
+    proto_const constant = {.kind = PCONST_FUNC, .func = proto};
+    emit_bytes (parser, OP_CLOSURE, make_constant (parser, constant));
 
-    for (int32 i = 0; i < func->upvalue_count; i++) {
-        emit_byte (compiler.upvalues[i].is_local ? 1 : 0);
-        emit_byte (compiler.upvalues[i].index);
+    for (int32 i = 0; i < proto->upvalue_count; i++) {
+        emit_byte (parser, compiler.upvalues[i].is_local ? 1 : 0);
+        emit_byte (parser, compiler.upvalues[i].index);
     }
 }
 
-static void method (void) {
-    consume (TOKEN_IDENTIFIER, "Expected method name");
-    uint8 constant = identifier_constant (&parser.previous);
+static void method (parser_t *parser) {
+    consume (parser, TOKEN_IDENTIFIER, "Expected method name");
+    uint8 constant = identifier_constant (parser, &parser->previous);
 
     func_type ftype = FTYPE_METHOD;
-    if (parser.previous.len == 4 &&
-        memcmp (parser.previous.start, "init", 4) == 0) {
+    if (parser->previous.len == 4 &&
+        memcmp (parser->previous.start, "init", 4) == 0) {
         ftype = FTYPE_INITIALIZER;
     }
 
-    function (ftype);
-    emit_bytes (OP_METHOD, constant);
+    function (parser, ftype);
+    emit_bytes (parser, OP_METHOD, constant);
 }
 
-static void class_declaration (void) {
-    consume (TOKEN_IDENTIFIER, "Expected class name");
-    token class_name = parser.previous;
-    uint8 name_const = identifier_constant (&parser.previous);
-    declare_variable ();
+static void class_declaration (parser_t *parser) {
+    consume (parser, TOKEN_IDENTIFIER, "Expected class name");
+    token class_name = parser->previous;
+    uint8 name_const = identifier_constant (parser, &parser->previous);
+    declare_variable (parser);
 
-    emit_bytes (OP_CLASS, name_const);
-    define_variable (name_const);
+    emit_bytes (parser, OP_CLASS, name_const);
+    define_variable (parser, name_const);
 
     class_compiler class_comp;
-    class_comp.enclosing = current_class;
-    current_class        = &class_comp;
+    class_comp.enclosing      = parser->klass;
+    class_comp.has_superclass = false;
+    parser->klass             = &class_comp;
+
+    if (match (parser, TOKEN_LESS)) {
+        consume (parser, TOKEN_IDENTIFIER, "Expected superclass name");
+        variable (parser, false);
+
+        if (identifiers_equal (&class_name, &parser->previous)) {
+            error (parser, "Class %.*s cannot inherit from itself",
+                   (int) class_name.len, class_name.start);
+        }
+
+        // The superclass lives on in a local named `super`, which methods
+        // capture as an upvalue.
+        begin_scope (parser);
+        add_local (parser, synthetic_token (parser, "super"));
+        define_variable (parser, 0);
+
+        named_variable (parser, class_name, false);
+        emit_byte (parser, OP_INHERIT);
+        class_comp.has_superclass = true;
+    }
 
-    named_variable (class_name, false);
+    named_variable (parser, class_name, false);
 
-    consume (TOKEN_LEFT_BRACE, "Expected '{' before class body");
-    while (!check (TOKEN_RIGHT_BRACE) && !check (TOKEN_EOF)) {
-        method ();
+    consume (parser, TOKEN_LEFT_BRACE, "Expected '{' before class body");
+    while (!check (parser, TOKEN_RIGHT_BRACE) && !check (parser, TOKEN_EOF)) {
+        method (parser);
     }
 
-    consume (TOKEN_RIGHT_BRACE, "Expected '}' to end class body");
-    emit_byte (OP_POP);
+    consume (parser, TOKEN_RIGHT_BRACE, "Expected '}' to end class body");
+    emit_byte (parser, OP_POP);
+
+    if (class_comp.has_superclass) end_scope (parser);
 
-    current_class = current_class->enclosing;
+    parser->klass = parser->klass->enclosing;
 }
 
-static void fun_declaration (void) {
-    uint8 global = parse_variable ("Expected function name");
-    mark_initialized ();
-    function (FTYPE_FUNC);
-    define_variable (global);
+static void fun_declaration (parser_t *parser) {
+    uint8 global = parse_variable (parser, "Expected function name");
+    mark_initialized (parser);
+    function (parser, FTYPE_FUNC);
+    define_variable (parser, global);
 }
 
-static void var_declaration (void) {
-    uint8 global = parse_variable ("Expected variable name");
+static void var_declaration (parser_t *parser) {
+    uint8 global = parse_variable (parser, "Expected variable name");
 
-    if (match (TOKEN_EQUAL)) {
-        expression ();
+    if (match (parser, TOKEN_EQUAL)) {
+        expression (parser);
     } else {
-        emit_byte (OP_NIL);
+        emit_byte (parser, OP_NIL);
     }
 
-    consume (TOKEN_SEMICOLON, "Expected ';' to end a statement");
-    define_variable (global);
+    consume (parser, TOKEN_SEMICOLON, "Expected ';' to end a statement");
+    define_variable (parser, global);
 }
 
-static void expression_statement (void) {
-    expression ();
-    consume (TOKEN_SEMICOLON, "Expected ';' to end a statement");
-    emit_byte (OP_POP);
+static void expression_statement (parser_t *parser) {
+    expression (parser);
+    consume (parser, TOKEN_SEMICOLON, "Expected ';' to end a statement");
+    emit_byte (parser, OP_POP);
 }
 
-static void if_statement (void) {
-    consume (TOKEN_LEFT_PAREN, "Expected '(' after `if`");
-    expression ();
-    consume (TOKEN_RIGHT_PAREN, "Expected ')' to end if condition");
+static void if_statement (parser_t *parser) {
+    consume (parser, TOKEN_LEFT_PAREN, "Expected '(' after `if`");
+    expression (parser);
+    consume (parser, TOKEN_RIGHT_PAREN, "Expected ')' to end if condition");
+
+    int32 then_jump = emit_jump (parser, OP_JUMP_IF_FALSE);
+    emit_byte (parser, OP_POP);
+    statement (parser);
 
-    int32 then_jump = emit_jump (OP_JUMP_IF_FALSE);
-    emit_byte (OP_POP);
-    statement ();
+    int32 else_jump = emit_jump (parser, OP_JUMP);
+    patch_jump (parser, then_jump);
+    emit_byte (parser, OP_POP);
 
-    int32 else_jump = emit_jump (OP_JUMP);
-    patch_jump (then_jump);
-    emit_byte (OP_POP);
+    if (match (parser, TOKEN_ELSE)) statement (parser);
+    patch_jump (parser, else_jump);
+}
+
+// The module is bound right after it has run, which for the first import
+// means after the call OP_IMPORT makes has returned.
+static void import_statement (parser_t *parser) {
+    consume (parser, TOKEN_STRING, "Expected a module path after 'import'");
+    uint8 spec = string_constant (parser, parser->previous.start + 1,
+                                  parser->previous.len - 1);
 
-    if (match (TOKEN_ELSE)) statement ();
-    patch_jump (else_jump);
+    consume (parser, TOKEN_SEMICOLON, "Expected ';' after the module path");
+    emit_bytes (parser, OP_IMPORT, spec);
+    emit_byte (parser, OP_BIND_MODULE);
 }
 
-static void print_statement (void) {
-    expression ();
-    consume (TOKEN_SEMICOLON, "Expected ';' to end a statement");
-    emit_byte (OP_PRINT);
+static void print_statement (parser_t *parser) {
+    expression (parser);
+    consume (parser, TOKEN_SEMICOLON, "Expected ';' to end a statement");
+    emit_byte (parser, OP_PRINT);
 }
 
-static void return_statement (void) {
-    if (current->ftype == FTYPE_SCRIPT) {
-        error ("Return outside of function");
+static void return_statement (parser_t *parser) {
+    if (parser->compiler->ftype == FTYPE_SCRIPT) {
+        error (parser, "Return outside of function");
     }
 
-    if (match (TOKEN_SEMICOLON)) {
-        implicit_return ();
+    if (match (parser, TOKEN_SEMICOLON)) {
+        implicit_return (parser);
     } else {
-        if (current->ftype == FTYPE_INITIALIZER) {
-            error ("Illegal return in initializer");
+        if (parser->compiler->ftype == FTYPE_INITIALIZER) {
+            error (parser, "Illegal return in initializer");
         }
 
-        expression ();
-        consume (TOKEN_SEMICOLON, "Expected ';' to end a statement");
-        emit_byte (OP_RETURN);
+        expression (parser);
+        consume (parser, TOKEN_SEMICOLON, "Expected ';' to end a statement");
+        emit_byte (parser, OP_RETURN);
     }
 }
 
-static void while_statement (void) {
-    int32 loop_start = current_chunk ()->count;
-    consume (TOKEN_LEFT_PAREN, "Expected '(' after `while`");
-    expression ();
-    consume (TOKEN_RIGHT_PAREN, "Expected ')' to end while condition");
+static void while_statement (parser_t *parser) {
+    int32 loop_start = current_proto (parser)->count;
+    consume (parser, TOKEN_LEFT_PAREN, "Expected '(' after `while`");
+    expression (parser);
+    consume (parser, TOKEN_RIGHT_PAREN, "Expected ')' to end while condition");
 
-    int32 exit_jump = emit_jump (OP_JUMP_IF_FALSE);
-    emit_byte (OP_POP);
-    statement ();
-    emit_loop (loop_start);
+    int32 exit_jump = emit_jump (parser, OP_JUMP_IF_FALSE);
+    emit_byte (parser, OP_POP);
+    statement (parser);
+    emit_loop (parser, loop_start);
 
-    patch_jump (exit_jump);
-    emit_byte (OP_POP);
+    patch_jump (parser, exit_jump);
+    emit_byte (parser, OP_POP);
 }
 
-static void for_statement (void) {
-    begin_scope ();
+static void for_statement (parser_t *parser) {
+    begin_scope (parser);
 
-    consume (TOKEN_LEFT_PAREN, "Expected '(' after `for`");
-    if (match (TOKEN_VAR)) {
-        var_declaration ();
-    } else if (!match (TOKEN_SEMICOLON)) {
-        expression_statement ();
+    consume (parser, TOKEN_LEFT_PAREN, "Expected '(' after `for`");
+    if (match (parser, TOKEN_VAR)) {
+        var_declaration (parser);
+    } else if (!match (parser, TOKEN_SEMICOLON)) {
+        expression_statement (parser);
     }
 
-    int32 loop_start = current_chunk ()->count;
+    int32 loop_start = current_proto (parser)->count;
     int32 exit_jump  = -1;
 
-    if (!match (TOKEN_SEMICOLON)) {
-        expression ();
-        consume (TOKEN_SEMICOLON, "Expected ';' after for loop condition");
+    if (!match (parser, TOKEN_SEMICOLON)) {
+        expression (parser);
+        consume (parser, TOKEN_SEMICOLON,
+                 "Expected ';' after for loop condition");
 
-        exit_jump = emit_jump (OP_JUMP_IF_FALSE);
-        emit_byte (OP_POP);
+        exit_jump = emit_jump (parser, OP_JUMP_IF_FALSE);
+        emit_byte (parser, OP_POP);
     }
 
-    if (!match (TOKEN_RIGHT_PAREN)) {
-        int32 body_jump       = emit_jump (OP_JUMP);
-        int32 increment_start = current_chunk ()->count;
-        expression ();
-        emit_byte (OP_POP);
-        consume (TOKEN_RIGHT_PAREN, "Expected ')' after for loop clauses");
+    if (!match (parser, TOKEN_RIGHT_PAREN)) {
+        int32 body_jump       = emit_jump (parser, OP_JUMP);
+        int32 increment_start = current_proto (parser)->count;
+        expression (parser);
+        emit_byte (parser, OP_POP);
+        consume (parser, TOKEN_RIGHT_PAREN,
+                 "Expected ')' after for loop clauses");
 
-        emit_loop (loop_start);
+        emit_loop (parser, loop_start);
         loop_start = increment_start;
-        patch_jump (body_jump);
+        patch_jump (parser, body_jump);
     }
 
-    statement ();
-    emit_loop (loop_start);
+    statement (parser);
+    emit_loop (parser, loop_start);
 
     if (exit_jump != -1) {
-        patch_jump (exit_jump);
-        emit_byte (OP_POP);
+        patch_jump (parser, exit_jump);
+        emit_byte (parser, OP_POP);
     }
 
-    end_scope ();
+    end_scope (parser);
 }
 
-static void synchronize (void) {
-    parser.panic_mode = false;
+static void synchronize (parser_t *parser) {
+    parser->panic_mode = false;
 
-    while (parser.current.type != TOKEN_EOF) {
-        if (parser.previous.type == TOKEN_SEMICOLON) return;
-        switch (parser.current.type) {
+    while (parser->current.type != TOKEN_EOF) {
+        if (parser->previous.type == TOKEN_SEMICOLON) return;
+        switch (parser->current.type) {
             case TOKEN_CLASS:
             case TOKEN_FUN:
             case TOKEN_VAR:
             case TOKEN_FOR:
             case TOKEN_IF:
+            case TOKEN_IMPORT:
             case TOKEN_WHILE:
             case TOKEN_PRINT:
             case TOKEN_RETURN: return;
@@ -864,67 +1367,270 @@ static void synchronize (void) {
             }
         }
 
-        advance ();
+        advance (parser);
     }
 }
 
-static void declaration (void) {
-    if (match (TOKEN_CLASS)) {
-        class_declaration ();
-    } else if (match (TOKEN_VAR)) {
-        var_declaration ();
-    } else if (match (TOKEN_FUN)) {
-        fun_declaration ();
+static void declaration (parser_t *parser) {
+    if (match (parser, TOKEN_CLASS)) {
+        class_declaration (parser);
+    } else if (match (parser, TOKEN_VAR)) {
+        var_declaration (parser);
+    } else if (match (parser, TOKEN_FUN)) {
+        fun_declaration (parser);
     } else {
-        statement ();
-    }
-
-    if (parser.panic_mode) synchronize ();
-}
-
-static void statement (void) {
-    if (match (TOKEN_PRINT)) {
-        print_statement ();
-    } else if (match (TOKEN_LEFT_BRACE)) {
-        begin_scope ();
-        block ();
-        end_scope ();
-    } else if (match (TOKEN_WHILE)) {
-        while_statement ();
-    } else if (match (TOKEN_FOR)) {
-        for_statement ();
-    } else if (match (TOKEN_IF)) {
-        if_statement ();
-    } else if (match (TOKEN_RETURN)) {
-        return_statement ();
+        statement (parser);
+    }
+
+    if (parser->panic_mode) synchronize (parser);
+}
+
+static void statement (parser_t *parser) {
+    if (match (parser, TOKEN_PRINT)) {
+        print_statement (parser);
+    } else if (match (parser, TOKEN_LEFT_BRACE)) {
+        begin_scope (parser);
+        block (parser);
+        end_scope (parser);
+    } else if (match (parser, TOKEN_WHILE)) {
+        while_statement (parser);
+    } else if (match (parser, TOKEN_FOR)) {
+        for_statement (parser);
+    } else if (match (parser, TOKEN_IF)) {
+        if_statement (parser);
+    } else if (match (parser, TOKEN_IMPORT)) {
+        import_statement (parser);
+    } else if (match (parser, TOKEN_RETURN)) {
+        return_statement (parser);
     } else {
-        expression_statement ();
+        expression_statement (parser);
     }
 }
 
-obj_func *compile (const char *source) {
-    init_scanner (source);
+static void init_parser (parser_t *parser, const char *source, bool report) {
+    memset (parser, 0, sizeof (*parser));
+    init_scanner (&parser->scanner, source);
+    parser->report = report;
+    parser->lazy   = lazy_compile;
+}
+
+func_proto *compile_proto (const char *source, bool report) {
+    parser_t parser;
+    init_parser (&parser, source, report);
 
     compiler_t compiler;
-    init_compiler (&compiler, FTYPE_SCRIPT);
+    init_compiler (&parser, &compiler, FTYPE_SCRIPT);
 
-    parser.had_error  = false;
-    parser.panic_mode = false;
+    advance (&parser);
 
-    advance ();
+    while (!match (&parser, TOKEN_EOF)) {
+        declaration (&parser);
+    }
+
+    func_proto *proto = end_compiler (&parser);
+    if (parser.had_error) {
+        free_proto (proto);
+        return NULL;
+    }
+
+    return proto;
+}
+
+void free_proto (func_proto *proto) {
+    for (size i = 0; i < proto->const_count; i++) {
+        if (proto->consts[i].kind == PCONST_FUNC) {
+            free_proto (proto->consts[i].func);
+        }
+    }
+
+    free (proto->code);
+    free (proto->lines);
+    free (proto->consts);
+    free (proto);
+}
+
+// Gives `func`, which must be reachable, the code and constants of `proto`.
+static void fill_func (obj_func *func, const func_proto *proto) {
+    obj_module *module = func->module;
+
+    // Sized up front, so the pool has no slack.
+    value_array *consts = &func->chk.consts;
+    consts->values      = ALLOCATE (value, proto->const_count);
+    consts->capacity    = proto->const_count;
+
+    for (size i = 0; i < proto->const_count; i++) {
+        const proto_const *constant = &proto->consts[i];
+        value              val;
+
+        switch (constant->kind) {
+            case PCONST_FUNC:
+                val = OBJ_VAL (
+                    (obj *) publish_proto (constant->func, module));
+                break;
+            case PCONST_STRING:
+                val = OBJ_VAL (
+                    (obj *) copy_string (constant->chars, constant->len));
+                break;
+            default: val = constant->val; break;
+        }
+
+        add_constant (&func->chk, val);
+    }
+
+    // Lazy functions have no code yet.
+    if (proto->count == 0) return;
+
+    chunk *chk = &func->chk;
+    chk->code  = ALLOCATE (uint8, proto->count);
+    memcpy (chk->code, proto->code, proto->count);
+    chk->lines = ALLOCATE (line_run, proto->line_count);
+    memcpy (chk->lines, proto->lines, proto->line_count * sizeof (line_run));
+    chk->count         = proto->count;
+    chk->capacity      = proto->count;
+    chk->line_count    = proto->line_count;
+    chk->line_capacity = proto->line_count;
+    chk->mapped        = false;
+
+#ifdef DEBUG_PRINT_CODE
+    disassemble_chunk (chk, func->name != NULL ? func->name->data : "<script>");
+#endif
+}
+
+// Every function is pushed while its constants are created, so nothing
+// built so far can be collected.
+obj_func *publish_proto (const func_proto *proto, obj_module *module) {
+    obj_func *func = new_func ();
+    push (OBJ_VAL ((obj *) func));
+
+    func->arity         = proto->arity;
+    func->upvalue_count = proto->upvalue_count;
+    func->module        = module;
+    if (proto->name != NULL) {
+        func->name = copy_string (proto->name, proto->name_len);
+    }
+
+    fill_func (func, proto);
+    pop ();
+    return func;
+}
 
-    while (!match (TOKEN_EOF)) {
-        declaration ();
+void set_lazy_compile (bool lazy) {
+    lazy_compile = lazy;
+}
+
+bool lazy_compile_enabled (void) {
+    return lazy_compile;
+}
+
+// The body is compiled on its own, as if it were the outermost function.
+// Its upvalues were settled when the enclosing function was compiled, so
+// names that are not its own locals resolve against `captures` first.
+bool compile_lazy (obj_func *func) {
+    value_array *consts = &func->chk.consts;
+    token        captures[UINT8_COUNT];
+
+    // Cache files and images are only checked for their structure.
+    if (consts->count != (size) (LAZY_NAMES + func->upvalue_count) ||
+        !IS_STRING (consts->values[LAZY_TEXT]) ||
+        !IS_INT (consts->values[LAZY_INFO]) ||
+        !IS_INT (consts->values[LAZY_LINE]) ||
+        !IS_INT (consts->values[LAZY_COLUMN])) {
+        return false;
+    }
+
+    obj_string *text = AS_STRING (consts->values[LAZY_TEXT]);
+    int64       info = AS_INT (consts->values[LAZY_INFO]);
+    for (int32 i = 0; i < func->upvalue_count; i++) {
+        if (!IS_STRING (consts->values[LAZY_NAMES + i])) return false;
+
+        obj_string *name = AS_STRING (consts->values[LAZY_NAMES + i]);
+        captures[i].start = name->data;
+        captures[i].len   = name->len;
+    }
+
+    parser_t parser;
+    init_parser (&parser, text->data, true);
+    parser.scanner.line   = (size) AS_INT (consts->values[LAZY_LINE]);
+    parser.scanner.column = (size) AS_INT (consts->values[LAZY_COLUMN]);
+    parser.captures       = captures;
+    parser.capture_count  = func->upvalue_count;
+
+    class_compiler klass = {NULL, (info & LAZY_HAS_SUPER) != 0};
+    if (info & LAZY_IN_CLASS) parser.klass = &klass;
+
+    compiler_t compiler;
+    init_compiler (&parser, &compiler, (func_type) (info & LAZY_FTYPE_MASK));
+    compiler.proto->upvalue_count = func->upvalue_count;
+    begin_scope (&parser);
+
+    advance (&parser);
+    function_body (&parser);
+    func_proto *proto = end_compiler (&parser);
+    if (parser.had_error) {
+        free_proto (proto);
+        return false;
     }
 
-    obj_func *func = end_compiler ();
-    return parser.had_error ? NULL : func;
+    // The constants of the new code still point into `text`.
+    push (OBJ_VAL ((obj *) text));
+    free_value_array (consts);
+    fill_func (func, proto);
+    pop ();
+
+    free_proto (proto);
+    return true;
+}
+
+obj_func *compile (const char *source, obj_module *module) {
+    func_proto *proto = compile_proto (source, true);
+    if (proto == NULL) return NULL;
+
+    obj_func *func = publish_proto (proto, module);
+    free_proto (proto);
+    return func;
 }
 
-void mark_compiler_roots (void) {
-    compiler_t *compiler = current;
-    while (compiler != NULL) {
-        mark_object ((obj *) compiler->func);
-        compiler = compiler->enclosing;
+typedef struct {
+    const char  **sources;
+    func_proto  **protos;
+    size          count;
+    atomic_size_t next;
+} compile_batch;
+
+static void *compile_worker (void *arg) {
+    compile_batch *batch = arg;
+    size           i;
+
+    while ((i = atomic_fetch_add (&batch->next, 1)) < batch->count) {
+        batch->protos[i] = compile_proto (batch->sources[i], false);
+    }
+
+    return NULL;
+}
+
+// The calling thread takes sources off the batch like the others, so a
+// single source or a single core spawns no threads at all.
+void compile_protos (const char **sources, func_proto **protos, size count) {
+    compile_batch batch = {
+        .sources = sources,
+        .protos  = protos,
+        .count   = count,
+    };
+    atomic_init (&batch.next, 0);
+
+    long cpus    = sysconf (_SC_NPROCESSORS_ONLN);
+    size threads = cpus > 1 ? (size) cpus : 1;
+    if (threads > count) threads = count;
+    if (threads > COMPILE_THREADS_MAX) threads = COMPILE_THREADS_MAX;
+
+    pthread_t workers[COMPILE_THREADS_MAX];
+    size      started = 0;
+    while (started + 1 < threads &&
+           pthread_create (&workers[started], NULL, compile_worker, &batch) ==
+               0) {
+        started++;
     }
+
+    compile_worker (&batch);
+    for (size i = 0; i < started; i++) pthread_join (workers[i], NULL);
 }
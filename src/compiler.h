@@ -4,7 +4,39 @@
 #define __ALOXOTL_COMPILER__
 #include "obj.h"
 
-obj_func *compile (const char *source);
-void      mark_compiler_roots (void);
+// A compiled function that lives outside the heap: its code, line table
+// and constants, with strings still pointing into the source, which has to
+// outlive it. Building one touches neither the heap nor any other global
+// state, so protos can be compiled on any thread. publish_proto turns one
+// into the function objects the VM runs.
+typedef struct _func_proto func_proto;
+
+// Returns NULL if `source` has errors, which are printed if `report`.
+func_proto *compile_proto (const char *source, bool report);
+void        free_proto (func_proto *proto);
+
+// Creates the functions for `proto`, belonging to `module`. Allocates, so it
+// must run on the VM's thread.
+obj_func *publish_proto (const func_proto *proto, obj_module *module);
+
+// Compiles `count` sources on as many threads as there are cores, setting
+// each of `protos`. Errors are not reported: callers compile a failing
+// source again with compile () to show them.
+void compile_protos (const char **sources, func_proto **protos, size count);
+
+// Functions compiled from `source` belong to `module`, NULL for the main
+// script.
+obj_func *compile (const char *source, obj_module *module);
+
+// With lazy compiling, which is the default, function bodies are parsed for
+// errors but only compiled on their first call, so code that never runs
+// costs little more than its source text. A function that has not been
+// compiled yet has no code.
+void set_lazy_compile (bool lazy);
+bool lazy_compile_enabled (void);
+
+// Compiles the body of a lazy function in place, printing any errors.
+// Allocates, so it must run on the VM's thread.
+bool compile_lazy (obj_func *func);
 
 #endif
@@ -45,12 +45,24 @@ static size constant_instruction (const char *name, chunk *chunk, size offset) {
     return offset + 2;
 }
 
+static size invoke_instruction (const char *name, chunk *chunk, size offset) {
+    uint8 constant = chunk->code[offset + 1];
+    uint8 argc     = chunk->code[offset + 2];
+
+    printf ("%-16s (%d args) %4d '", name, argc, constant);
+    print_value (chunk->consts.values[constant]);
+    printf ("'\n");
+
+    return offset + 3;
+}
+
 int disassemble_instruction (chunk *chunk, size offset) {
     printf ("%04zu ", offset);
-    if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
+    size line = get_line (chunk, offset);
+    if (offset > 0 && line == get_line (chunk, offset - 1)) {
         printf ("\t | ");
     } else {
-        printf ("%4zu ", chunk->lines[offset]);
+        printf ("%4zu ", line);
     }
 
     uint8 instr = chunk->code[offset];
@@ -66,6 +78,17 @@ int disassemble_instruction (chunk *chunk, size offset) {
         case OP_SUBTRACT: return simple_instruction ("OP_SUBTRACT", offset);
         case OP_MULTIPLY: return simple_instruction ("OP_MULTIPLY", offset);
         case OP_DIVIDE: return simple_instruction ("OP_DIVIDE", offset);
+        case OP_INT_DIVIDE:
+            return simple_instruction ("OP_INT_DIVIDE", offset);
+        case OP_MODULO: return simple_instruction ("OP_MODULO", offset);
+        case OP_BIT_AND: return simple_instruction ("OP_BIT_AND", offset);
+        case OP_BIT_NOT: return simple_instruction ("OP_BIT_NOT", offset);
+        case OP_BIT_OR: return simple_instruction ("OP_BIT_OR", offset);
+        case OP_BIT_XOR: return simple_instruction ("OP_BIT_XOR", offset);
+        case OP_SHIFT_LEFT:
+            return simple_instruction ("OP_SHIFT_LEFT", offset);
+        case OP_SHIFT_RIGHT:
+            return simple_instruction ("OP_SHIFT_RIGHT", offset);
         case OP_NOT: return simple_instruction ("OP_NOT", offset);
         case OP_EQUAL: return simple_instruction ("OP_EQUAL", offset);
         case OP_GREATER: return simple_instruction ("OP_GREATER", offset);
@@ -100,6 +123,19 @@ int disassemble_instruction (chunk *chunk, size offset) {
             return constant_instruction ("OP_SET_PROPERTY", chunk, offset);
         case OP_METHOD:
             return constant_instruction ("OP_METHOD", chunk, offset);
+        case OP_IMPORT:
+            return constant_instruction ("OP_IMPORT", chunk, offset);
+        case OP_BIND_MODULE:
+            return simple_instruction ("OP_BIND_MODULE", offset);
+        case OP_INHERIT: return simple_instruction ("OP_INHERIT", offset);
+        case OP_BUILD_LIST:
+            return byte_instruction ("OP_BUILD_LIST", chunk, offset);
+        case OP_GET_INDEX: return simple_instruction ("OP_GET_INDEX", offset);
+        case OP_SET_INDEX: return simple_instruction ("OP_SET_INDEX", offset);
+        case OP_GET_SUPER:
+            return constant_instruction ("OP_GET_SUPER", chunk, offset);
+        case OP_SUPER_INVOKE:
+            return invoke_instruction ("OP_SUPER_INVOKE", chunk, offset);
 
         case OP_CLOSURE: {
             offset++;
@@ -0,0 +1,190 @@
+// apachejuice, 18.10.2026
+// See LICENSE for details.
+#include "f64array.h"
+#include "obj.h"
+#include "vec.h"
+#include "vm.h"
+
+#include <math.h>
+
+// Largest array f64_array will create, 2 GiB of doubles. Anything bigger
+// is almost certainly a mistake, and far larger counts would overflow the
+// byte size of the allocation.
+#define F64_ARRAY_MAX ((size) 1 << 28)
+
+// Checks that the first `argc` arguments are f64 arrays.
+static bool f64_args (const char *name, uint8 argc, value *args,
+                      uint8 expect) {
+    if (argc != expect) {
+        native_error ("%s expects %d arguments but got %d", name, expect,
+                      argc);
+        return false;
+    }
+
+    for (uint8 i = 0; i < argc; i++) {
+        if (!IS_F64_ARRAY (args[i])) {
+            native_error ("%s expects f64 arrays, not %s", name,
+                          VALUE_TYPESTR (args[i]));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool same_length (const char *name, value a, value b) {
+    if (AS_F64_ARRAY (a)->count != AS_F64_ARRAY (b)->count) {
+        native_error ("%s expects arrays of the same length, got %zu and %zu",
+                      name, AS_F64_ARRAY (a)->count, AS_F64_ARRAY (b)->count);
+        return false;
+    }
+
+    return true;
+}
+
+// f64_array(n): n zeros. f64_array(list): the numbers in the list.
+static value native_f64_array (uint8 argc, value *args) {
+    if (argc == 1 && IS_NUMERIC (args[0])) {
+        double count = AS_FLOAT (args[0]);
+        if (count < 0 || count != floor (count)) {
+            return native_error ("f64_array size must be a whole number");
+        }
+
+        if (count > F64_ARRAY_MAX) {
+            return native_error ("f64_array size %g is out of range [0, %zu]",
+                                 count, F64_ARRAY_MAX);
+        }
+
+        return OBJ_VAL ((obj *) new_f64_array ((size) count));
+    }
+
+    if (argc != 1 || !IS_LIST (args[0])) {
+        return native_error ("f64_array expects a size or a list of numbers");
+    }
+
+    value_array *items = &AS_LIST (args[0])->items;
+    for (size i = 0; i < items->count; i++) {
+        if (!IS_NUMERIC (items->values[i])) {
+            return native_error ("f64_array element %zu is a %s, not a number",
+                                 i, VALUE_TYPESTR (items->values[i]));
+        }
+    }
+
+    obj_f64_array *array = new_f64_array (items->count);
+    for (size i = 0; i < array->count; i++) {
+        array->data[i] = AS_FLOAT (items->values[i]);
+    }
+
+    return OBJ_VAL ((obj *) array);
+}
+
+static value native_f64_sum (uint8 argc, value *args) {
+    if (!f64_args ("f64_sum", argc, args, 1)) return NIL_VAL ();
+
+    obj_f64_array *x = AS_F64_ARRAY (args[0]);
+    return NUMBER_VAL (vec_sum (x->data, x->count));
+}
+
+static value native_f64_min (uint8 argc, value *args) {
+    if (!f64_args ("f64_min", argc, args, 1)) return NIL_VAL ();
+
+    obj_f64_array *x = AS_F64_ARRAY (args[0]);
+    if (x->count == 0) return native_error ("f64_min of an empty array");
+
+    return NUMBER_VAL (vec_min (x->data, x->count));
+}
+
+static value native_f64_max (uint8 argc, value *args) {
+    if (!f64_args ("f64_max", argc, args, 1)) return NIL_VAL ();
+
+    obj_f64_array *x = AS_F64_ARRAY (args[0]);
+    if (x->count == 0) return native_error ("f64_max of an empty array");
+
+    return NUMBER_VAL (vec_max (x->data, x->count));
+}
+
+static value native_f64_dot (uint8 argc, value *args) {
+    if (!f64_args ("f64_dot", argc, args, 2) ||
+        !same_length ("f64_dot", args[0], args[1])) {
+        return NIL_VAL ();
+    }
+
+    obj_f64_array *x = AS_F64_ARRAY (args[0]);
+    obj_f64_array *y = AS_F64_ARRAY (args[1]);
+    return NUMBER_VAL (vec_dot (x->data, y->data, x->count));
+}
+
+// f64_axpy(a, x, y): y += a * x, in place. Returns y.
+static value native_f64_axpy (uint8 argc, value *args) {
+    if (argc != 3 || !IS_NUMERIC (args[0])) {
+        return native_error ("f64_axpy expects a number and two f64 arrays");
+    }
+
+    if (!f64_args ("f64_axpy", 2, args + 1, 2) ||
+        !same_length ("f64_axpy", args[1], args[2])) {
+        return NIL_VAL ();
+    }
+
+    obj_f64_array *x = AS_F64_ARRAY (args[1]);
+    obj_f64_array *y = AS_F64_ARRAY (args[2]);
+    vec_axpy (AS_FLOAT (args[0]), x->data, y->data, x->count);
+
+    return args[2];
+}
+
+typedef void (*elementwise_fn) (double *out, const double *x, const double *y,
+                                size n);
+
+// The result is a new array; the arguments keep it clear of the collector
+// until it is returned.
+static value elementwise (const char *name, elementwise_fn fn, uint8 argc,
+                          value *args) {
+    if (!f64_args (name, argc, args, 2) ||
+        !same_length (name, args[0], args[1])) {
+        return NIL_VAL ();
+    }
+
+    obj_f64_array *out = new_f64_array (AS_F64_ARRAY (args[0])->count);
+    fn (out->data, AS_F64_ARRAY (args[0])->data, AS_F64_ARRAY (args[1])->data,
+        out->count);
+
+    return OBJ_VAL ((obj *) out);
+}
+
+static value native_f64_add (uint8 argc, value *args) {
+    return elementwise ("f64_add", vec_add, argc, args);
+}
+
+static value native_f64_mul (uint8 argc, value *args) {
+    return elementwise ("f64_mul", vec_mul, argc, args);
+}
+
+static value native_f64_prefix_sum (uint8 argc, value *args) {
+    if (!f64_args ("f64_prefix_sum", argc, args, 1)) return NIL_VAL ();
+
+    obj_f64_array *out = new_f64_array (AS_F64_ARRAY (args[0])->count);
+    vec_prefix_sum (out->data, AS_F64_ARRAY (args[0])->data, out->count);
+
+    return OBJ_VAL ((obj *) out);
+}
+
+// Sorts in place and returns the array.
+static value native_f64_sort (uint8 argc, value *args) {
+    if (!f64_args ("f64_sort", argc, args, 1)) return NIL_VAL ();
+
+    vec_sort (AS_F64_ARRAY (args[0])->data, AS_F64_ARRAY (args[0])->count);
+    return args[0];
+}
+
+void register_f64_natives (void) {
+    define_native ("f64_array", &native_f64_array);
+    define_native ("f64_add", &native_f64_add);
+    define_native ("f64_axpy", &native_f64_axpy);
+    define_native ("f64_dot", &native_f64_dot);
+    define_native ("f64_max", &native_f64_max);
+    define_native ("f64_min", &native_f64_min);
+    define_native ("f64_mul", &native_f64_mul);
+    define_native ("f64_prefix_sum", &native_f64_prefix_sum);
+    define_native ("f64_sort", &native_f64_sort);
+    define_native ("f64_sum", &native_f64_sum);
+}
@@ -0,0 +1,13 @@
+// apachejuice, 18.10.2026
+// See LICENSE for details.
+#ifndef __ALOXOTL_F64ARRAY__
+#define __ALOXOTL_F64ARRAY__
+
+#include "common.h"
+
+// Natives creating f64 arrays and running the kernels from vec.h over them:
+// f64_array, f64_add, f64_axpy, f64_dot, f64_max, f64_min, f64_mul,
+// f64_prefix_sum, f64_sort, f64_sum.
+void register_f64_natives (void);
+
+#endif
@@ -0,0 +1,185 @@
+// apachejuice, 18.10.2026
+// See LICENSE for details.
+#include "gcpolicy.h"
+#include "common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GC_DEFAULT_MIN_HEAP (1024 * 1024)
+#define GC_DEFAULT_TARGET (0.05)
+#define GC_DEFAULT_GROW_FACTOR (2.0)
+
+#define GC_MIN_GROW_FACTOR (1.1)
+#define GC_MAX_GROW_FACTOR (8.0)
+
+// Part of the memory limit left for everything that is not the GC heap.
+#define GC_LIMIT_HEADROOM (0.1)
+
+static bool parse_size (const char *text, size *out) {
+    char  *end;
+    double val = strtod (text, &end);
+    if (end == text || !(val >= 0)) return false;
+
+    switch (*end) {
+        case 'k':
+        case 'K': val *= 1024; end++; break;
+        case 'm':
+        case 'M': val *= 1024 * 1024; end++; break;
+        case 'g':
+        case 'G': val *= 1024 * 1024 * 1024; end++; break;
+        default: break;
+    }
+
+    // Also catches values whose suffix multiplication overflowed.
+    if (*end != 0 || val >= (double) SIZE_MAX) return false;
+
+    *out = (size) val;
+    return true;
+}
+
+static bool parse_fraction (const char *text, double *out) {
+    char  *end;
+    double val = strtod (text, &end);
+    if (end == text || *end != 0 || val <= 0 || val >= 1) return false;
+
+    *out = val;
+    return true;
+}
+
+// Reads the cgroup v2 memory.max of the cgroup this process lives in.
+static size cgroup_memory_limit (void) {
+    char  path[4096] = "/sys/fs/cgroup/memory.max";
+    FILE *file       = fopen ("/proc/self/cgroup", "r");
+
+    if (file != NULL) {
+        char line[4000];
+        while (fgets (line, sizeof (line), file)) {
+            if (strncmp (line, "0::", 3) != 0) continue;
+
+            line[strcspn (line, "\n")] = 0;
+            snprintf (path, sizeof (path), "/sys/fs/cgroup%s/memory.max",
+                      strcmp (line + 3, "/") == 0 ? "" : line + 3);
+            break;
+        }
+
+        fclose (file);
+    }
+
+    file = fopen (path, "r");
+    if (file == NULL) return 0;
+
+    char text[64] = {0};
+    if (!fgets (text, sizeof (text), file)) text[0] = 0;
+    fclose (file);
+
+    text[strcspn (text, "\n")] = 0;
+    size limit;
+    if (strcmp (text, "max") == 0 || !parse_size (text, &limit)) return 0;
+
+    return limit;
+}
+
+static void read_env (const char *name, const char *prefix,
+                      gc_policy *policy) {
+    const char *val = getenv (name);
+    if (val == NULL) return;
+
+    char arg[256];
+    snprintf (arg, sizeof (arg), "%s%s", prefix, val);
+    if (!gc_policy_option (policy, arg)) {
+        fprintf (stderr, "Ignoring invalid %s '%s'\n", name, val);
+    }
+}
+
+void init_gc_policy (gc_policy *policy) {
+    policy->min_heap        = GC_DEFAULT_MIN_HEAP;
+    policy->max_heap        = 0;
+    policy->cgroup_limit    = cgroup_memory_limit ();
+    policy->memory_limit    = policy->cgroup_limit;
+    policy->target_fraction = GC_DEFAULT_TARGET;
+    policy->grow_factor     = GC_DEFAULT_GROW_FACTOR;
+}
+
+void gc_policy_from_env (gc_policy *policy) {
+    read_env ("ALOXOTL_GC_MIN_HEAP", "--gc-min-heap=", policy);
+    read_env ("ALOXOTL_GC_MAX_HEAP", "--gc-max-heap=", policy);
+    read_env ("ALOXOTL_GC_TARGET", "--gc-target=", policy);
+    read_env ("ALOXOTL_GC_MEMORY_LIMIT", "--gc-memory-limit=", policy);
+}
+
+// Applies one `--gc-*=value` option. Returns false if `arg` is not a GC
+// option or its value does not parse.
+bool gc_policy_option (gc_policy *policy, const char *arg) {
+    const char *val;
+
+    if ((val = strchr (arg, '=')) == NULL) return false;
+    val++;
+
+    if (strncmp (arg, "--gc-min-heap=", 14) == 0) {
+        return parse_size (val, &policy->min_heap);
+    } else if (strncmp (arg, "--gc-max-heap=", 14) == 0) {
+        return parse_size (val, &policy->max_heap);
+    } else if (strncmp (arg, "--gc-target=", 12) == 0) {
+        return parse_fraction (val, &policy->target_fraction);
+    } else if (strncmp (arg, "--gc-memory-limit=", 18) == 0) {
+        size limit;
+        if (!parse_size (val, &limit)) return false;
+
+        // Replaces any earlier limit, so a flag wins over the environment,
+        // but never goes past the cgroup's.
+        if (policy->cgroup_limit != 0 &&
+            (limit == 0 || limit > policy->cgroup_limit)) {
+            limit = policy->cgroup_limit;
+        }
+
+        policy->memory_limit = limit;
+        return true;
+    }
+
+    return false;
+}
+
+bool gc_policy_valid (const gc_policy *policy) {
+    return policy->max_heap == 0 || policy->max_heap >= policy->min_heap;
+}
+
+size gc_policy_next_threshold (gc_policy *policy, size live, uint64 pause_ns,
+                               uint64 mutator_ns) {
+    double total = (double) pause_ns + (double) mutator_ns;
+    if (total > 0) {
+        // Collections happen about as often as the headroom above the live
+        // heap fills up, so scaling the headroom by how far off target we are
+        // converges on the target. Damped to avoid swinging on noisy pauses.
+        double ratio = ((double) pause_ns / total) / policy->target_fraction;
+        if (ratio < 0.5) ratio = 0.5;
+        if (ratio > 2.0) ratio = 2.0;
+
+        policy->grow_factor = 1 + (policy->grow_factor - 1) * ratio;
+        if (policy->grow_factor < GC_MIN_GROW_FACTOR) {
+            policy->grow_factor = GC_MIN_GROW_FACTOR;
+        }
+
+        if (policy->grow_factor > GC_MAX_GROW_FACTOR) {
+            policy->grow_factor = GC_MAX_GROW_FACTOR;
+        }
+    }
+
+    size next = (size) ((double) live * policy->grow_factor);
+    if (next < policy->min_heap) next = policy->min_heap;
+    if (policy->max_heap && next > policy->max_heap) next = policy->max_heap;
+
+    if (policy->memory_limit) {
+        size cap = (size) ((double) policy->memory_limit *
+                           (1 - GC_LIMIT_HEADROOM));
+        if (next > cap) next = cap;
+    }
+
+    // Past the limits already: still leave some room, or every allocation
+    // would collect.
+    size floor = live + live / 16 + 64 * 1024;
+    if (next < floor) next = floor;
+
+    return next;
+}
@@ -0,0 +1,31 @@
+// apachejuice, 18.10.2026
+// See LICENSE for details.
+#ifndef __ALOXOTL_GCPOLICY__
+#define __ALOXOTL_GCPOLICY__
+
+#include "common.h"
+
+// Decides when the next collection happens. After every collection the grow
+// factor is nudged so that the share of time spent collecting approaches
+// `target_fraction`, and the resulting threshold is clamped to the
+// configured heap bounds and memory limit. Sizes of 0 mean "no limit".
+// `memory_limit` never exceeds `cgroup_limit`, the cgroup's memory.max.
+typedef struct {
+    size   min_heap;
+    size   max_heap;
+    size   memory_limit;
+    size   cgroup_limit;
+    double target_fraction;
+    double grow_factor;
+} gc_policy;
+
+void init_gc_policy (gc_policy *policy);
+void gc_policy_from_env (gc_policy *policy);
+bool gc_policy_option (gc_policy *policy, const char *arg);
+
+// False if the options contradict each other, i.e. max_heap < min_heap.
+bool gc_policy_valid (const gc_policy *policy);
+size gc_policy_next_threshold (gc_policy *policy, size live, uint64 pause_ns,
+                               uint64 mutator_ns);
+
+#endif
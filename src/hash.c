@@ -0,0 +1,226 @@
+// apachejuice, 18.10.2026
+// See LICENSE for details.
+#include "hash.h"
+#include "common.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define HASH_X86
+#endif
+
+#define HASH_P1 0x9e3779b185ebca87ull
+#define HASH_P2 0xc2b2ae3d27d4eb4full
+#define HASH_P3 0x165667b19e3779f9ull
+#define HASH_P32 0x9e3779b1u
+
+#define HASH_STRIPE 64
+#define HASH_LANES 8
+
+// Inputs at least this long go through the striped loop.
+#define HASH_LONG 256
+
+// Stripes between two scrambles of the accumulators.
+#define HASH_SCRAMBLE_EVERY 16
+
+static const uint64 hash_key[HASH_LANES] = {
+    0xbe4ba423396cfeb8ull, 0x1cad21f72c81017cull, 0xdb979083e96dd4deull,
+    0x1f67b3b7a4a44072ull, 0x78e5c0cc4ee679cbull, 0x2172ffcc7dd05a82ull,
+    0x8e2443f7744608b8ull, 0x4c263a81e69035e0ull,
+};
+
+static inline uint64 read64 (const char *p) {
+    uint64 v;
+    memcpy (&v, p, sizeof (v));
+    return v;
+}
+
+static inline uint32 read32 (const char *p) {
+    uint32 v;
+    memcpy (&v, p, sizeof (v));
+    return v;
+}
+
+static inline uint64 rotl64 (uint64 x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64 round64 (uint64 acc, uint64 word) {
+    acc += word * HASH_P2;
+    acc  = rotl64 (acc, 31);
+    return acc * HASH_P1;
+}
+
+static inline uint64 avalanche (uint64 h) {
+    h ^= h >> 33;
+    h *= HASH_P2;
+    h ^= h >> 29;
+    h *= HASH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint32 hash_fnv1a (const char *data, size len) {
+    uint32 hash = 2166136261u;
+    for (size i = 0; i < len; i++) {
+        hash ^= (uint8) data[i];
+        hash *= 16777619;
+    }
+
+    return hash;
+}
+
+uint64 hash_checksum (const void *data, size len) {
+    return ((uint64) hash_words (data, len) << 32) | hash_fnv1a (data, len);
+}
+
+// Each lane adds the product of the two halves of its keyed word, and the
+// unkeyed word goes into the neighbouring lane so no input bits are lost.
+// This only needs 32x32->64 multiplies, which SSE2 and AVX2 have.
+static void accumulate_scalar (uint64 *acc, const char *p, size stripes) {
+    for (size s = 0; s < stripes; s++, p += HASH_STRIPE) {
+        for (int i = 0; i < HASH_LANES; i++) {
+            uint64 word  = read64 (p + 8 * i);
+            uint64 keyed = word ^ hash_key[i];
+            acc[i ^ 1]  += word;
+            acc[i]      += (keyed & 0xffffffffu) * (keyed >> 32);
+        }
+    }
+}
+
+static void scramble_scalar (uint64 *acc) {
+    for (int i = 0; i < HASH_LANES; i++) {
+        uint64 a = acc[i];
+        a ^= a >> 47;
+        a ^= hash_key[(i + 3) % HASH_LANES];
+        acc[i] = a * HASH_P32;
+    }
+}
+
+#ifdef HASH_X86
+static void accumulate_sse2 (uint64 *acc, const char *p, size stripes) {
+    __m128i *lanes = (__m128i *) acc;
+    for (size s = 0; s < stripes; s++, p += HASH_STRIPE) {
+        for (int i = 0; i < HASH_LANES / 2; i++) {
+            __m128i word = _mm_loadu_si128 ((const __m128i *) p + i);
+            __m128i key =
+                _mm_loadu_si128 ((const __m128i *) hash_key + i);
+            __m128i keyed = _mm_xor_si128 (word, key);
+            __m128i hi    = _mm_shuffle_epi32 (keyed, _MM_SHUFFLE (0, 3, 0, 1));
+            __m128i prod  = _mm_mul_epu32 (keyed, hi);
+            __m128i swap  = _mm_shuffle_epi32 (word, _MM_SHUFFLE (1, 0, 3, 2));
+            __m128i sum   = _mm_add_epi64 (prod, swap);
+            _mm_storeu_si128 (
+                lanes + i,
+                _mm_add_epi64 (_mm_loadu_si128 (lanes + i), sum));
+        }
+    }
+}
+
+__attribute__ ((target ("avx2"))) static void
+accumulate_avx2 (uint64 *acc, const char *p, size stripes) {
+    __m256i *lanes = (__m256i *) acc;
+    for (size s = 0; s < stripes; s++, p += HASH_STRIPE) {
+        for (int i = 0; i < HASH_LANES / 4; i++) {
+            __m256i word = _mm256_loadu_si256 ((const __m256i *) p + i);
+            __m256i key =
+                _mm256_loadu_si256 ((const __m256i *) hash_key + i);
+            __m256i keyed = _mm256_xor_si256 (word, key);
+            __m256i hi =
+                _mm256_shuffle_epi32 (keyed, _MM_SHUFFLE (0, 3, 0, 1));
+            __m256i prod = _mm256_mul_epu32 (keyed, hi);
+            __m256i swap =
+                _mm256_shuffle_epi32 (word, _MM_SHUFFLE (1, 0, 3, 2));
+            __m256i sum = _mm256_add_epi64 (prod, swap);
+            _mm256_storeu_si256 (
+                lanes + i,
+                _mm256_add_epi64 (_mm256_loadu_si256 (lanes + i), sum));
+        }
+    }
+}
+#endif
+
+typedef void (*accumulate_fn) (uint64 *acc, const char *p, size stripes);
+
+// Starts out scalar so hashing works before init_hash, and is only changed
+// on the VM thread before any compiler threads exist.
+static accumulate_fn accumulate = accumulate_scalar;
+
+bool hash_set_isa (hash_isa isa) {
+    switch (isa) {
+        case HASH_ISA_SCALAR: accumulate = accumulate_scalar; return true;
+
+#ifdef HASH_X86
+        case HASH_ISA_SSE2: accumulate = accumulate_sse2; return true;
+        case HASH_ISA_AVX2:
+            __builtin_cpu_init ();
+            if (!__builtin_cpu_supports ("avx2")) return false;
+            accumulate = accumulate_avx2;
+            return true;
+#else
+        case HASH_ISA_SSE2:
+        case HASH_ISA_AVX2: return false;
+#endif
+    }
+
+    return false;
+}
+
+void init_hash (void) {
+    if (!hash_set_isa (HASH_ISA_AVX2) && !hash_set_isa (HASH_ISA_SSE2)) {
+        hash_set_isa (HASH_ISA_SCALAR);
+    }
+}
+
+static uint64 hash_long (const char *data, size len, uint64 h) {
+    uint64 acc[HASH_LANES] = {
+        HASH_P32, HASH_P1, HASH_P2, HASH_P3,
+        HASH_P1 ^ len, HASH_P2 ^ len, HASH_P3 ^ len, HASH_P32 ^ len,
+    };
+
+    size stripes = len / HASH_STRIPE;
+    size block   = HASH_SCRAMBLE_EVERY;
+    for (size s = 0; s < stripes; s += block) {
+        if (block > stripes - s) block = stripes - s;
+        accumulate (acc, data + s * HASH_STRIPE, block);
+        scramble_scalar (acc);
+    }
+
+    for (int i = 0; i < HASH_LANES; i++) h = round64 (h, acc[i]);
+    return h;
+}
+
+uint32 hash_words (const char *data, size len) {
+    uint64      h   = HASH_P3 ^ (len * HASH_P1);
+    const char *p   = data;
+    const char *end = data + len;
+
+    if (len >= HASH_LONG) {
+        h  = hash_long (data, len, h);
+        p += len / HASH_STRIPE * HASH_STRIPE;
+    }
+
+    for (; end - p >= 8; p += 8) h = round64 (h, read64 (p));
+
+    // Whatever is left is shorter than a word. Reread the last eight bytes
+    // when there are that many, otherwise combine two overlapping halves, or
+    // the first, middle and last byte.
+    if (p < end) {
+        size   rest = (size) (end - p);
+        uint64 tail;
+        if (len >= 8) {
+            tail = read64 (end - 8);
+        } else if (rest >= 4) {
+            tail = ((uint64) read32 (p) << 32) | read32 (end - 4);
+        } else {
+            tail = ((uint64) (uint8) p[0] << 16) |
+                   ((uint64) (uint8) p[rest / 2] << 8) | (uint8) end[-1];
+        }
+
+        h = round64 (h ^ rest, tail);
+    }
+
+    h = avalanche (h);
+    return (uint32) (h ^ (h >> 32));
+}
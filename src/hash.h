@@ -0,0 +1,39 @@
+// apachejuice, 18.10.2026
+// See LICENSE for details.
+#ifndef __ALOXOTL_HASH__
+#define __ALOXOTL_HASH__
+
+#include "common.h"
+
+// Byte-at-a-time FNV-1a, the original string hash. Kept for comparison.
+uint32 hash_fnv1a (const char *data, size len);
+
+// Reads eight bytes at a time and, for long inputs, runs eight independent
+// lanes over 64-byte stripes, vectorized with SSE2 or AVX2 where the CPU has
+// them. Every path produces the same value.
+uint32 hash_words (const char *data, size len);
+
+// A 64-bit checksum, hash_words and hash_fnv1a side by side. Used to key
+// and verify files the VM maps and runs code from.
+uint64 hash_checksum (const void *data, size len);
+
+typedef enum {
+    HASH_ISA_SCALAR,
+    HASH_ISA_SSE2,
+    HASH_ISA_AVX2,
+} hash_isa;
+
+// Picks the fastest striped loop this CPU has. Called once from init_vm,
+// before any thread that could hash is started.
+void init_hash (void);
+
+// Forces the striped loop of hash_words onto one implementation, for
+// benchmarks. Not thread-safe. Returns false if this CPU or build does not have it.
+bool hash_set_isa (hash_isa isa);
+
+// The hash used for strings. Build with -DSTRING_HASH=hash_fnv1a to switch.
+#ifndef STRING_HASH
+#define STRING_HASH hash_words
+#endif
+
+#endif
@@ -0,0 +1,494 @@
+// apachejuice, 18.10.2026
+// See LICENSE for details.
+#define _DEFAULT_SOURCE
+
+#include "heap.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define HEAP_OS_PAGE 4096
+#define HEAP_BIN_COUNT 32
+#define HEAP_LARGE_BIN UINT32_MAX
+
+// Empty pages kept mapped for reuse instead of being unmapped right away.
+// Their memory is handed back to the OS, only the address range stays.
+#define HEAP_POOL_MAX 16
+
+typedef struct {
+    heap_page *pages;
+    heap_page *tail;
+    heap_page *cursor;
+} heap_bin;
+
+static struct {
+    heap_bin       bins[HEAP_BIN_COUNT];
+    uint32         bin_sizes[HEAP_BIN_COUNT];
+    uint8          bin_of[HEAP_MAX_SMALL / HEAP_CELL_ALIGN + 1];
+    heap_page     *large;
+    heap_page     *pool;
+    size           pool_count;
+    size           cell_bytes;
+    size           swept_pages;
+    size           swept_bytes;
+    uint32         epoch;
+    heap_finalizer finalizer;
+} heap;
+
+static uint8 *map_region (size sz) {
+    size   span = sz + HEAP_PAGE_SIZE;
+    uint8 *raw  = mmap (NULL, span, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) exit (1);
+
+    uintptr_t aligned = ((uintptr_t) raw + HEAP_PAGE_SIZE - 1) &
+                        ~(uintptr_t) (HEAP_PAGE_SIZE - 1);
+    size head = aligned - (uintptr_t) raw;
+    size tail = span - head - sz;
+
+    if (head) munmap (raw, head);
+    if (tail) munmap ((uint8 *) aligned + sz, tail);
+
+    return (uint8 *) aligned;
+}
+
+static void format_page (heap_page *page, uint32 cell_size,
+                         uint32 bin_index) {
+    page->next        = NULL;
+    page->cells       = page->base + HEAP_CELL_ALIGN;
+    page->cell_size   = cell_size;
+    page->cell_div    = (uint32) (((uint64) 1 << 32) / cell_size + 1);
+    page->bin         = bin_index;
+    page->live        = 0;
+    page->scan_word   = 0;
+    page->sweep_epoch = heap.epoch;
+    page->evacuated   = false;
+
+    if (bin_index == HEAP_LARGE_BIN) {
+        page->cell_count = 1;
+    } else {
+        page->cell_count = (HEAP_PAGE_SIZE - HEAP_CELL_ALIGN) / cell_size;
+    }
+
+    memset (page->alloc_bits, 0, sizeof (page->alloc_bits));
+    memset (page->mark_bits, 0, sizeof (page->mark_bits));
+
+    // The first word of every page points back at its descriptor.
+    *(heap_page **) page->base = page;
+}
+
+static heap_page *new_page (uint32 bin_index) {
+    heap_page *page = heap.pool;
+    if (page != NULL) {
+        heap.pool = page->next;
+        heap.pool_count--;
+    } else {
+        page = malloc (sizeof (heap_page));
+        if (page == NULL) exit (1);
+
+        page->base        = map_region (HEAP_PAGE_SIZE);
+        page->region_size = HEAP_PAGE_SIZE;
+    }
+
+    format_page (page, heap.bin_sizes[bin_index], bin_index);
+
+    heap_bin *bin = &heap.bins[bin_index];
+    if (bin->tail != NULL) {
+        bin->tail->next = page;
+    } else {
+        bin->pages = page;
+    }
+
+    bin->tail = page;
+    return page;
+}
+
+static void release_page (heap_page *page) {
+    if (page->bin != HEAP_LARGE_BIN && heap.pool_count < HEAP_POOL_MAX) {
+        madvise (page->base, page->region_size, MADV_DONTNEED);
+        page->next = heap.pool;
+        heap.pool  = page;
+        heap.pool_count++;
+        return;
+    }
+
+    munmap (page->base, page->region_size);
+    free (page);
+}
+
+static inline uint32 bitmap_words (heap_page *page) {
+    return (page->cell_count + 63) / 64;
+}
+
+static inline obj *cell_at (heap_page *page, uint32 idx) {
+    return (obj *) (page->cells + (size) idx * page->cell_size);
+}
+
+static void *take_cell (heap_page *page) {
+    uint32 words = bitmap_words (page);
+
+    for (uint32 w = page->scan_word; w < words; w++) {
+        uint64 free_bits = ~page->alloc_bits[w];
+        if (free_bits == 0) continue;
+
+        uint32 idx = w * 64 + (uint32) __builtin_ctzll (free_bits);
+        if (idx >= page->cell_count) break;
+
+        page->alloc_bits[w] |= (uint64) 1 << (idx & 63);
+        page->scan_word = w;
+        page->live++;
+        heap.cell_bytes += page->cell_size;
+
+        return cell_at (page, idx);
+    }
+
+    page->scan_word = words;
+    return NULL;
+}
+
+// Finalizes every allocated but unmarked cell, then makes the mark bits the
+// new allocation bits.
+static void sweep_page (heap_page *page) {
+    uint32 words = bitmap_words (page);
+    uint32 live  = 0;
+
+    for (uint32 w = 0; w < words; w++) {
+        uint64 dead = page->alloc_bits[w] & ~page->mark_bits[w];
+        while (dead) {
+            uint32 bit = (uint32) __builtin_ctzll (dead);
+            heap.finalizer (cell_at (page, w * 64 + bit));
+            heap.cell_bytes -= page->cell_size;
+            dead &= dead - 1;
+        }
+
+        page->alloc_bits[w] = page->mark_bits[w];
+        page->mark_bits[w]  = 0;
+        live += (uint32) __builtin_popcountll (page->alloc_bits[w]);
+    }
+
+    page->live        = live;
+    page->scan_word   = 0;
+    page->sweep_epoch = heap.epoch;
+}
+
+static void *alloc_large (size sz) {
+    heap_page *page = malloc (sizeof (heap_page));
+    if (page == NULL) exit (1);
+
+    size region = (HEAP_CELL_ALIGN + sz + HEAP_OS_PAGE - 1) &
+                  ~(size) (HEAP_OS_PAGE - 1);
+    page->base        = map_region (region);
+    page->region_size = region;
+    format_page (page, (uint32) heap_cell_size (sz), HEAP_LARGE_BIN);
+
+    page->alloc_bits[0] = 1;
+    page->live          = 1;
+    page->next          = heap.large;
+    heap.large          = page;
+    heap.cell_bytes += page->cell_size;
+
+    return page->cells;
+}
+
+// Large objects are few, and holding on to a dead one is expensive, so they
+// are swept eagerly at the end of every cycle.
+static void sweep_large (void) {
+    heap_page **link = &heap.large;
+
+    while (*link != NULL) {
+        heap_page *page = *link;
+        if (page->mark_bits[0] & 1) {
+            page->mark_bits[0] = 0;
+            link               = &page->next;
+            continue;
+        }
+
+        *link = page->next;
+        heap.finalizer ((obj *) page->cells);
+        heap.cell_bytes -= page->cell_size;
+        release_page (page);
+    }
+}
+
+void init_heap (heap_finalizer finalizer) {
+    memset (&heap, 0, sizeof (heap));
+    heap.finalizer = finalizer;
+
+    // 8-byte steps up to 128, then four bins per doubling.
+    uint32 bin_index = 0;
+    for (uint32 sz = HEAP_CELL_ALIGN; sz <= 128; sz += HEAP_CELL_ALIGN) {
+        heap.bin_sizes[bin_index++] = sz;
+    }
+
+    for (uint32 step = 32; bin_index < HEAP_BIN_COUNT; step *= 2) {
+        uint32 base = heap.bin_sizes[bin_index - 1];
+        for (uint32 i = 1; i <= 4; i++) {
+            heap.bin_sizes[bin_index++] = base + step * i;
+        }
+    }
+
+    bin_index = 0;
+    for (uint32 i = 0; i <= HEAP_MAX_SMALL / HEAP_CELL_ALIGN; i++) {
+        while (heap.bin_sizes[bin_index] < i * HEAP_CELL_ALIGN) bin_index++;
+        heap.bin_of[i] = (uint8) bin_index;
+    }
+}
+
+size heap_cell_size (size sz) {
+    if (sz > HEAP_MAX_SMALL) {
+        return (sz + HEAP_CELL_ALIGN - 1) & ~(size) (HEAP_CELL_ALIGN - 1);
+    }
+
+    return heap.bin_sizes[heap.bin_of[(sz + HEAP_CELL_ALIGN - 1) /
+                                      HEAP_CELL_ALIGN]];
+}
+
+size heap_cell_bytes (void) {
+    return heap.cell_bytes;
+}
+
+void *heap_alloc (size sz) {
+    if (sz > HEAP_MAX_SMALL) return alloc_large (sz);
+
+    uint32    bin_index =
+        heap.bin_of[(sz + HEAP_CELL_ALIGN - 1) / HEAP_CELL_ALIGN];
+    heap_bin *bin = &heap.bins[bin_index];
+
+    while (1) {
+        heap_page *page = bin->cursor;
+        if (page == NULL) {
+            page        = new_page (bin_index);
+            bin->cursor = page;
+        }
+
+        // This is the lazy half of the sweep: a page left over from the last
+        // cycle is only reclaimed once its bin runs out of room.
+        if (page->sweep_epoch != heap.epoch) sweep_page (page);
+
+        void *cell = take_cell (page);
+        if (cell != NULL) return cell;
+
+        bin->cursor = page->next;
+    }
+}
+
+// Ends a mark phase. Small pages are left to be swept on demand.
+void heap_begin_sweep (void) {
+    heap.epoch++;
+    sweep_large ();
+
+    for (uint32 i = 0; i < HEAP_BIN_COUNT; i++) {
+        heap.bins[i].cursor = heap.bins[i].pages;
+    }
+}
+
+// Sweeps whatever the allocator has not reached since the last cycle. This
+// has to run before marking starts again. The pages it keeps are tallied for
+// heap_fragmentation.
+void heap_finish_sweep (void) {
+    heap.swept_pages = 0;
+    heap.swept_bytes = 0;
+
+    for (uint32 i = 0; i < HEAP_BIN_COUNT; i++) {
+        heap_bin  *bin  = &heap.bins[i];
+        heap_page *prev = NULL;
+        heap_page *page = bin->pages;
+
+        while (page != NULL) {
+            heap_page *next = page->next;
+            if (page->sweep_epoch != heap.epoch) sweep_page (page);
+
+            if (page->live == 0) {
+                if (prev != NULL) {
+                    prev->next = next;
+                } else {
+                    bin->pages = next;
+                }
+
+                if (bin->tail == page) bin->tail = prev;
+                release_page (page);
+            } else {
+                heap.swept_pages++;
+                heap.swept_bytes += (size) page->live * page->cell_size;
+                prev = page;
+            }
+
+            page = next;
+        }
+
+        bin->cursor = bin->pages;
+    }
+}
+
+double heap_fragmentation (void) {
+    if (heap.swept_pages == 0) return 0;
+
+    size committed = heap.swept_pages * HEAP_PAGE_SIZE;
+    return 1.0 - (double) heap.swept_bytes / (double) committed;
+}
+
+static int compare_live (const void *a, const void *b) {
+    const heap_page *pa = *(heap_page *const *) a;
+    const heap_page *pb = *(heap_page *const *) b;
+    return (pa->live < pb->live) - (pa->live > pb->live);
+}
+
+// Moves every cell of `from` into the pages of `order` that are kept.
+static void evacuate_page (heap_page *from, heap_page **order, size kept,
+                           size *target) {
+    uint32 words = bitmap_words (from);
+
+    for (uint32 w = 0; w < words; w++) {
+        uint64 bits = from->alloc_bits[w];
+        while (bits) {
+            uint32 idx  = w * 64 + (uint32) __builtin_ctzll (bits);
+            obj   *src  = cell_at (from, idx);
+            void  *dest = NULL;
+
+            while (*target < kept &&
+                   (dest = take_cell (order[*target])) == NULL) {
+                (*target)++;
+            }
+
+            memcpy (dest, src, from->cell_size);
+            *(void **) src = dest;
+            bits &= bits - 1;
+        }
+    }
+
+    from->evacuated = true;
+}
+
+size heap_evacuate (void) {
+    size evacuated = 0;
+
+    for (uint32 i = 0; i < HEAP_BIN_COUNT; i++) {
+        heap_bin *bin   = &heap.bins[i];
+        size      count = 0;
+        size      live  = 0;
+
+        for (heap_page *page = bin->pages; page != NULL; page = page->next) {
+            count++;
+            live += page->live;
+        }
+
+        if (count < 2) continue;
+
+        uint32 per_page = bin->pages->cell_count;
+        size   needed   = (live + per_page - 1) / per_page;
+        if (needed >= count) continue;
+
+        heap_page **order = malloc (sizeof (heap_page *) * count);
+        if (order == NULL) exit (1);
+
+        size n = 0;
+        for (heap_page *page = bin->pages; page != NULL; page = page->next) {
+            page->scan_word = 0;
+            order[n++]      = page;
+        }
+
+        // Densest pages first: those are kept, the tail gets evacuated.
+        qsort (order, count, sizeof (heap_page *), compare_live);
+
+        size target = 0;
+        for (size p = needed; p < count; p++) {
+            evacuate_page (order[p], order, needed, &target);
+            evacuated++;
+        }
+
+        free (order);
+    }
+
+    return evacuated;
+}
+
+void heap_release_evacuated (void) {
+    for (uint32 i = 0; i < HEAP_BIN_COUNT; i++) {
+        heap_bin  *bin  = &heap.bins[i];
+        heap_page *prev = NULL;
+        heap_page *page = bin->pages;
+
+        while (page != NULL) {
+            heap_page *next = page->next;
+            if (!page->evacuated) {
+                prev = page;
+                page = next;
+                continue;
+            }
+
+            if (prev != NULL) {
+                prev->next = next;
+            } else {
+                bin->pages = next;
+            }
+
+            if (bin->tail == page) bin->tail = prev;
+
+            // The cells were moved, not freed, so there is nothing to
+            // finalize here.
+            heap.cell_bytes -= (size) page->live * page->cell_size;
+            release_page (page);
+            page = next;
+        }
+
+        bin->cursor = bin->pages;
+    }
+}
+
+void heap_for_each_object (heap_visitor visitor) {
+    for (uint32 i = 0; i < HEAP_BIN_COUNT; i++) {
+        for (heap_page *page = heap.bins[i].pages; page != NULL;
+             page            = page->next) {
+            if (page->evacuated) continue;
+
+            for (uint32 w = 0; w < bitmap_words (page); w++) {
+                uint64 bits = page->alloc_bits[w];
+                while (bits) {
+                    uint32 idx = w * 64 + (uint32) __builtin_ctzll (bits);
+                    visitor (cell_at (page, idx));
+                    bits &= bits - 1;
+                }
+            }
+        }
+    }
+
+    for (heap_page *page = heap.large; page != NULL; page = page->next) {
+        visitor ((obj *) page->cells);
+    }
+}
+
+void free_heap (void) {
+    for (uint32 i = 0; i < HEAP_BIN_COUNT; i++) {
+        heap_page *page = heap.bins[i].pages;
+        while (page != NULL) {
+            heap_page *next = page->next;
+            memset (page->mark_bits, 0, sizeof (page->mark_bits));
+            sweep_page (page);
+
+            munmap (page->base, page->region_size);
+            free (page);
+            page = next;
+        }
+
+        heap.bins[i].pages  = NULL;
+        heap.bins[i].tail   = NULL;
+        heap.bins[i].cursor = NULL;
+    }
+
+    for (heap_page *page = heap.large; page != NULL; page = page->next) {
+        page->mark_bits[0] = 0;
+    }
+
+    sweep_large ();
+
+    while (heap.pool != NULL) {
+        heap_page *next = heap.pool->next;
+        munmap (heap.pool->base, heap.pool->region_size);
+        free (heap.pool);
+        heap.pool = next;
+    }
+
+    heap.pool_count = 0;
+}
@@ -0,0 +1,102 @@
+// apachejuice, 18.10.2026
+// See LICENSE for details.
+#ifndef __ALOXOTL_HEAP__
+#define __ALOXOTL_HEAP__
+
+#include "common.h"
+#include "value.h"
+
+// Objects live in fixed-size, size-aligned pages. Every page serves a single
+// size class (bin), so the page (and its descriptor) can be found from any object
+// pointer by masking. Mark and allocation bits are kept in the descriptor, off
+// the page, so marking never writes to object memory.
+#define HEAP_PAGE_SIZE (64 * 1024)
+#define HEAP_CELL_ALIGN 8
+#define HEAP_MAX_CELLS (HEAP_PAGE_SIZE / HEAP_CELL_ALIGN)
+#define HEAP_BITMAP_WORDS (HEAP_MAX_CELLS / 64)
+
+// Objects bigger than this get a page of their own.
+#define HEAP_MAX_SMALL 2048
+
+typedef struct _heap_page heap_page;
+
+struct _heap_page {
+    heap_page *next;
+    uint8     *base;
+    uint8     *cells;
+    size       region_size;
+    uint32     cell_size;
+    uint32     cell_count;
+    uint32     cell_div;  // 2^32 / cell_size, rounded up
+    uint32     bin;
+    uint32     live;
+    uint32     scan_word;
+    uint32     sweep_epoch;
+    bool       evacuated;
+    uint64     alloc_bits[HEAP_BITMAP_WORDS];
+    uint64     mark_bits[HEAP_BITMAP_WORDS];
+};
+
+// Called for every object the sweeper reclaims, before its cell is reused.
+typedef void (*heap_finalizer) (obj *object);
+typedef void (*heap_visitor) (obj *object);
+
+void  init_heap (heap_finalizer finalizer);
+void  free_heap (void);
+void *heap_alloc (size sz);
+size  heap_cell_size (size sz);
+size  heap_cell_bytes (void);
+void  heap_begin_sweep (void);
+void  heap_finish_sweep (void);
+
+// Compaction. Only valid right after a full sweep, when every allocated cell
+// is live: sparse pages are evacuated into the densest pages of their bin,
+// leaving a forwarding pointer in each old cell until the pages are released.
+// heap_fragmentation is the share of the small-object pages kept by the last
+// heap_finish_sweep that their cells do not fill.
+double heap_fragmentation (void);
+size   heap_evacuate (void);
+void   heap_release_evacuated (void);
+void   heap_for_each_object (heap_visitor visitor);
+
+static inline heap_page *heap_page_of (const void *ptr) {
+    uintptr_t base = (uintptr_t) ptr & ~(uintptr_t) (HEAP_PAGE_SIZE - 1);
+    return *(heap_page **) base;
+}
+
+static inline uint32 heap_cell_index (heap_page *page, const void *ptr) {
+    uint64 offset = (uint64) ((const uint8 *) ptr - page->cells);
+    return (uint32) ((offset * page->cell_div) >> 32);
+}
+
+// Sets the mark bit of `ptr` and returns whether it was already set.
+static inline bool heap_mark (const void *ptr) {
+    heap_page *page = heap_page_of (ptr);
+    uint32     idx  = heap_cell_index (page, ptr);
+    uint64     bit  = (uint64) 1 << (idx & 63);
+    uint64    *word = &page->mark_bits[idx >> 6];
+
+    if (*word & bit) return true;
+    *word |= bit;
+    return false;
+}
+
+static inline bool heap_is_marked (const void *ptr) {
+    heap_page *page = heap_page_of (ptr);
+    uint32     idx  = heap_cell_index (page, ptr);
+    return (page->mark_bits[idx >> 6] >> (idx & 63)) & 1;
+}
+
+static inline size heap_object_size (const void *ptr) {
+    return heap_page_of (ptr)->cell_size;
+}
+
+static inline obj *heap_forward (obj *object) {
+    if (object != NULL && heap_page_of (object)->evacuated) {
+        return *(obj **) object;
+    }
+
+    return object;
+}
+
+#endif
@@ -0,0 +1,909 @@
+// apachejuice, 18.10.2026
+// See LICENSE for details.
+#define _DEFAULT_SOURCE
+
+#include "image.h"
+#include "bcache.h"
+#include "hash.h"
+#include "map.h"
+#include "memory.h"
+#include "rope.h"
+#include "vm.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern VM vm;
+
+#define IMAGE_MAGIC 0x49584c41u  // "ALXI" on little endian machines
+#define IMAGE_ALIGN 8
+#define IMAGE_PROBE "aloxotl image"
+
+// An image is the header, one record per object, the words describing the
+// objects and the globals, and a blob with string bytes, code, line tables
+// and f64 array elements. Each object is a run of words starting at its
+// record's `word`:
+//
+//   string        len, hash, blob offset of the bytes and a NUL
+//   func          arity, upvalue count, name, module, code length, code
+//                 offset, line run count, lines offset, constant count,
+//                 constants
+//   module        executed, path, body, global count, (name, value) pairs
+//   native        name of its builtin
+//   closure       func, upvalue count, upvalues
+//   upvalue       closed value
+//   class         name, init, method count, (name, closure) pairs
+//   instance      class, field count, (name, value) pairs
+//   bound method  receiver, method
+//   list          count, items
+//   map           count, (key, value) pairs
+//   f64 array     count, blob offset of the elements
+//
+// The globals are a count and (name, value) pairs at `globals_word`, and the
+// loaded modules are a count and (path, module) pairs at `modules_word`.
+// References are object indices plus one, 0 standing for NULL. Values are a
+// value_type word followed by the payload: the bool, the int, the bits of
+// the double or the reference.
+typedef struct {
+    uint32 magic;
+    uint32 version;
+    uint32 bcache_version;
+    uint32 hash_probe;
+    uint32 word_size;
+    uint32 pad;
+    uint64 file_size;
+    uint64 checksum;  // of everything after the header
+    uint64 object_count;
+    uint64 records_offset;
+    uint64 words_offset;
+    uint64 word_count;
+    uint64 blob_offset;
+    uint64 blob_size;
+    uint64 globals_word;
+    uint64 modules_word;
+} image_header;
+
+typedef struct {
+    uint32 type;
+    uint32 pad;
+    uint64 word;
+} image_record;
+
+static void *mapped_base;
+static size  mapped_len;
+
+static void *grow (void *data, size *capacity, size needed, size elem) {
+    if (needed <= *capacity) return data;
+
+    size new_capacity = *capacity < 64 ? 64 : *capacity;
+    while (new_capacity < needed) new_capacity *= 2;
+
+    data = realloc (data, new_capacity * elem);
+    if (data == NULL) exit (1);
+
+    *capacity = new_capacity;
+    return data;
+}
+
+static uint32 image_probe (void) {
+    return STRING_HASH (IMAGE_PROBE, sizeof (IMAGE_PROBE) - 1);
+}
+
+// Saving.
+
+typedef struct {
+    obj   *key;
+    uint64 index;
+} index_entry;
+
+typedef struct {
+    obj        **objects;
+    size         count;
+    size         capacity;
+    index_entry *slots;
+    size         slot_capacity;
+    uint64      *words;
+    size         word_count;
+    size         word_capacity;
+    uint8       *blob;
+    size         blob_count;
+    size         blob_capacity;
+    value       *natives;  // (native, name) pairs from the builtins
+    size         native_count;
+    bool         ok;
+} saver;
+
+static index_entry *find_slot (saver *s, obj *key) {
+    size idx = ((uintptr_t) key >> 3) & (s->slot_capacity - 1);
+    while (s->slots[idx].key != NULL && s->slots[idx].key != key) {
+        idx = (idx + 1) & (s->slot_capacity - 1);
+    }
+
+    return &s->slots[idx];
+}
+
+static void emit (saver *s, uint64 word) {
+    s->words = grow (s->words, &s->word_capacity, s->word_count + 1,
+                     sizeof (uint64));
+    s->words[s->word_count++] = word;
+}
+
+static uint64 emit_blob (saver *s, const void *data, size len) {
+    size start = (s->blob_count + IMAGE_ALIGN - 1) & ~(size) (IMAGE_ALIGN - 1);
+    s->blob = grow (s->blob, &s->blob_capacity, start + len, 1);
+
+    memset (s->blob + s->blob_count, 0, start - s->blob_count);
+    if (len) memcpy (s->blob + start, data, len);
+    s->blob_count = start + len;
+
+    return start;
+}
+
+// Returns the reference to `object`, numbering it if it is new. Ropes are
+// flattened and stand for their string.
+static uint64 ref (saver *s, obj *object) {
+    if (object == NULL) return 0;
+    if (OBJ_TYPEOF (object) == OBJ_ROPE) {
+        object = (obj *) rope_flatten ((obj_rope *) object);
+    }
+
+    if ((s->count + 1) * 2 > s->slot_capacity) {
+        index_entry *old          = s->slots;
+        size         old_capacity = s->slot_capacity;
+
+        s->slot_capacity = old_capacity ? old_capacity * 2 : 256;
+        s->slots         = calloc (s->slot_capacity, sizeof (index_entry));
+        if (s->slots == NULL) exit (1);
+
+        for (size i = 0; i < old_capacity; i++) {
+            if (old[i].key != NULL) *find_slot (s, old[i].key) = old[i];
+        }
+
+        free (old);
+    }
+
+    index_entry *slot = find_slot (s, object);
+    if (slot->key == NULL) {
+        s->objects = grow (s->objects, &s->capacity, s->count + 1,
+                           sizeof (obj *));
+        s->objects[s->count] = object;
+        slot->key            = object;
+        slot->index          = s->count++;
+    }
+
+    return slot->index + 1;
+}
+
+static void emit_ref (saver *s, obj *object) {
+    emit (s, ref (s, object));
+}
+
+static void emit_value (saver *s, value val) {
+    uint64 payload = 0;
+
+    switch (val.type) {
+        case VALUE_BOOL: payload = AS_BOOL (val); break;
+        case VALUE_INT: payload = (uint64) AS_INT (val); break;
+        case VALUE_NUMBER: {
+            double num = AS_NUMBER (val);
+            memcpy (&payload, &num, sizeof (num));
+            break;
+        }
+        case VALUE_OBJ: payload = ref (s, AS_OBJ (val)); break;
+        default: break;
+    }
+
+    emit (s, val.type);
+    emit (s, payload);
+}
+
+static void emit_table (saver *s, table *tab) {
+    obj_string *key;
+    value       val;
+    size        slot = 0;
+
+    emit (s, tab->count);
+    while (table_next (tab, &slot, &key, &val)) {
+        emit_ref (s, (obj *) key);
+        emit_value (s, val);
+    }
+}
+
+// Natives are saved by the name of the builtin holding them.
+static obj *native_name (saver *s, obj *native) {
+    for (size i = 0; i < s->native_count; i++) {
+        if (AS_OBJ (s->natives[2 * i]) == native) {
+            return AS_OBJ (s->natives[2 * i + 1]);
+        }
+    }
+
+    return NULL;
+}
+
+static void emit_object (saver *s, obj *object) {
+    switch (OBJ_TYPEOF (object)) {
+        case OBJ_BOUND_METHOD: {
+            obj_bound_method *bound = (obj_bound_method *) object;
+            emit_value (s, bound->reciever);
+            emit_ref (s, (obj *) bound->method);
+            break;
+        }
+
+        case OBJ_CLASS: {
+            obj_class *klass = (obj_class *) object;
+            emit_ref (s, (obj *) klass->name);
+            emit_ref (s, (obj *) klass->init);
+            emit_table (s, &klass->methods);
+            break;
+        }
+
+        case OBJ_CLOSURE: {
+            obj_closure *closure = (obj_closure *) object;
+            emit_ref (s, (obj *) closure->func);
+            emit (s, (uint64) closure->upvalue_count);
+            for (int32 i = 0; i < closure->upvalue_count; i++) {
+                emit_ref (s, (obj *) closure->upvalues[i]);
+            }
+
+            break;
+        }
+
+        case OBJ_F64_ARRAY: {
+            obj_f64_array *array = (obj_f64_array *) object;
+            emit (s, array->count);
+            emit (s, emit_blob (s, array->data,
+                                array->count * sizeof (double)));
+            break;
+        }
+
+        case OBJ_FUNC: {
+            obj_func *func = (obj_func *) object;
+            emit (s, (uint64) func->arity);
+            emit (s, (uint64) func->upvalue_count);
+            emit_ref (s, (obj *) func->name);
+            emit_ref (s, (obj *) func->module);
+            emit (s, func->chk.count);
+            emit (s, emit_blob (s, func->chk.code, func->chk.count));
+            emit (s, func->chk.line_count);
+            emit (s, emit_blob (s, func->chk.lines,
+                                func->chk.line_count * sizeof (line_run)));
+            emit (s, func->chk.consts.count);
+            for (size i = 0; i < func->chk.consts.count; i++) {
+                emit_value (s, func->chk.consts.values[i]);
+            }
+
+            break;
+        }
+
+        case OBJ_INSTANCE: {
+            obj_instance *instance = (obj_instance *) object;
+            emit_ref (s, (obj *) instance->klass);
+            emit_table (s, &instance->fields);
+            break;
+        }
+
+        case OBJ_LIST: {
+            value_array *items = &((obj_list *) object)->items;
+            emit (s, items->count);
+            for (size i = 0; i < items->count; i++) {
+                emit_value (s, items->values[i]);
+            }
+
+            break;
+        }
+
+        case OBJ_MAP: {
+            obj_map *map = (obj_map *) object;
+            emit (s, map->count);
+            for (size i = 0; i < map->capacity; i++) {
+                if (map->hashes[i] == 0) continue;
+
+                emit_value (s, map->entries[i].key);
+                emit_value (s, map->entries[i].val);
+            }
+
+            break;
+        }
+
+        case OBJ_MODULE: {
+            obj_module *module = (obj_module *) object;
+            emit (s, module->executed);
+            emit_ref (s, (obj *) module->path);
+            emit_ref (s, (obj *) module->body);
+            emit_table (s, &module->globals);
+            break;
+        }
+
+        case OBJ_NATIVE: {
+            obj *name = native_name (s, object);
+            if (name == NULL) {
+                fprintf (stderr, "Cannot save a native that is no builtin\n");
+                s->ok = false;
+            }
+
+            emit_ref (s, name);
+            break;
+        }
+
+        case OBJ_STRING: {
+            obj_string *str = (obj_string *) object;
+            emit (s, str->len);
+            emit (s, IS_INTERNED (str) ? str->hash
+                                       : STRING_HASH (str->data, str->len));
+            emit (s, emit_blob (s, str->data, str->len + 1));
+            break;
+        }
+
+        case OBJ_UPVALUE: {
+            obj_upvalue *upvalue = (obj_upvalue *) object;
+            if (upvalue->location != &upvalue->closed) {
+                fprintf (stderr, "Cannot save an open upvalue\n");
+                s->ok = false;
+            }
+
+            emit_value (s, upvalue->closed);
+            break;
+        }
+
+        case OBJ_ROPE: break;
+    }
+}
+
+static void collect_natives (saver *s) {
+    obj_string *key;
+    value       val;
+    size        slot     = 0;
+    size        capacity = 0;
+
+    while (table_next (&vm.builtins, &slot, &key, &val)) {
+        if (!IS_NATIVE (val)) continue;
+
+        s->natives = grow (s->natives, &capacity, 2 * s->native_count + 2,
+                           sizeof (value));
+        s->natives[2 * s->native_count]     = val;
+        s->natives[2 * s->native_count + 1] = OBJ_VAL ((obj *) key);
+        s->native_count++;
+    }
+}
+
+static bool write_file (const char *path, saver *s, image_record *records,
+                        uint64 modules_word) {
+    image_header header;
+    memset (&header, 0, sizeof (header));
+
+    header.magic          = IMAGE_MAGIC;
+    header.version        = IMAGE_VERSION;
+    header.bcache_version = BCACHE_VERSION;
+    header.hash_probe     = image_probe ();
+    header.word_size      = sizeof (size);
+    header.object_count   = s->count;
+    header.records_offset = sizeof (header);
+    header.words_offset   = sizeof (header) + s->count * sizeof (*records);
+    header.word_count     = s->word_count;
+    header.blob_offset    = header.words_offset + s->word_count * 8;
+    header.blob_size      = s->blob_count;
+    header.globals_word   = 0;
+    header.modules_word   = modules_word;
+    header.file_size      = header.blob_offset + s->blob_count;
+
+    // The checksum covers the sections as they lie in the file, so they are
+    // put together first.
+    size   records_len = s->count * sizeof (*records);
+    size   words_len   = s->word_count * 8;
+    size   len         = records_len + words_len + s->blob_count;
+    uint8 *payload     = malloc (len ? len : 1);
+    if (payload == NULL) return false;
+
+    if (records_len) memcpy (payload, records, records_len);
+    if (words_len) memcpy (payload + records_len, s->words, words_len);
+    if (s->blob_count) {
+        memcpy (payload + records_len + words_len, s->blob, s->blob_count);
+    }
+
+    header.checksum = hash_checksum (payload, len);
+
+    FILE *file = fopen (path, "wb");
+    bool  ok   = file != NULL;
+    if (ok) {
+        ok = fwrite (&header, sizeof (header), 1, file) == 1 &&
+             fwrite (payload, 1, len, file) == len;
+        ok = fclose (file) == 0 && ok;
+        if (!ok) remove (path);
+    }
+
+    free (payload);
+    return ok;
+}
+
+// Saves the globals, the loaded modules, everything reachable from them and
+// the interned strings. Only valid while no script is running.
+bool image_save (const char *path) {
+    saver s;
+    memset (&s, 0, sizeof (s));
+    s.ok = true;
+
+    // Drops interned strings that nothing refers to any more.
+    collect_garbage ();
+    collect_natives (&s);
+
+    // Flattening ropes may allocate, so every object is numbered while the
+    // graph is walked and the intern set is only read once nothing else can
+    // be reached.
+    image_record *records  = NULL;
+    size          capacity = 0;
+    size          next     = 0;
+
+    emit_table (&s, &vm.globals);
+    uint64 modules_word = s.word_count;
+    emit_table (&s, &vm.modules);
+    for (int pass = 0; pass < 2; pass++) {
+        for (; next < s.count; next++) {
+            records = grow (records, &capacity, next + 1, sizeof (*records));
+            records[next].type = OBJ_TYPEOF (s.objects[next]);
+            records[next].pad  = 0;
+            records[next].word = s.word_count;
+            emit_object (&s, s.objects[next]);
+        }
+
+        for (size i = 0; pass == 0 && i < vm.strings.capacity; i++) {
+            if (vm.strings.strings[i] != NULL) {
+                ref (&s, (obj *) vm.strings.strings[i]);
+            }
+        }
+    }
+
+    bool ok = s.ok && write_file (path, &s, records, modules_word);
+
+    free (records);
+    free (s.objects);
+    free (s.slots);
+    free (s.words);
+    free (s.blob);
+    free (s.natives);
+    return ok;
+}
+
+// Loading.
+
+typedef struct {
+    const image_header *header;
+    const uint8        *base;
+    const uint64       *words;
+    uint64              pos;
+    obj               **objects;
+    bool                ok;
+} loader;
+
+static uint64 next_word (loader *l) {
+    if (l->pos >= l->header->word_count) {
+        l->ok = false;
+        return 0;
+    }
+
+    return l->words[l->pos++];
+}
+
+// Reads the blob offset of `count` elements of `width` bytes and returns
+// their offset in the file, after checking that they lie inside the blob.
+static uint64 next_blob (loader *l, uint64 count, uint64 width) {
+    uint64 offset = next_word (l);
+    uint64 blob   = l->header->blob_size;
+    if (offset % (width < IMAGE_ALIGN ? 1 : IMAGE_ALIGN) != 0 ||
+        offset > blob || count > (blob - offset) / width) {
+        l->ok = false;
+        return 0;
+    }
+
+    return l->header->blob_offset + offset;
+}
+
+// Resolves a reference to an object of `type` that has already been
+// created, or to any type for _OBJTYPE_COUNT. NULL is only accepted if
+// `nullable`.
+static obj *resolve (loader *l, uint64 ref, int type, bool nullable) {
+    if (ref == 0 || ref > l->header->object_count) {
+        if (ref != 0 || !nullable) l->ok = false;
+        return NULL;
+    }
+
+    obj *object = l->objects[ref - 1];
+    if (object == NULL ||
+        (type != _OBJTYPE_COUNT && OBJ_TYPEOF (object) != (obj_type) type)) {
+        l->ok = false;
+        return NULL;
+    }
+
+    return object;
+}
+
+static obj *next_ref (loader *l, int type, bool nullable) {
+    return resolve (l, next_word (l), type, nullable);
+}
+
+static value next_value (loader *l) {
+    uint64 type    = next_word (l);
+    uint64 payload = next_word (l);
+
+    switch (type) {
+        case VALUE_BOOL: return BOOL_VAL (payload != 0);
+        case VALUE_INT: return INT_VAL ((int64) payload);
+        case VALUE_NIL: return NIL_VAL ();
+        case VALUE_NUMBER: {
+            double num;
+            memcpy (&num, &payload, sizeof (num));
+            return NUMBER_VAL (num);
+        }
+        case VALUE_OBJ: {
+            obj *object = resolve (l, payload, _OBJTYPE_COUNT, false);
+            return l->ok ? OBJ_VAL (object) : NIL_VAL ();
+        }
+        default: l->ok = false; return NIL_VAL ();
+    }
+}
+
+static const image_record *record_at (loader *l, uint64 idx) {
+    const image_record *records =
+        (const image_record *) (l->base + l->header->records_offset);
+    l->pos = records[idx].word;
+    return &records[idx];
+}
+
+// Creates object `idx` with no references set yet, in a state the collector
+// can deal with. Strings and functions come first, since natives are found
+// by name and closures are sized by their function.
+static obj *create (loader *l, uint64 idx, int pass) {
+    obj_type type = (obj_type) record_at (l, idx)->type;
+    if ((pass == 0) != (type == OBJ_STRING || type == OBJ_FUNC)) return NULL;
+
+    switch (type) {
+        case OBJ_BOUND_METHOD:
+            return (obj *) new_bound_method (NIL_VAL (), NULL);
+        case OBJ_CLASS: return (obj *) new_klass (NULL);
+        case OBJ_INSTANCE: return (obj *) new_instance (NULL);
+        case OBJ_LIST: return (obj *) new_list ();
+        case OBJ_MAP: return (obj *) new_map ();
+
+        case OBJ_MODULE: {
+            obj_module *module = new_module (NULL);
+            module->executed   = next_word (l) != 0;
+            return (obj *) module;
+        }
+
+        case OBJ_CLOSURE: {
+            obj *func = next_ref (l, OBJ_FUNC, false);
+            return l->ok ? (obj *) new_closure ((obj_func *) func) : NULL;
+        }
+
+        case OBJ_F64_ARRAY: {
+            uint64 count = next_word (l);
+            uint64 data  = next_blob (l, count, sizeof (double));
+            if (!l->ok) return NULL;
+
+            obj_f64_array *array = new_f64_array (count);
+            if (count) memcpy (array->data, l->base + data, count * 8);
+            return (obj *) array;
+        }
+
+        case OBJ_FUNC: {
+            obj_func *func      = new_func ();
+            func->arity         = (int32) next_word (l);
+            func->upvalue_count = (int32) next_word (l);
+            l->pos += 2;  // name and module, set by fix_up
+
+            uint64 len        = next_word (l);
+            uint64 code       = next_blob (l, len, 1);
+            uint64 line_count = next_word (l);
+            uint64 lines      = next_blob (l, line_count, sizeof (line_run));
+            if (func->upvalue_count < 0 || func->upvalue_count > UINT8_COUNT ||
+                line_count > len || !l->ok) {
+                l->ok               = false;
+                func->upvalue_count = 0;
+                return (obj *) func;
+            }
+
+            func->chk.code          = (uint8 *) l->base + code;
+            func->chk.lines         = (line_run *) (l->base + lines);
+            func->chk.count         = len;
+            func->chk.capacity      = len;
+            func->chk.line_count    = line_count;
+            func->chk.line_capacity = line_count;
+            func->chk.mapped        = true;
+            return (obj *) func;
+        }
+
+        case OBJ_NATIVE: {
+            obj  *name = next_ref (l, OBJ_STRING, false);
+            value native;
+            if (!l->ok || !get_table (&vm.builtins, (obj_string *) name,
+                                      &native) ||
+                !IS_NATIVE (native)) {
+                l->ok = false;
+                return NULL;
+            }
+
+            return AS_OBJ (native);
+        }
+
+        case OBJ_STRING: {
+            uint64 len  = next_word (l);
+            uint32 hash = (uint32) next_word (l);
+            if (len >= l->header->blob_size) l->ok = false;
+
+            uint64 data = next_blob (l, len + 1, 1);
+            if (!l->ok) return NULL;
+
+            return (obj *) copy_string_hashed ((const char *) l->base + data,
+                                               len, hash);
+        }
+
+        case OBJ_UPVALUE: {
+            obj_upvalue *upvalue = new_upvalue (NULL);
+            upvalue->location    = &upvalue->closed;
+            upvalue->next        = NULL;
+            return (obj *) upvalue;
+        }
+
+        default: l->ok = false; return NULL;
+    }
+}
+
+static void fix_up_table (loader *l, table *tab) {
+    uint64 count = next_word (l);
+    for (uint64 i = 0; i < count && l->ok; i++) {
+        obj  *key = next_ref (l, OBJ_STRING, false);
+        value val = next_value (l);
+        if (l->ok) set_table (tab, (obj_string *) key, val);
+    }
+}
+
+// Sets the references of object `idx`. Everything it can refer to exists by
+// now and is rooted, so the allocations made here are safe.
+static void fix_up (loader *l, uint64 idx) {
+    obj *object = l->objects[idx];
+    record_at (l, idx);
+
+    switch (OBJ_TYPEOF (object)) {
+        case OBJ_BOUND_METHOD: {
+            obj_bound_method *bound = (obj_bound_method *) object;
+            bound->reciever         = next_value (l);
+            bound->method = (obj_closure *) next_ref (l, OBJ_CLOSURE, false);
+            break;
+        }
+
+        case OBJ_CLASS: {
+            obj_class *klass = (obj_class *) object;
+            klass->name      = (obj_string *) next_ref (l, OBJ_STRING, false);
+            klass->init      = (obj_closure *) next_ref (l, OBJ_CLOSURE, true);
+            fix_up_table (l, &klass->methods);
+            break;
+        }
+
+        case OBJ_CLOSURE: {
+            obj_closure *closure = (obj_closure *) object;
+            l->pos++;
+            if (next_word (l) != (uint64) closure->upvalue_count) {
+                l->ok = false;
+            }
+
+            for (int32 i = 0; i < closure->upvalue_count && l->ok; i++) {
+                closure->upvalues[i] =
+                    (obj_upvalue *) next_ref (l, OBJ_UPVALUE, false);
+            }
+
+            break;
+        }
+
+        case OBJ_FUNC: {
+            obj_func *func = (obj_func *) object;
+            l->pos += 2;
+            func->name   = (obj_string *) next_ref (l, OBJ_STRING, true);
+            func->module = (obj_module *) next_ref (l, OBJ_MODULE, true);
+            l->pos += 4;
+
+            uint64 count = next_word (l);
+            for (uint64 i = 0; i < count && l->ok; i++) {
+                value val = next_value (l);
+                if (l->ok) write_value_array (&func->chk.consts, val);
+            }
+
+            break;
+        }
+
+        case OBJ_INSTANCE: {
+            obj_instance *instance = (obj_instance *) object;
+            instance->klass = (obj_class *) next_ref (l, OBJ_CLASS, false);
+            fix_up_table (l, &instance->fields);
+            break;
+        }
+
+        case OBJ_MODULE: {
+            obj_module *module = (obj_module *) object;
+            l->pos++;
+            module->path = (obj_string *) next_ref (l, OBJ_STRING, false);
+            module->body = (obj_func *) next_ref (l, OBJ_FUNC, true);
+            fix_up_table (l, &module->globals);
+            break;
+        }
+
+        case OBJ_LIST: {
+            obj_list *list  = (obj_list *) object;
+            uint64    count = next_word (l);
+            for (uint64 i = 0; i < count && l->ok; i++) {
+                value val = next_value (l);
+                if (l->ok) write_value_array (&list->items, val);
+            }
+
+            break;
+        }
+
+        case OBJ_MAP: {
+            obj_map *map   = (obj_map *) object;
+            uint64   count = next_word (l);
+            for (uint64 i = 0; i < count && l->ok; i++) {
+                value key = next_value (l);
+                value val = next_value (l);
+                if (l->ok && !map_prepare_key (&key)) l->ok = false;
+                if (l->ok) map_set (map, key, val);
+            }
+
+            break;
+        }
+
+        case OBJ_UPVALUE: {
+            obj_upvalue *upvalue = (obj_upvalue *) object;
+            upvalue->closed      = next_value (l);
+            break;
+        }
+
+        case OBJ_F64_ARRAY:
+        case OBJ_NATIVE:
+        case OBJ_ROPE:
+        case OBJ_STRING: break;
+    }
+}
+
+static bool check_header (const image_header *header, uint64 file_size) {
+    return header->magic == IMAGE_MAGIC && header->version == IMAGE_VERSION &&
+           header->bcache_version == BCACHE_VERSION &&
+           header->hash_probe == image_probe () &&
+           header->word_size == sizeof (size) &&
+           header->file_size == file_size &&
+           header->records_offset == sizeof (image_header) &&
+           header->object_count <= file_size / sizeof (image_record) &&
+           header->words_offset ==
+               header->records_offset +
+                   header->object_count * sizeof (image_record) &&
+           header->word_count <= file_size / 8 &&
+           header->blob_offset ==
+               header->words_offset + header->word_count * 8 &&
+           header->blob_offset <= file_size &&
+           header->blob_size == file_size - header->blob_offset;
+}
+
+// Reads the table at `word` into `tab`, or only checks it if `tab` is NULL.
+// Values must be of `type`, or of any type for _OBJTYPE_COUNT.
+static void load_table (loader *l, uint64 word, table *tab, int type) {
+    l->pos       = word;
+    uint64 count = next_word (l);
+
+    for (uint64 i = 0; i < count && l->ok; i++) {
+        obj  *key = next_ref (l, OBJ_STRING, false);
+        value val = next_value (l);
+        if (type != _OBJTYPE_COUNT &&
+            (!IS_OBJ (val) || OBJ_TYPEOF (AS_OBJ (val)) != (obj_type) type)) {
+            l->ok = false;
+        }
+
+        if (l->ok && tab != NULL) set_table (tab, (obj_string *) key, val);
+    }
+}
+
+// Loads the image at `path` into the VM, defining its globals and modules.
+// Must be called before any script runs.
+bool image_load (const char *path) {
+    int fd = open (path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat (fd, &st) != 0 || (uint64) st.st_size < sizeof (image_header)) {
+        close (fd);
+        return false;
+    }
+
+    size  file_size = (size) st.st_size;
+    void *base      = mmap (NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (base == MAP_FAILED) return false;
+
+    loader l;
+    l.header  = (const image_header *) base;
+    l.base    = base;
+    l.pos     = 0;
+    l.ok      = check_header (l.header, file_size);
+    l.objects = NULL;
+
+    // Code is used in place without being verified, so a corrupted image is
+    // only caught by its checksum.
+    size payload_len = file_size - sizeof (image_header);
+    if (l.ok &&
+        l.header->checksum != hash_checksum (l.header + 1, payload_len)) {
+        l.ok = false;
+    }
+
+    if (l.ok) {
+        l.words   = (const uint64 *) (l.base + l.header->words_offset);
+        l.objects = calloc (l.header->object_count + 1, sizeof (obj *));
+        if (l.objects == NULL) l.ok = false;
+    }
+
+    const image_record *records =
+        (const image_record *) (l.base + sizeof (image_header));
+    for (uint64 i = 0; l.ok && i < l.header->object_count; i++) {
+        if (records[i].word >= l.header->word_count) l.ok = false;
+    }
+
+    if (!l.ok) {
+        free (l.objects);
+        munmap (base, file_size);
+        return false;
+    }
+
+    obj_list *roots = new_list ();
+    push (OBJ_VAL ((obj *) roots));
+
+    uint64 count = l.header->object_count;
+    for (int pass = 0; pass < 2 && l.ok; pass++) {
+        for (uint64 i = 0; i < count && l.ok; i++) {
+            obj *object = create (&l, i, pass);
+            if (object == NULL) continue;
+
+            l.objects[i] = object;
+            push (OBJ_VAL (object));
+            write_value_array (&roots->items, OBJ_VAL (object));
+            pop ();
+        }
+    }
+
+    for (uint64 i = 0; i < count && l.ok; i++) {
+        if (l.objects[i] == NULL) l.ok = false;
+    }
+
+    for (uint64 i = 0; i < count && l.ok; i++) fix_up (&l, i);
+
+    // The tables are read once to check them and once to define them, so a
+    // broken image leaves the globals and modules alone.
+    for (int pass = 0; pass < 2 && l.ok; pass++) {
+        load_table (&l, l.header->globals_word, pass ? &vm.globals : NULL,
+                    _OBJTYPE_COUNT);
+        load_table (&l, l.header->modules_word, pass ? &vm.modules : NULL,
+                    OBJ_MODULE);
+    }
+
+    pop ();
+    free (l.objects);
+    flush_method_cache ();
+
+    // Whatever was created from a broken image is unreachable now. Chunks
+    // never free or read mapped code once they are garbage.
+    if (!l.ok) {
+        munmap (base, file_size);
+        return false;
+    }
+
+    mapped_base = base;
+    mapped_len  = file_size;
+    return true;
+}
+
+void image_release (void) {
+    if (mapped_base == NULL) return;
+
+    munmap (mapped_base, mapped_len);
+    mapped_base = NULL;
+    mapped_len  = 0;
+}
@@ -0,0 +1,28 @@
+// apachejuice, 18.10.2026
+// See LICENSE for details.
+#ifndef __ALOXOTL_IMAGE__
+#define __ALOXOTL_IMAGE__
+
+#include "common.h"
+
+// Heap images. image_save writes every object reachable from the globals
+// and the intern set to a file, with each reference replaced by the index
+// of its target. image_load maps such a file into a fresh VM, allocates the
+// objects and fixes the references up, so a prelude that only defines
+// classes and tables does not have to run again on every start. Function
+// code and line tables are used in place from the mapping, which stays
+// alive until image_release. Code is not verified, so images whose checksum
+// does not match are rejected.
+//
+// Modules loaded with `import` are saved with their globals, so importing
+// them again after loading the image neither compiles nor runs them. Natives
+// are saved by the name of their builtin and bound to the native of that
+// name on load. Ropes are saved as the strings they flatten to. Images
+// can only be taken between scripts, when no upvalue is open.
+#define IMAGE_VERSION 6
+
+bool image_save (const char *path);
+bool image_load (const char *path);
+void image_release (void);
+
+#endif
@@ -0,0 +1,129 @@
+// apachejuice, 18.10.2026
+// See LICENSE for details.
+#include "intern.h"
+#include "heap.h"
+#include "memory.h"
+#include "obj.h"
+
+#include <string.h>
+
+#define INTERN_MAX_LOAD 0.75
+
+// Both arrays share one block: `capacity` pointers, then `capacity` hashes.
+#define INTERN_SLOT_SIZE (sizeof (obj_string *) + sizeof (uint32))
+
+void init_intern_set (intern_set *set) {
+    set->count    = 0;
+    set->capacity = 0;
+    set->strings  = NULL;
+    set->hashes   = NULL;
+}
+
+void free_intern_set (intern_set *set) {
+    FREE_ARRAY (uint8, set->strings, set->capacity * INTERN_SLOT_SIZE);
+    init_intern_set (set);
+}
+
+size intern_set_bytes (const intern_set *set) {
+    return set->capacity * INTERN_SLOT_SIZE;
+}
+
+obj_string *intern_set_find (intern_set *set, const char *data, size len,
+                             uint32 hash) {
+    if (set->count == 0) return NULL;
+
+    size mask = set->capacity - 1;
+    for (size index = hash & mask;; index = (index + 1) & mask) {
+        obj_string *str = set->strings[index];
+        if (str == NULL) return NULL;
+
+        if (set->hashes[index] == hash && str->len == len &&
+            memcmp (str->data, data, len) == 0) {
+            return str;
+        }
+    }
+}
+
+static void insert (intern_set *set, obj_string *str, uint32 hash) {
+    size mask  = set->capacity - 1;
+    size index = hash & mask;
+    while (set->strings[index] != NULL) index = (index + 1) & mask;
+
+    set->strings[index] = str;
+    set->hashes[index]  = hash;
+    set->count++;
+}
+
+static void adjust_capacity (intern_set *set, size capacity) {
+    uint8 *block = ALLOCATE (uint8, capacity * INTERN_SLOT_SIZE);
+
+    // The allocation may have collected, so only read the old slots now.
+    intern_set old = *set;
+    set->count     = 0;
+    set->capacity  = capacity;
+    set->strings   = (obj_string **) block;
+    set->hashes    = (uint32 *) (block + capacity * sizeof (obj_string *));
+    memset (set->strings, 0, capacity * sizeof (obj_string *));
+
+    for (size i = 0; i < old.capacity; i++) {
+        if (old.strings[i] != NULL) {
+            insert (set, old.strings[i], old.hashes[i]);
+        }
+    }
+
+    FREE_ARRAY (uint8, old.strings, old.capacity * INTERN_SLOT_SIZE);
+}
+
+// `str` must not be in the set yet.
+void intern_set_add (intern_set *set, obj_string *str) {
+    if (set->count + 1 > set->capacity * INTERN_MAX_LOAD) {
+        adjust_capacity (set, GROW_CAPACITY (set->capacity));
+    }
+
+    insert (set, str, str->hash);
+}
+
+// Empties slot `hole` and moves later members of its probe run back, so
+// lookups never need tombstones.
+static void remove_at (intern_set *set, size hole) {
+    size mask = set->capacity - 1;
+    size next = (hole + 1) & mask;
+
+    while (set->strings[next] != NULL) {
+        size home = set->hashes[next] & mask;
+
+        // An entry may fill the hole unless its home lies cyclically in
+        // (hole, next].
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            set->strings[hole] = set->strings[next];
+            set->hashes[hole]  = set->hashes[next];
+            hole               = next;
+        }
+
+        next = (next + 1) & mask;
+    }
+
+    set->strings[hole] = NULL;
+    set->count--;
+}
+
+void intern_set_remove_white (intern_set *set) {
+    for (size i = 0; i < set->capacity;) {
+        obj_string *str = set->strings[i];
+        if (str != NULL && !heap_is_marked (str)) {
+            // Something else may have been shifted into slot i.
+            remove_at (set, i);
+            continue;
+        }
+
+        i++;
+    }
+}
+
+// Compaction moves strings but not their hashes, so slots stay put.
+void relocate_intern_set (intern_set *set) {
+    for (size i = 0; i < set->capacity; i++) {
+        obj *str        = (obj *) set->strings[i];
+        set->strings[i] = (obj_string *) heap_forward (str);
+    }
+}
@@ -0,0 +1,30 @@
+// apachejuice, 18.10.2026
+// See LICENSE for details.
+#ifndef __ALOXOTL_INTERN__
+#define __ALOXOTL_INTERN__
+
+#include "common.h"
+#include "value.h"
+
+// The set of interned strings. Unlike a `table` it has no values: each slot
+// is a string pointer plus a copy of its hash, so probing only touches the
+// string when the hashes match. Linear probing over a power-of-two capacity,
+// with backward-shift deletion instead of tombstones. The set is weak, dead
+// strings are dropped by `intern_set_remove_white` during collection.
+typedef struct {
+    size         count;
+    size         capacity;
+    obj_string **strings;
+    uint32      *hashes;
+} intern_set;
+
+void        init_intern_set (intern_set *set);
+void        free_intern_set (intern_set *set);
+size        intern_set_bytes (const intern_set *set);
+obj_string *intern_set_find (intern_set *set, const char *data, size len,
+                             uint32 hash);
+void        intern_set_add (intern_set *set, obj_string *str);
+void        intern_set_remove_white (intern_set *set);
+void        relocate_intern_set (intern_set *set);
+
+#endif
@@ -0,0 +1,136 @@
+// apachejuice, 18.10.2026
+// See LICENSE for details.
+#include "list.h"
+#include "memory.h"
+#include "rope.h"
+#include "vm.h"
+
+#include <math.h>
+#include <string.h>
+
+extern VM vm;
+
+// Reads a non-negative integer argument no greater than `max`.
+static bool integer_arg (value val, size max, const char *what, size *out) {
+    if (!IS_NUMERIC (val)) {
+        native_error ("%s must be a number, not %s", what,
+                      VALUE_TYPESTR (val));
+        return false;
+    }
+
+    double num = AS_FLOAT (val);
+    if (num != floor (num) || num < 0 || num > (double) max) {
+        native_error ("%s %g is out of range [0, %zu]", what, num, max);
+        return false;
+    }
+
+    *out = (size) num;
+    return true;
+}
+
+static void reserve (value_array *array, size count) {
+    if (array->capacity >= count) return;
+
+    size old_capacity = array->capacity;
+    size capacity     = GROW_CAPACITY (old_capacity);
+    while (capacity < count) capacity *= 2;
+
+    array->capacity = capacity;
+    array->values =
+        GROW_ARRAY (value, array->values, old_capacity, array->capacity);
+}
+
+// append(list, value): adds `value` at the end and returns the list.
+static value native_append (uint8 argc, value *args) {
+    if (argc != 2 || !IS_LIST (args[0])) {
+        return native_error ("append expects a list and a value");
+    }
+
+    write_value_array (&AS_LIST (args[0])->items, args[1]);
+    return args[0];
+}
+
+// length(x): element count of a list, f64 array or map, or byte count of
+// a string.
+static value native_length (uint8 argc, value *args) {
+    if (argc == 1 && IS_LIST (args[0])) {
+        return INT_VAL ((int64) AS_LIST (args[0])->items.count);
+    } else if (argc == 1 && IS_F64_ARRAY (args[0])) {
+        return INT_VAL ((int64) AS_F64_ARRAY (args[0])->count);
+    } else if (argc == 1 && IS_MAP (args[0])) {
+        return INT_VAL ((int64) AS_MAP (args[0])->count);
+    } else if (argc == 1 && IS_STRING (args[0])) {
+        return INT_VAL ((int64) AS_STRING (args[0])->len);
+    }
+
+    return native_error (
+        "length expects a list, an f64 array, a map or a string");
+}
+
+// slice(list, start, end): a new list with the elements in [start, end).
+static value native_slice (uint8 argc, value *args) {
+    if (argc != 3 || !IS_LIST (args[0])) {
+        return native_error ("slice expects a list, a start and an end");
+    }
+
+    size count = AS_LIST (args[0])->items.count;
+    size start, end;
+    if (!integer_arg (args[1], count, "Slice start", &start) ||
+        !integer_arg (args[2], count, "Slice end", &end)) {
+        return NIL_VAL ();
+    }
+
+    if (end < start) end = start;
+
+    // Rooted in the argument slots: the source is still there as well.
+    obj_list *slice = new_list ();
+    args[1]         = OBJ_VAL ((obj *) slice);
+    if (end == start) return args[1];
+
+    reserve (&slice->items, end - start);
+    memcpy (slice->items.values, AS_LIST (args[0])->items.values + start,
+            (end - start) * sizeof (value));
+    slice->items.count = end - start;
+
+    return args[1];
+}
+
+// copy(dst, dst_start, src, src_start, count): copies `count` elements.
+// `dst` grows if the copy runs past its end, as long as it starts no later
+// than the end. Overlapping ranges of the same list are handled.
+static value native_copy (uint8 argc, value *args) {
+    if (argc != 5 || !IS_LIST (args[0]) || !IS_LIST (args[2])) {
+        return native_error (
+            "copy expects dst, dst_start, src, src_start, count");
+    }
+
+    obj_list *dst = AS_LIST (args[0]);
+    obj_list *src = AS_LIST (args[2]);
+    size      dst_start, src_start, count;
+    if (!integer_arg (args[1], dst->items.count, "Copy destination",
+                      &dst_start) ||
+        !integer_arg (args[3], src->items.count, "Copy source", &src_start) ||
+        !integer_arg (args[4], src->items.count - src_start, "Copy count",
+                      &count)) {
+        return NIL_VAL ();
+    }
+
+    // Either list may have no storage yet.
+    if (count == 0) return args[0];
+
+    if (dst_start + count > dst->items.count) {
+        reserve (&dst->items, dst_start + count);
+        dst->items.count = dst_start + count;
+    }
+
+    memmove (dst->items.values + dst_start, src->items.values + src_start,
+             count * sizeof (value));
+    return args[0];
+}
+
+void register_list_natives (void) {
+    define_native ("append", &native_append);
+    define_native ("copy", &native_copy);
+    define_native ("length", &native_length);
+    define_native ("slice", &native_slice);
+}
@@ -0,0 +1,11 @@
+// apachejuice, 18.10.2026
+// See LICENSE for details.
+#ifndef __ALOXOTL_LIST__
+#define __ALOXOTL_LIST__
+
+#include "common.h"
+
+// Natives operating on lists: append, copy, length, slice.
+void register_list_natives (void);
+
+#endif
@@ -2,6 +2,10 @@
 // See LICENSE for details.
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include "compiler.h"
+#include "image.h"
+#include "memory.h"
 #include "vm.h"
 
 static void repl (void) {
@@ -47,27 +51,99 @@ static char *read_file (const char *path) {
     return buffer;
 }
 
-static void run_file (const char *path) {
+static interpret_result run_file (const char *path, bool use_cache) {
     char            *source = read_file (path);
-    interpret_result result = interpret (source);
+    interpret_result result = interpret_file (source, path, use_cache);
     free (source);
 
-    if (result == INTERPRET_COMPILE_ERROR) exit (65);
-    if (result == INTERPRET_RUNTIME_ERROR) exit (70);
+    return result;
+}
+
+static void usage (const char *argv0) {
+    fprintf (stderr,
+             "Usage: %s [options] [path]\n"
+             "  --gc-stats=FILE          dump GC counters as JSON at exit\n"
+             "  --gc-min-heap=SIZE       never collect below this heap size\n"
+             "  --gc-max-heap=SIZE       collect before growing past this\n"
+             "  --gc-target=FRACTION     share of time to spend in the GC\n"
+             "  --gc-memory-limit=SIZE   stay under this much memory\n"
+             "  --image=FILE             start from a saved heap image\n"
+             "  --save-image=FILE        save the heap after the script "
+             "ran\n"
+             "  --no-cache               neither read nor write bytecode "
+             "cache files\n"
+             "  --eager                  compile function bodies before "
+             "they are called\n",
+             argv0);
+    exit (64);
 }
 
 int main (int argc, char *argv[]) {
+    const char *path       = NULL;
+    const char *stats_path = getenv ("ALOXOTL_GC_STATS");
+    const char *image_path = NULL;
+    const char *save_path  = NULL;
+    bool        use_cache  = getenv ("ALOXOTL_NO_CACHE") == NULL;
+
+    gc_policy policy;
+    init_gc_policy (&policy);
+    gc_policy_from_env (&policy);
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp (argv[i], "--gc-stats=", 11) == 0) {
+            stats_path = argv[i] + 11;
+        } else if (strncmp (argv[i], "--gc-", 5) == 0) {
+            if (!gc_policy_option (&policy, argv[i])) {
+                fprintf (stderr, "Invalid option '%s'\n", argv[i]);
+                usage (argv[0]);
+            }
+        } else if (strncmp (argv[i], "--image=", 8) == 0) {
+            image_path = argv[i] + 8;
+        } else if (strncmp (argv[i], "--save-image=", 13) == 0) {
+            save_path = argv[i] + 13;
+        } else if (strcmp (argv[i], "--no-cache") == 0) {
+            use_cache = false;
+        } else if (strcmp (argv[i], "--eager") == 0) {
+            set_lazy_compile (false);
+        } else if (argv[i][0] == '-' || path != NULL) {
+            usage (argv[0]);
+        } else {
+            path = argv[i];
+        }
+    }
+
+    if (!gc_policy_valid (&policy)) {
+        fprintf (stderr, "GC max heap is smaller than min heap\n");
+        usage (argv[0]);
+    }
+
     init_vm ();
+    set_gc_policy (&policy);
 
-    if (argc == 1) {
+    if (image_path != NULL && !image_load (image_path)) {
+        fprintf (stderr, "Could not load image '%s'\n", image_path);
+        exit (74);
+    }
+
+    interpret_result result = INTERPRET_OK;
+    if (path == NULL) {
         repl ();
-    } else if (argc == 2) {
-        run_file (argv[1]);
     } else {
-        fprintf (stderr, "Usage: %s [path]\n", argv[0]);
-        return 64;
+        result = run_file (path, use_cache);
+    }
+
+    if (save_path != NULL && result == INTERPRET_OK &&
+        !image_save (save_path)) {
+        fprintf (stderr, "Could not save image '%s'\n", save_path);
     }
 
+    if (stats_path != NULL && !write_gc_stats (stats_path)) {
+        perror ("Unable to write GC stats");
+    }
+
+    if (result == INTERPRET_COMPILE_ERROR) exit (65);
+    if (result == INTERPRET_RUNTIME_ERROR) exit (70);
+
     free_vm ();
     return 0;
 }
@@ -0,0 +1,343 @@
+// apachejuice, 18.10.2026
+// See LICENSE for details.
+#include "map.h"
+#include "heap.h"
+#include "memory.h"
+#include "rope.h"
+#include "vm.h"
+
+#include <string.h>
+
+#define MAP_MAX_LOAD 0.75
+
+// Both arrays share one block: `capacity` entries, then `capacity` hashes.
+#define MAP_SLOT_SIZE (sizeof (map_entry) + sizeof (uint32))
+
+static inline uint32 mix64 (uint64 x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return (uint32) x;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wswitch"
+
+// Keys have been through map_prepare_key. Never 0, which marks empty slots.
+static uint32 hash_value (value key) {
+    uint32 hash = 0;
+    switch (key.type) {
+        case VALUE_NIL: hash = 0x9e3779b1u; break;
+        case VALUE_BOOL:
+            hash = AS_BOOL (key) ? 0x85ebca77u : 0xc2b2ae3du;
+            break;
+
+        case VALUE_INT: hash = mix64 ((uint64) AS_INT (key)); break;
+
+        // A double holding an integer equals that int (and -0 equals 0), so
+        // it hashes like one.
+        case VALUE_NUMBER: {
+            double num = AS_NUMBER (key);
+            if (num >= -0x1p63 && num < 0x1p63 && num == (double) (int64) num) {
+                hash = mix64 ((uint64) (int64) num);
+                break;
+            }
+
+            uint64 bits;
+            memcpy (&bits, &num, sizeof (bits));
+            hash = mix64 (bits);
+            break;
+        }
+
+        case VALUE_OBJ:
+            if (IS_STRING (key)) {
+                hash = AS_STRING (key)->hash;
+            } else {
+                hash = mix64 ((uint64) (uintptr_t) AS_OBJ (key));
+            }
+
+            break;
+    }
+
+    return hash == 0 ? 1 : hash;
+}
+
+#pragma GCC diagnostic pop
+
+static bool hashed_by_address (value key) {
+    return IS_OBJ (key) && !IS_STRING (key);
+}
+
+bool map_prepare_key (value *slot) {
+    if (IS_ROPE (*slot)) {
+        *slot = OBJ_VAL ((obj *) rope_flatten (AS_ROPE (*slot)));
+    }
+
+    if (IS_STRING (*slot)) {
+        *slot = OBJ_VAL ((obj *) intern_string (AS_STRING (*slot)));
+    }
+
+    return !IS_NUMBER (*slot) || AS_NUMBER (*slot) == AS_NUMBER (*slot);
+}
+
+static void insert (obj_map *map, value key, value val, uint32 hash) {
+    size mask  = map->capacity - 1;
+    size index = hash & mask;
+    while (map->hashes[index] != 0) index = (index + 1) & mask;
+
+    map->entries[index] = (map_entry) {key, val};
+    map->hashes[index]  = hash;
+    map->count++;
+}
+
+// Also rehashes keys hashed by address, so it doubles as the cure for a
+// stale map.
+static void adjust_capacity (obj_map *map, size capacity) {
+    uint8 *block = ALLOCATE (uint8, capacity * MAP_SLOT_SIZE);
+
+    // The allocation may have collected, so only read the old slots now.
+    obj_map old   = *map;
+    map->count    = 0;
+    map->capacity = capacity;
+    map->entries  = (map_entry *) block;
+    map->hashes   = (uint32 *) (block + capacity * sizeof (map_entry));
+    map->stale    = false;
+    memset (map->hashes, 0, capacity * sizeof (uint32));
+
+    for (size i = 0; i < old.capacity; i++) {
+        if (old.hashes[i] == 0) continue;
+
+        map_entry *entry = &old.entries[i];
+        uint32     hash  = old.hashes[i];
+        if (old.stale && hashed_by_address (entry->key)) {
+            hash = hash_value (entry->key);
+        }
+
+        insert (map, entry->key, entry->val, hash);
+    }
+
+    FREE_ARRAY (uint8, old.entries, old.capacity * MAP_SLOT_SIZE);
+}
+
+static void refresh (obj_map *map) {
+    if (map->stale) adjust_capacity (map, map->capacity);
+}
+
+// Returns the slot holding `key`, or -1.
+static int64 find (obj_map *map, value key, uint32 hash) {
+    if (map->count == 0) return -1;
+
+    size mask = map->capacity - 1;
+    for (size index = hash & mask;; index = (index + 1) & mask) {
+        if (map->hashes[index] == 0) return -1;
+
+        if (map->hashes[index] == hash &&
+            values_equal (map->entries[index].key, key)) {
+            return (int64) index;
+        }
+    }
+}
+
+bool map_get (obj_map *map, value key, value *out) {
+    refresh (map);
+
+    int64 index = find (map, key, hash_value (key));
+    if (index < 0) return false;
+
+    *out = map->entries[index].val;
+    return true;
+}
+
+void map_set (obj_map *map, value key, value val) {
+    refresh (map);
+
+    uint32 hash  = hash_value (key);
+    int64  index = find (map, key, hash);
+    if (index >= 0) {
+        map->entries[index].val = val;
+        return;
+    }
+
+    if (map->count + 1 > map->capacity * MAP_MAX_LOAD) {
+        adjust_capacity (map, GROW_CAPACITY (map->capacity));
+    }
+
+    insert (map, key, val, hash);
+}
+
+// Empties slot `hole` and moves later members of its probe run back, so
+// lookups never need tombstones.
+static void remove_at (obj_map *map, size hole) {
+    size mask = map->capacity - 1;
+    size next = (hole + 1) & mask;
+
+    while (map->hashes[next] != 0) {
+        size home = map->hashes[next] & mask;
+
+        // An entry may fill the hole unless its home lies cyclically in
+        // (hole, next].
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            map->entries[hole] = map->entries[next];
+            map->hashes[hole]  = map->hashes[next];
+            hole               = next;
+        }
+
+        next = (next + 1) & mask;
+    }
+
+    map->hashes[hole] = 0;
+    map->count--;
+}
+
+bool map_delete (obj_map *map, value key) {
+    refresh (map);
+
+    int64 index = find (map, key, hash_value (key));
+    if (index < 0) return false;
+
+    remove_at (map, (size) index);
+    return true;
+}
+
+void free_map (obj_map *map) {
+    FREE_ARRAY (uint8, map->entries, map->capacity * MAP_SLOT_SIZE);
+}
+
+size map_bytes (const obj_map *map) {
+    return map->capacity * MAP_SLOT_SIZE;
+}
+
+void mark_map (obj_map *map) {
+    for (size i = 0; i < map->capacity; i++) {
+        if (map->hashes[i] == 0) continue;
+
+        mark_value (map->entries[i].key);
+        mark_value (map->entries[i].val);
+    }
+}
+
+void relocate_map (obj_map *map) {
+    for (size i = 0; i < map->capacity; i++) {
+        if (map->hashes[i] == 0) continue;
+
+        map_entry *entry = &map->entries[i];
+        if (IS_OBJ (entry->key)) {
+            obj *moved = heap_forward (AS_OBJ (entry->key));
+            if (moved != AS_OBJ (entry->key)) {
+                entry->key = OBJ_VAL (moved);
+                map->stale |= hashed_by_address (entry->key);
+            }
+        }
+
+        if (IS_OBJ (entry->val)) {
+            entry->val = OBJ_VAL (heap_forward (AS_OBJ (entry->val)));
+        }
+    }
+}
+
+static bool map_arg (const char *name, uint8 argc, value *args,
+                     uint8 expect) {
+    if (argc != expect || !IS_MAP (args[0])) {
+        native_error ("%s expects a map and %d more arguments", name,
+                      expect - 1);
+        return false;
+    }
+
+    if (expect > 1 && !map_prepare_key (&args[1])) {
+        native_error ("NaN cannot be used as a map key");
+        return false;
+    }
+
+    return true;
+}
+
+static value native_map (uint8 argc, value *args) {
+    if (argc != 0) return native_error ("map expects no arguments");
+
+    return OBJ_VAL ((obj *) new_map ());
+}
+
+// map_get(m, key) is nil for missing keys; map_get(m, key, default) returns
+// `default` instead.
+static value native_map_get (uint8 argc, value *args) {
+    if (argc != 2 && argc != 3) {
+        return native_error ("map_get expects a map, a key and a default");
+    }
+
+    if (!map_arg ("map_get", 2, args, 2)) return NIL_VAL ();
+
+    value val;
+    if (map_get (AS_MAP (args[0]), args[1], &val)) return val;
+
+    return argc == 3 ? args[2] : NIL_VAL ();
+}
+
+// Returns the value stored.
+static value native_map_set (uint8 argc, value *args) {
+    if (!map_arg ("map_set", argc, args, 3)) return NIL_VAL ();
+
+    map_set (AS_MAP (args[0]), args[1], args[2]);
+    return args[2];
+}
+
+static value native_map_has (uint8 argc, value *args) {
+    if (!map_arg ("map_has", argc, args, 2)) return NIL_VAL ();
+
+    value val;
+    return BOOL_VAL (map_get (AS_MAP (args[0]), args[1], &val));
+}
+
+// Returns whether the key was there.
+static value native_map_delete (uint8 argc, value *args) {
+    if (!map_arg ("map_delete", argc, args, 2)) return NIL_VAL ();
+
+    return BOOL_VAL (map_delete (AS_MAP (args[0]), args[1]));
+}
+
+static value native_map_size (uint8 argc, value *args) {
+    if (!map_arg ("map_size", argc, args, 1)) return NIL_VAL ();
+
+    return INT_VAL ((int64) AS_MAP (args[0])->count);
+}
+
+// Collects the keys or the values into a new list, in slot order. The list
+// sits on the stack while it grows.
+static value collect (uint8 argc, value *args, bool keys) {
+    if (!map_arg (keys ? "map_keys" : "map_values", argc, args, 1)) {
+        return NIL_VAL ();
+    }
+
+    obj_list *list = new_list ();
+    push (OBJ_VAL ((obj *) list));
+
+    obj_map *map = AS_MAP (args[0]);
+    for (size i = 0; i < map->capacity; i++) {
+        if (map->hashes[i] == 0) continue;
+
+        map_entry *entry = &map->entries[i];
+        write_value_array (&list->items, keys ? entry->key : entry->val);
+    }
+
+    return pop ();
+}
+
+static value native_map_keys (uint8 argc, value *args) {
+    return collect (argc, args, true);
+}
+
+static value native_map_values (uint8 argc, value *args) {
+    return collect (argc, args, false);
+}
+
+void register_map_natives (void) {
+    define_native ("map", &native_map);
+    define_native ("map_delete", &native_map_delete);
+    define_native ("map_get", &native_map_get);
+    define_native ("map_has", &native_map_has);
+    define_native ("map_keys", &native_map_keys);
+    define_native ("map_set", &native_map_set);
+    define_native ("map_size", &native_map_size);
+    define_native ("map_values", &native_map_values);
+}
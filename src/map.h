@@ -0,0 +1,37 @@
+// apachejuice, 18.10.2026
+// See LICENSE for details.
+#ifndef __ALOXOTL_MAP__
+#define __ALOXOTL_MAP__
+
+#include "common.h"
+#include "obj.h"
+#include "value.h"
+
+// Maps take any value but NaN as a key, with the equality of values_equal.
+// Slots are laid out like the intern set: linear probing over a power-of-two
+// capacity, a cached hash per slot (0 when the slot is empty) and
+// backward-shift deletion.
+//
+// String keys are interned, so they hash by contents and compare by
+// identity. Other objects hash by address; compaction marks a map `stale`
+// when it moves one of those, and the next access rehashes it.
+
+// Turns the key in `slot` into the form stored in maps: ropes are flattened
+// and strings interned. Returns false if the key cannot be used (NaN). The
+// key must stay in `slot` while the map is used with it.
+bool map_prepare_key (value *slot);
+
+bool map_get (obj_map *map, value key, value *out);
+void map_set (obj_map *map, value key, value val);
+bool map_delete (obj_map *map, value key);
+
+void free_map (obj_map *map);
+size map_bytes (const obj_map *map);
+void mark_map (obj_map *map);
+void relocate_map (obj_map *map);
+
+// Natives: map, map_delete, map_get, map_has, map_keys, map_set, map_size,
+// map_values.
+void register_map_natives (void);
+
+#endif
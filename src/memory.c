@@ -2,25 +2,46 @@
 // See LICENSE for details.
 #include "memory.h"
 #include "chunk.h"
-#include "compiler.h"
+#include "heap.h"
 #include "obj.h"
+#include "map.h"
+#include "rope.h"
 #include "value.h"
 #include "vm.h"
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #ifdef DEBUG_LOG_GC
-#include <stdio.h>
 #include "debug.h"
 #endif
 
-#define GC_HEAP_GROW_FACTOR (2)
+// Share of committed small-object pages that may be free before the next
+// safepoint compacts the heap. Tiny heaps are never worth moving.
+#define GC_COMPACT_FRAGMENTATION (0.5)
+#define GC_COMPACT_MIN_HEAP (16 * HEAP_PAGE_SIZE)
+
+#define RELOCATE(type, ptr) ((ptr) = (type *) heap_forward ((obj *) (ptr)))
 
 extern VM vm;
 
+static uint64 now_ns (void) {
+    struct timespec ts;
+    timespec_get (&ts, TIME_UTC);
+    return (uint64) ts.tv_sec * 1000000000u + (uint64) ts.tv_nsec;
+}
+
 void *reallocate (void *ptr, size old_size, size new_size) {
     vm.heap_size += new_size - old_size;
+    if (new_size < old_size) {
+        vm.stats.bytes_freed += old_size - new_size;
+    }
+
     if (new_size > old_size) {
+        vm.stats.bytes_allocated += new_size - old_size;
+
 #ifdef DEBUG_STRESS_GC
         collect_garbage ();
 #endif
@@ -43,62 +64,111 @@ void *reallocate (void *ptr, size old_size, size new_size) {
     return result;
 }
 
+void *allocate_cell (size sz) {
+    size cell = heap_cell_size (sz);
+    vm.heap_size += cell;
+    vm.stats.bytes_allocated += cell;
+
+#ifdef DEBUG_STRESS_GC
+    collect_garbage ();
+#endif
+
+    if (vm.heap_size > vm.gc_treshold) {
+        collect_garbage ();
+    }
+
+    return heap_alloc (sz);
+}
+
+// Releases whatever an object owns outside of its heap cell. The cell itself
+// goes back to its page once the sweeper is done with it.
 static void free_object (obj *obj) {
     if (!obj) return;
 
 #ifdef DEBUG_LOG_GC
-    printf ("%p free type %s\n", (void *) obj, OBJ_TYPESTR (obj->type));
+    printf ("%p free type %s\n", (void *) obj, OBJ_TYPESTR (OBJ_TYPEOF (obj)));
 #endif
 
-    switch (obj->type) {
-        case OBJ_BOUND_METHOD: FREE (obj_bound_method, obj); break;
+    vm.heap_size -= heap_object_size (obj);
+    vm.stats.bytes_freed += heap_object_size (obj);
+
+    switch (OBJ_TYPEOF (obj)) {
+        // Strings and closures keep their payload inline, in the cell.
+        case OBJ_BOUND_METHOD:
+        case OBJ_CLOSURE:
+        case OBJ_NATIVE:
+        case OBJ_STRING:
+        case OBJ_UPVALUE: break;
 
         case OBJ_INSTANCE: {
             obj_instance *instance = (obj_instance *) obj;
             free_table (&instance->fields);
-            FREE (obj_instance, obj);
             break;
         }
 
         case OBJ_CLASS: {
             obj_class *klass = (obj_class *) obj;
             free_table (&klass->methods);
-            FREE (obj_class, obj);
             break;
         }
 
-        case OBJ_STRING: {
-            obj_string *str = (obj_string *) obj;
-            FREE_ARRAY (char, str->data, str->len + 1);
-            FREE (obj_string, obj);
-            break;
-        }
+        case OBJ_MODULE: free_table (&((obj_module *) obj)->globals); break;
 
         case OBJ_FUNC: {
             obj_func *func = (obj_func *) obj;
             free_chunk (&func->chk);
-            FREE (obj_func, obj);
             break;
         }
 
-        case OBJ_NATIVE: {
-            FREE (obj_native, obj);
+        case OBJ_F64_ARRAY: {
+            obj_f64_array *array = (obj_f64_array *) obj;
+            FREE_ARRAY (double, array->data, array->count);
             break;
         }
 
-        case OBJ_CLOSURE: {
-            obj_closure *closure = (obj_closure *) obj;
-            FREE_ARRAY (obj_upvalue *, closure->upvalues,
-                        closure->upvalue_count);
-            FREE (obj_closure, obj);
-            break;
-        }
+        case OBJ_LIST: free_value_array (&((obj_list *) obj)->items); break;
+        case OBJ_MAP: free_map ((obj_map *) obj); break;
+        case OBJ_ROPE: rope_release ((obj_rope *) obj); break;
+    }
+}
 
-        case OBJ_UPVALUE: {
-            FREE (obj_upvalue, obj);
-            break;
+// What free_object would release for `object`, besides its cell.
+static size owned_bytes (obj *object) {
+    switch (OBJ_TYPEOF (object)) {
+        case OBJ_BOUND_METHOD:
+        case OBJ_CLOSURE:
+        case OBJ_NATIVE:
+        case OBJ_STRING:
+        case OBJ_UPVALUE: return 0;
+
+        case OBJ_INSTANCE:
+            return table_bytes (&((obj_instance *) object)->fields);
+        case OBJ_CLASS: return table_bytes (&((obj_class *) object)->methods);
+        case OBJ_MODULE:
+            return table_bytes (&((obj_module *) object)->globals);
+
+        case OBJ_FUNC: {
+            chunk *chk   = &((obj_func *) object)->chk;
+            size   bytes = chk->consts.capacity * sizeof (value);
+            if (!chk->mapped) {
+                bytes += chk->capacity + chk->line_capacity * sizeof (line_run);
+            }
+
+            return bytes;
         }
+
+        case OBJ_F64_ARRAY:
+            return ((obj_f64_array *) object)->count * sizeof (double);
+
+        case OBJ_LIST:
+            return ((obj_list *) object)->items.capacity * sizeof (value);
+
+        case OBJ_MAP: return map_bytes ((obj_map *) object);
+        case OBJ_ROPE:
+            return rope_bytes ((obj_rope *) object, vm.stats.collections);
     }
+
+    return 0;
 }
 
 void mark_value (value val) {
@@ -106,15 +176,18 @@ void mark_value (value val) {
 }
 
 void mark_object (obj *object) {
-    if (!object || object->marked) return;
+    if (!object || heap_mark (object)) return;
 
 #ifdef DEBUG_LOG_GC
-    printf ("%p marked ", (void *) obj);
-    print_value (OBJ_VAL (obj));
+    printf ("%p marked ", (void *) object);
+    print_value (OBJ_VAL (object));
     printf ("\n");
 #endif
 
-    object->marked = true;
+    size cell = heap_object_size (object);
+    vm.marked_bytes += cell + owned_bytes (object);
+    vm.stats.live_objects[OBJ_TYPEOF (object)]++;
+    vm.stats.live_bytes[OBJ_TYPEOF (object)] += cell;
 
     if (vm.gray_capacity < vm.gray_count + 1) {
         vm.gray_capacity = GROW_CAPACITY (vm.gray_capacity);
@@ -148,18 +221,26 @@ static void mark_roots (void) {
     }
 
     mark_table (&vm.globals);
-    mark_compiler_roots ();
+    mark_table (&vm.builtins);
+    mark_table (&vm.modules);
     mark_object ((obj *) vm.init_string);
+
+    // The VM's own tables are allocated like object storage, so they count
+    // as live too.
+    vm.marked_bytes += table_bytes (&vm.globals) + table_bytes (&vm.builtins);
+    vm.marked_bytes += table_bytes (&vm.modules);
+    vm.marked_bytes += intern_set_bytes (&vm.strings);
 }
 
 static void blacken_object (obj *object) {
 #ifdef DEBUG_LOG_GC
-    printf ("%p blacken ", (void *) obj);
-    print_value (OBJ_VAL (obj));
+    printf ("%p blacken ", (void *) object);
+    print_value (OBJ_VAL (object));
     printf ("\n");
 #endif
 
-    switch (object->type) {
+    switch (OBJ_TYPEOF (object)) {
+        case OBJ_F64_ARRAY:
         case OBJ_STRING:
         case OBJ_NATIVE: break;
 
@@ -173,6 +254,7 @@ static void blacken_object (obj *object) {
         case OBJ_CLASS: {
             obj_class *klass = (obj_class *) object;
             mark_object ((obj *) klass->name);
+            mark_object ((obj *) klass->init);
             mark_table (&klass->methods);
             break;
         }
@@ -185,11 +267,31 @@ static void blacken_object (obj *object) {
             break;
         }
 
+        case OBJ_MODULE: {
+            obj_module *module = (obj_module *) object;
+            mark_object ((obj *) module->path);
+            mark_object ((obj *) module->body);
+            mark_table (&module->globals);
+            break;
+        }
+
         case OBJ_UPVALUE: mark_value (((obj_upvalue *) object)->closed); break;
 
+        case OBJ_LIST: mark_array (&((obj_list *) object)->items); break;
+        case OBJ_MAP: mark_map ((obj_map *) object); break;
+
+        case OBJ_ROPE: {
+            obj_rope *rope = (obj_rope *) object;
+            mark_object (rope->left);
+            mark_object (rope->right);
+            mark_object ((obj *) rope->flat);
+            break;
+        }
+
         case OBJ_FUNC: {
             obj_func *func = (obj_func *) object;
             mark_object ((obj *) func->name);
+            mark_object ((obj *) func->module);
             mark_array (&func->chk.consts);
             break;
         }
@@ -213,58 +315,271 @@ static void trace_references (void) {
     }
 }
 
-static void sweep (void) {
-    obj *prev   = NULL;
-    obj *object = vm.objects;
+void init_memory (void) {
+    init_heap (free_object);
+}
 
-    while (object) {
-        if (object->marked) {
-            object->marked = false;
-            prev           = object;
-            object         = object->next;
-        } else {
-            obj *unreached = object;
-            object         = object->next;
-            if (prev) {
-                prev->next = object;
-            } else {
-                vm.objects = object;
-            }
+void set_gc_policy (const gc_policy *policy) {
+    vm.policy      = *policy;
+    vm.gc_treshold = gc_policy_next_threshold (&vm.policy, vm.heap_size, 0, 0);
+}
 
-            free_object (unreached);
-        }
-    }
+static uint64 record_pause (uint64 start) {
+    uint64 pause = now_ns () - start;
+    uint64 us    = pause / 1000;
+    int32  b     = 0;
+
+    while (b < GC_PAUSE_BUCKETS - 1 && us >= ((uint64) 1 << b)) b++;
+
+    vm.stats.pauses[b]++;
+    vm.stats.pause_total_ns += pause;
+    if (pause > vm.stats.pause_max_ns) vm.stats.pause_max_ns = pause;
+
+    vm.stats.last_end_ns = now_ns ();
+    return pause;
 }
 
 void collect_garbage (void) {
 #ifdef DEBUG_LOG_GC
     printf ("-- GC BEGIN --\n");
+#endif
+
+    uint64 start   = now_ns ();
+    uint64 mutator = 0;
+    if (vm.stats.last_end_ns != 0) mutator = start - vm.stats.last_end_ns;
+
+    vm.stats.collections++;
+    vm.stats.mutator_total_ns += mutator;
+
+    // Pages the allocator never got to still hold last cycle's marks. Once
+    // they are swept, the pages show how well the survivors fill them.
+    heap_finish_sweep ();
+    flush_method_cache ();
+
+    if (heap_cell_bytes () >= GC_COMPACT_MIN_HEAP &&
+        heap_fragmentation () > GC_COMPACT_FRAGMENTATION) {
+        vm.compact_requested = true;
+    }
+
+#ifdef DEBUG_LOG_GC
     size before = vm.heap_size;
 #endif
 
+    vm.marked_bytes = 0;
+    memset (vm.stats.live_objects, 0, sizeof (vm.stats.live_objects));
+    memset (vm.stats.live_bytes, 0, sizeof (vm.stats.live_bytes));
+
     mark_roots ();
     trace_references ();
-    table_remove_white (&vm.strings);
-    sweep ();
+    intern_set_remove_white (&vm.strings);
 
-    vm.gc_treshold = vm.heap_size * GC_HEAP_GROW_FACTOR;
+    // Dead cells are only reclaimed as their pages get reused, so the live
+    // heap is what was marked, with the storage marked objects own.
+    size live = vm.marked_bytes;
+    heap_begin_sweep ();
+
+    uint64 pause   = record_pause (start);
+    vm.gc_treshold = gc_policy_next_threshold (&vm.policy, live, pause, mutator);
 
 #ifdef DEBUG_LOG_GC
     printf ("-- GC END --\n");
     printf (
-        "\tcollected %zu bytes (from %zu to %zu), next collection triggered at "
-        "%zu\n",
-        before - vm.heap_size, before, vm.heap_size, vm.gc_treshold);
+        "\tfound %zu bytes of garbage (heap at %zu), next collection "
+        "triggered at %zu\n",
+        before - live, before, vm.gc_treshold);
 #endif
 }
 
-void free_objects (void) {
-    /* obj *obj = vm.objects;
-    while (obj != NULL) {
-        obj *next = obj->next;
-        free_object (next);
-        obj = next;
-    } */
+static void relocate_value (value *val) {
+    if (IS_OBJ (*val)) val->as.o = heap_forward (AS_OBJ (*val));
+}
 
+static void relocate_array (value_array *array) {
+    for (size i = 0; i < array->count; i++) {
+        relocate_value (&array->values[i]);
+    }
+}
+
+static void relocate_object (obj *object) {
+    switch (OBJ_TYPEOF (object)) {
+        case OBJ_F64_ARRAY:
+        case OBJ_STRING:
+        case OBJ_NATIVE: break;
+
+        case OBJ_BOUND_METHOD: {
+            obj_bound_method *bound = (obj_bound_method *) object;
+            relocate_value (&bound->reciever);
+            RELOCATE (obj_closure, bound->method);
+            break;
+        }
+
+        case OBJ_CLASS: {
+            obj_class *klass = (obj_class *) object;
+            RELOCATE (obj_string, klass->name);
+            RELOCATE (obj_closure, klass->init);
+            relocate_table (&klass->methods);
+            break;
+        }
+
+        case OBJ_INSTANCE: {
+            obj_instance *instance = (obj_instance *) object;
+            RELOCATE (obj_class, instance->klass);
+            relocate_table (&instance->fields);
+            break;
+        }
+
+        case OBJ_MODULE: {
+            obj_module *module = (obj_module *) object;
+            RELOCATE (obj_string, module->path);
+            RELOCATE (obj_func, module->body);
+            relocate_table (&module->globals);
+            break;
+        }
+
+        case OBJ_UPVALUE: {
+            obj_upvalue *upvalue = (obj_upvalue *) object;
+            relocate_value (&upvalue->closed);
+            RELOCATE (obj_upvalue, upvalue->next);
+
+            // A closed upvalue points into itself, which may have moved.
+            if (upvalue->location < vm.stack ||
+                upvalue->location >= vm.stack + STACK_MAX) {
+                upvalue->location = &upvalue->closed;
+            }
+
+            break;
+        }
+
+        case OBJ_LIST: relocate_array (&((obj_list *) object)->items); break;
+        case OBJ_MAP: relocate_map ((obj_map *) object); break;
+
+        case OBJ_ROPE: {
+            obj_rope *rope = (obj_rope *) object;
+            RELOCATE (obj, rope->left);
+            RELOCATE (obj, rope->right);
+            RELOCATE (obj_string, rope->flat);
+            break;
+        }
+
+        case OBJ_FUNC: {
+            obj_func *func = (obj_func *) object;
+            RELOCATE (obj_string, func->name);
+            RELOCATE (obj_module, func->module);
+            relocate_array (&func->chk.consts);
+            break;
+        }
+
+        case OBJ_CLOSURE: {
+            obj_closure *closure = (obj_closure *) object;
+            RELOCATE (obj_func, closure->func);
+            for (int32 i = 0; i < closure->upvalue_count; i++) {
+                RELOCATE (obj_upvalue, closure->upvalues[i]);
+            }
+
+            break;
+        }
+    }
+}
+
+static void relocate_roots (void) {
+    for (value *slot = vm.stack; slot < vm.stack_top; slot++) {
+        relocate_value (slot);
+    }
+
+    for (int32 i = 0; i < vm.frame_count; i++) {
+        RELOCATE (obj_closure, vm.frames[i].closure);
+    }
+
+    RELOCATE (obj_upvalue, vm.open_upvalues);
+    RELOCATE (obj_string, vm.init_string);
+    relocate_table (&vm.globals);
+    relocate_table (&vm.builtins);
+    relocate_table (&vm.modules);
+    relocate_intern_set (&vm.strings);
+}
+
+// A full collection that also moves objects out of sparse pages. Every
+// reference into the heap must be reachable from here, so this may only run
+// where the VM holds no object pointers in C locals: between instructions.
+void compact_heap (void) {
+    vm.compact_requested = false;
+    collect_garbage ();
+    vm.compact_requested = false;
+
+    uint64 start = now_ns ();
+    vm.stats.compactions++;
+
+    heap_finish_sweep ();
+    if (heap_evacuate () > 0) {
+        heap_for_each_object (relocate_object);
+        relocate_roots ();
+        heap_release_evacuated ();
+    }
+
+    record_pause (start);
+
+#ifdef DEBUG_LOG_GC
+    printf ("-- GC COMPACT -- %zu bytes in cells\n", heap_cell_bytes ());
+#endif
+}
+
+static void write_type_counts (FILE *file, const char *key, size *counts) {
+    fprintf (file, "  \"%s\": {", key);
+    for (int32 i = 0; i < _OBJTYPE_COUNT; i++) {
+        fprintf (file, "%s\"%s\": %zu", i ? ", " : "", OBJ_TYPESTR (i),
+                 counts[i]);
+    }
+
+    fprintf (file, "},\n");
+}
+
+// Dumps the counters as JSON. A path of "-" means stderr.
+bool write_gc_stats (const char *path) {
+    FILE *file = strcmp (path, "-") == 0 ? stderr : fopen (path, "w");
+    if (file == NULL) return false;
+
+    fprintf (file, "{\n");
+    fprintf (file, "  \"collections\": %llu,\n",
+             (unsigned long long) vm.stats.collections);
+    fprintf (file, "  \"compactions\": %llu,\n",
+             (unsigned long long) vm.stats.compactions);
+    fprintf (file, "  \"bytes_allocated\": %llu,\n",
+             (unsigned long long) vm.stats.bytes_allocated);
+    fprintf (file, "  \"bytes_freed\": %llu,\n",
+             (unsigned long long) vm.stats.bytes_freed);
+    fprintf (file, "  \"heap_size\": %zu,\n", vm.heap_size);
+    fprintf (file, "  \"gc_treshold\": %zu,\n", vm.gc_treshold);
+    fprintf (file, "  \"grow_factor\": %g,\n", vm.policy.grow_factor);
+    fprintf (file, "  \"pause_total_ns\": %llu,\n",
+             (unsigned long long) vm.stats.pause_total_ns);
+    fprintf (file, "  \"pause_max_ns\": %llu,\n",
+             (unsigned long long) vm.stats.pause_max_ns);
+    fprintf (file, "  \"mutator_total_ns\": %llu,\n",
+             (unsigned long long) vm.stats.mutator_total_ns);
+
+    write_type_counts (file, "live_objects", vm.stats.live_objects);
+    write_type_counts (file, "live_bytes", vm.stats.live_bytes);
+
+    fprintf (file, "  \"pause_histogram_us\": [");
+    for (int32 b = 0; b < GC_PAUSE_BUCKETS; b++) {
+        fprintf (file, "%s{\"lt\": ", b ? ", " : "");
+        if (b == GC_PAUSE_BUCKETS - 1) {
+            fprintf (file, "null");
+        } else {
+            fprintf (file, "%llu", 1ull << b);
+        }
+
+        fprintf (file, ", \"count\": %llu}",
+                 (unsigned long long) vm.stats.pauses[b]);
+    }
+
+    fprintf (file, "]\n}\n");
+
+    if (file != stderr) fclose (file);
+    return true;
+}
+
+void free_objects (void) {
+    free_heap ();
     free (vm.gray_stack);
 }
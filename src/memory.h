@@ -4,6 +4,8 @@
 #define __ALOXOTL_MEMORY__
 
 #include "common.h"
+#include "gcpolicy.h"
+#include "obj.h"
 #include "value.h"
 
 #define ALLOCATE(type, len) (type *) reallocate (NULL, 0, sizeof (type) * (len))
@@ -18,10 +20,35 @@
 
 #define FREE(type, pointer) reallocate (pointer, sizeof (type), 0)
 
+// Pause histogram buckets: bucket 0 counts pauses under 1us, bucket i those
+// under 2^i us. The last one takes everything longer.
+#define GC_PAUSE_BUCKETS 24
+
+typedef struct {
+    uint64 collections;
+    uint64 compactions;
+    uint64 bytes_allocated;
+    uint64 bytes_freed;
+    uint64 pause_total_ns;
+    uint64 pause_max_ns;
+    uint64 pauses[GC_PAUSE_BUCKETS];
+    uint64 mutator_total_ns;
+    uint64 last_end_ns;
+
+    // As of the last mark phase.
+    size live_objects[_OBJTYPE_COUNT];
+    size live_bytes[_OBJTYPE_COUNT];
+} gc_stats;
+
+void  init_memory (void);
 void *reallocate (void *pointer, size old_size, size new_size);
+void *allocate_cell (size sz);
+void  set_gc_policy (const gc_policy *policy);
 void  collect_garbage (void);
+void  compact_heap (void);
 void  mark_value (value val);
 void  mark_object (obj *obj);
 void  free_objects (void);
+bool  write_gc_stats (const char *path);
 
 #endif
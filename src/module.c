@@ -0,0 +1,284 @@
+// apachejuice, 18.10.2026
+// See LICENSE for details.
+#define _DEFAULT_SOURCE
+
+#include "module.h"
+#include "bcache.h"
+#include "compiler.h"
+#include "memory.h"
+#include "scanner.h"
+#include "vm.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern VM vm;
+
+// Returns the canonical form of `spec` taken relative to the directory of
+// the file `base`, or to the working directory if `base` is NULL. The
+// caller frees the result.
+static char *resolve_path (const char *spec, const char *base) {
+    char        joined[PATH_MAX];
+    const char *slash = base != NULL ? strrchr (base, '/') : NULL;
+    int         dir   = spec[0] == '/' || slash == NULL
+                            ? 0
+                            : (int) (slash - base + 1);
+
+    if (snprintf (joined, sizeof (joined), "%.*s%s", dir, base ? base : "",
+                  spec) >= (int) sizeof (joined)) {
+        return NULL;
+    }
+
+    return realpath (joined, NULL);
+}
+
+static char *read_source (const char *path) {
+    FILE *file = fopen (path, "rb");
+    if (file == NULL) return NULL;
+
+    char *buffer = NULL;
+    long  len    = -1;
+    if (fseek (file, 0L, SEEK_END) == 0) len = ftell (file);
+    if (len >= 0) {
+        rewind (file);
+        buffer = malloc ((size) len + 1);
+    }
+
+    if (buffer != NULL) {
+        if (fread (buffer, 1, (size) len, file) == (size) len) {
+            buffer[len] = '\0';
+        } else {
+            free (buffer);
+            buffer = NULL;
+        }
+    }
+
+    fclose (file);
+    return buffer;
+}
+
+// Compiles a module's source, going through the bytecode cache when the
+// main script does.
+static obj_func *compile_module (obj_module *module, const char *source) {
+    size      len        = strlen (source);
+    char     *cache_path = NULL;
+    obj_func *func       = NULL;
+
+    if (vm.use_cache) {
+        cache_path = bcache_path (module->path->data, source, len);
+        func       = bcache_load (cache_path, source, len, module);
+    }
+
+    if (func == NULL) {
+        func = compile (source, module);
+        if (func != NULL && cache_path != NULL) {
+            bcache_store (cache_path, source, len, func);
+        }
+    }
+
+    free (cache_path);
+    return func;
+}
+
+import_status import_module (obj_string *spec, obj_module *importer,
+                             obj_module **module, obj_func **body) {
+    const char *base = importer != NULL ? importer->path->data : vm.main_path;
+    char       *path = resolve_path (spec->data, base);
+    char       *source;
+    value       found;
+
+    *body = NULL;
+    if (path == NULL) return IMPORT_NOT_FOUND;
+
+    obj_string *key = copy_string (path, strlen (path));
+    if (get_table (&vm.modules, key, &found)) {
+        free (path);
+        *module = AS_MODULE (found);
+        if (!(*module)->executed && (*module)->body != NULL) {
+            *body               = (*module)->body;
+            (*module)->body     = NULL;
+            (*module)->executed = true;
+        }
+
+        return IMPORT_OK;
+    }
+
+    source = read_source (path);
+    free (path);
+    if (source == NULL) return IMPORT_NOT_FOUND;
+
+    // Registered before compiling, which roots it, and so that its
+    // functions can point to it.
+    push (OBJ_VAL ((obj *) key));
+    *module = new_module (key);
+    push (OBJ_VAL ((obj *) *module));
+    set_table (&vm.modules, key, OBJ_VAL ((obj *) *module));
+
+    obj_func *func = compile_module (*module, source);
+    free (source);
+    pop ();
+    pop ();
+
+    if (func == NULL) {
+        delete_table (&vm.modules, key);
+        return IMPORT_COMPILE_ERROR;
+    }
+
+    (*module)->executed = true;
+    *body               = func;
+    return IMPORT_OK;
+}
+
+// A file found by prefetch_modules. `job` is its index in the batch handed
+// to compile_protos, or -1 if it came from the bytecode cache.
+typedef struct {
+    char       *path;
+    char       *source;
+    char       *cache_path;
+    obj_module *module;
+    int32       job;
+} prefetch;
+
+typedef struct {
+    prefetch *items;
+    size      count;
+    size      capacity;
+} prefetch_list;
+
+static bool is_known (prefetch_list *list, const char *path) {
+    for (size i = 0; i < list->count; i++) {
+        if (strcmp (list->items[i].path, path) == 0) return true;
+    }
+
+    value found;
+    return get_table (&vm.modules, copy_string (path, strlen (path)), &found);
+}
+
+static void add_prefetch (prefetch_list *list, token spec, const char *base) {
+    char *name = malloc (spec.len);
+    if (name == NULL) exit (1);
+
+    // The lexeme still has its opening quote.
+    memcpy (name, spec.start + 1, spec.len - 1);
+    name[spec.len - 1] = '\0';
+    char *path         = resolve_path (name, base);
+    free (name);
+
+    char *source = NULL;
+    if (path != NULL && !is_known (list, path)) source = read_source (path);
+    if (source == NULL) {
+        free (path);
+        return;
+    }
+
+    if (list->count == list->capacity) {
+        list->capacity = GROW_CAPACITY (list->capacity);
+        list->items =
+            realloc (list->items, list->capacity * sizeof (prefetch));
+        if (list->items == NULL) exit (1);
+    }
+
+    list->items[list->count++] = (prefetch) {
+        .path   = path,
+        .source = source,
+        .job    = -1,
+    };
+}
+
+// Adds the modules `source` imports outside of any block. Imports in
+// functions or behind conditions may never run, so they are left alone.
+static void scan_imports (prefetch_list *list, const char *source,
+                          const char *base) {
+    scanner_t  scanner;
+    token_type prev  = TOKEN_EOF;
+    int32      depth = 0;
+
+    init_scanner (&scanner, source);
+    for (;;) {
+        token tok = scan_token (&scanner);
+        if (tok.type == TOKEN_EOF) break;
+        if (tok.type == TOKEN_ERROR) free ((char *) tok.start);
+
+        if (tok.type == TOKEN_LEFT_BRACE) depth++;
+        if (tok.type == TOKEN_RIGHT_BRACE) depth--;
+        if (tok.type == TOKEN_STRING && prev == TOKEN_IMPORT && depth == 0) {
+            add_prefetch (list, tok, base);
+        }
+
+        prev = tok.type;
+    }
+}
+
+void prefetch_modules (const char *source, const char *path) {
+    prefetch_list list = {NULL, 0, 0};
+
+    scan_imports (&list, source, path);
+    for (size i = 0; i < list.count; i++) {
+        const char *next_source = list.items[i].source;
+        const char *next_path   = list.items[i].path;
+        scan_imports (&list, next_source, next_path);
+    }
+
+    if (list.count == 0) return;
+
+    const char **sources = malloc (list.count * sizeof (char *));
+    func_proto **protos  = malloc (list.count * sizeof (func_proto *));
+    if (sources == NULL || protos == NULL) exit (1);
+
+    // Registering the modules roots them for the rest of the way.
+    size jobs = 0;
+    for (size i = 0; i < list.count; i++) {
+        prefetch   *item = &list.items[i];
+        size        len  = strlen (item->source);
+        obj_string *key  = copy_string (item->path, strlen (item->path));
+
+        push (OBJ_VAL ((obj *) key));
+        item->module = new_module (key);
+        push (OBJ_VAL ((obj *) item->module));
+        set_table (&vm.modules, key, OBJ_VAL ((obj *) item->module));
+        pop ();
+        pop ();
+
+        if (vm.use_cache) {
+            item->cache_path = bcache_path (item->path, item->source, len);
+            item->module->body =
+                bcache_load (item->cache_path, item->source, len, item->module);
+            if (item->module->body != NULL) continue;
+        }
+
+        item->job       = (int32) jobs;
+        sources[jobs++] = item->source;
+    }
+
+    compile_protos (sources, protos, jobs);
+
+    // The merge step, back on this thread: publishing is what touches the
+    // heap. A module that failed is dropped again, so that its import
+    // compiles it once more and reports the errors.
+    for (size i = 0; i < list.count; i++) {
+        prefetch *item = &list.items[i];
+        if (item->job >= 0) {
+            func_proto *proto = protos[item->job];
+            if (proto == NULL) {
+                delete_table (&vm.modules, item->module->path);
+            } else {
+                item->module->body = publish_proto (proto, item->module);
+                free_proto (proto);
+                if (item->cache_path != NULL) {
+                    bcache_store (item->cache_path, item->source,
+                                  strlen (item->source), item->module->body);
+                }
+            }
+        }
+
+        free (item->cache_path);
+        free (item->source);
+        free (item->path);
+    }
+
+    free (sources);
+    free (protos);
+    free (list.items);
+}
@@ -0,0 +1,32 @@
+// apachejuice, 18.10.2026
+// See LICENSE for details.
+#ifndef __ALOXOTL_MODULE__
+#define __ALOXOTL_MODULE__
+
+#include "common.h"
+#include "obj.h"
+
+// `import "path";` runs the module at `path` once per process and then
+// copies its globals into the importing namespace. Paths are relative to
+// the directory of the importing file (the working directory in the REPL)
+// and modules are keyed by their canonical path, so one file reached
+// through different paths is still only compiled and run once.
+typedef enum {
+    IMPORT_OK,
+    IMPORT_NOT_FOUND,
+    IMPORT_COMPILE_ERROR,
+} import_status;
+
+// Finds or loads the module `spec` names for code in `importer` (NULL for
+// the main script). If the module has not run yet, `*body` is set to its
+// top-level function, which the caller must run; otherwise it is NULL.
+import_status import_module (obj_string *spec, obj_module *importer,
+                             obj_module **module, obj_func **body);
+
+// Compiles the modules `source` (the file at `path`) imports at its top
+// level, and the ones those import in turn, on all cores at once. They are
+// still run by their import statements; this only moves the compiling
+// ahead. Modules that are loaded already or fail to compile are skipped.
+void prefetch_modules (const char *source, const char *path);
+
+#endif
@@ -2,7 +2,9 @@
 // See LICENSE for details.
 #include "obj.h"
 #include "chunk.h"
+#include "hash.h"
 #include "memory.h"
+#include "rope.h"
 #include "value.h"
 #include "vm.h"
 
@@ -11,21 +13,24 @@
 
 extern VM vm;
 
-const char *const _obj_types[] = {
-    "bound_method", "class",  "closure", "func",
-    "instance",     "native", "string",  "upvalue",
+const char *const _obj_types[_OBJTYPE_COUNT] = {
+    "bound_method", "class",  "closure", "f64_array", "func",
+    "instance",     "list",   "map",     "module",    "native",
+    "rope",         "string", "upvalue",
 };
 
+// The header and the field after it must share one word, see obj.h.
+_Static_assert (sizeof (obj) == 4, "object header must be 32 bits");
+_Static_assert (_OBJTYPE_COUNT <= OBJ_TYPE_MASK, "too many object types");
+_Static_assert (sizeof (obj_string) == 16, "obj_string has padding");
+_Static_assert (sizeof (obj_closure) == 16, "obj_closure has padding");
+
 #define ALLOCATE_OBJ(type, obj_type) \
     (type *) allocate_object (sizeof (type), obj_type)
 
 static obj *allocate_object (size sz, obj_type type) {
-    obj *obj    = reallocate (NULL, 0, sz);
-    obj->type   = type;
-    obj->marked = false;
-
-    obj->next  = vm.objects;
-    vm.objects = obj;
+    obj *obj    = allocate_cell (sz);
+    obj->header = type;
 
 #ifdef DEBUG_LOG_GC
     printf ("%p allocate %zu for %s\n", (void *) obj, sz, OBJ_TYPESTR (type));
@@ -37,6 +42,7 @@ static obj *allocate_object (size sz, obj_type type) {
 obj_class *new_klass (obj_string *name) {
     obj_class *klass = ALLOCATE_OBJ (obj_class, OBJ_CLASS);
     klass->name      = name;
+    klass->init      = NULL;
     init_table (&klass->methods);
 
     return klass;
@@ -50,6 +56,47 @@ obj_instance *new_instance (obj_class *klass) {
     return instance;
 }
 
+obj_list *new_list (void) {
+    obj_list *list = ALLOCATE_OBJ (obj_list, OBJ_LIST);
+    init_value_array (&list->items);
+
+    return list;
+}
+
+// Zero-filled. The elements are allocated first, so a collection they
+// trigger cannot find the object half built.
+obj_f64_array *new_f64_array (size count) {
+    double *data = GROW_ARRAY (double, NULL, 0, count);
+    if (count > 0) memset (data, 0, count * sizeof (double));
+
+    obj_f64_array *array = ALLOCATE_OBJ (obj_f64_array, OBJ_F64_ARRAY);
+    array->count         = count;
+    array->data          = data;
+
+    return array;
+}
+
+obj_map *new_map (void) {
+    obj_map *map  = ALLOCATE_OBJ (obj_map, OBJ_MAP);
+    map->stale    = false;
+    map->count    = 0;
+    map->capacity = 0;
+    map->entries  = NULL;
+    map->hashes   = NULL;
+
+    return map;
+}
+
+obj_module *new_module (obj_string *path) {
+    obj_module *module = ALLOCATE_OBJ (obj_module, OBJ_MODULE);
+    module->executed   = false;
+    module->path       = path;
+    module->body       = NULL;
+    init_table (&module->globals);
+
+    return module;
+}
+
 obj_bound_method *new_bound_method (value reciever, obj_closure *closure) {
     obj_bound_method *bound = ALLOCATE_OBJ (obj_bound_method, OBJ_BOUND_METHOD);
     bound->reciever         = reciever;
@@ -59,15 +106,14 @@ obj_bound_method *new_bound_method (value reciever, obj_closure *closure) {
 }
 
 obj_closure *new_closure (obj_func *func) {
-    obj_upvalue **upvalues = ALLOCATE (obj_upvalue *, func->upvalue_count);
-    for (int32 i = 0; i < func->upvalue_count; i++) {
-        upvalues[i] = NULL;
-    }
-
-    obj_closure *closure   = ALLOCATE_OBJ (obj_closure, OBJ_CLOSURE);
+    obj_closure *closure = (obj_closure *) allocate_object (
+        sizeof (obj_closure) + sizeof (obj_upvalue *) * func->upvalue_count,
+        OBJ_CLOSURE);
     closure->func          = func;
-    closure->upvalues      = upvalues;
     closure->upvalue_count = func->upvalue_count;
+    for (int32 i = 0; i < func->upvalue_count; i++) {
+        closure->upvalues[i] = NULL;
+    }
 
     return closure;
 }
@@ -76,6 +122,7 @@ obj_func *new_func (void) {
     obj_func *func      = ALLOCATE_OBJ (obj_func, OBJ_FUNC);
     func->arity         = 0;
     func->name          = NULL;
+    func->module        = NULL;
     func->upvalue_count = 0;
     init_chunk (&func->chk);
 
@@ -88,53 +135,90 @@ obj_native *new_native (native_fn callback) {
     return native;
 }
 
-static obj_string *allocate_string (char *data, size len, uint32 hash) {
-    obj_string *str = ALLOCATE_OBJ (obj_string, OBJ_STRING);
-    str->len        = len;
-    str->data       = data;
-    str->hash       = hash;
+obj_rope *new_rope (size len, uint32 depth) {
+    obj_rope *rope = ALLOCATE_OBJ (obj_rope, OBJ_ROPE);
+    rope->depth    = depth;
+    rope->len      = len;
+    rope->left     = NULL;
+    rope->right    = NULL;
+    rope->buffer   = NULL;
+    rope->flat     = NULL;
 
-    push (OBJ_VAL ((obj *) str));
-    set_table (&vm.strings, str, NIL_VAL ());
-    pop ();
+    return rope;
+}
+
+static obj_string *allocate_string (size len, uint32 hash) {
+    obj_string *str =
+        (obj_string *) allocate_object (sizeof (obj_string) + len + 1,
+                                        OBJ_STRING);
+    str->len       = len;
+    str->hash      = hash;
+    str->data[len] = 0;
 
     return str;
 }
 
+static void add_string (obj_string *str) {
+    OBJ_SET_FLAG (&str->base_ref, OBJ_INTERNED);
+    push (OBJ_VAL ((obj *) str));
+    intern_set_add (&vm.strings, str);
+    pop ();
+}
+
 static uint32 hash_string (const char *data, size len) {
-    uint32 hash = 2166136261u;
-    for (size i = 0; i < len; i++) {
-        hash ^= (uint8) data[i];
-        hash *= 16777619;
-    }
+    return STRING_HASH (data, len);
+}
 
-    return hash;
+// Returns an uninterned string of `len` bytes for the caller to fill in,
+// which must then go through `finish_string` before it is used as a value.
+obj_string *new_string (size len) {
+    return allocate_string (len, 0);
 }
 
-obj_string *take_string (char *data, size len) {
-    uint32      hash     = hash_string (data, len);
-    obj_string *interned = table_find_string (&vm.strings, data, len, hash);
-    if (interned != NULL) {
-        FREE_ARRAY (char, data, len + 1);
-        return interned;
-    }
+obj_string *finish_string (obj_string *str) {
+#ifdef LAZY_INTERN
+    return str;
+#else
+    return intern_string (str);
+#endif
+}
+
+// Returns the canonical string with the contents of `str`. Tables compare
+// keys by identity, so anything used as a key has to go through here.
+obj_string *intern_string (obj_string *str) {
+    if (IS_INTERNED (str)) return str;
 
-    return allocate_string (data, len, hash_string (data, len));
+    str->hash            = hash_string (str->data, str->len);
+    obj_string *interned =
+        intern_set_find (&vm.strings, str->data, str->len, str->hash);
+    if (interned != NULL) return interned;
+
+    add_string (str);
+    return str;
 }
 
 obj_string *copy_string (const char *data, size len) {
-    char *heap_data = ALLOCATE (char, len + 1);
-    memcpy (heap_data, data, len);
-    heap_data[len] = 0;
-
-    uint32      hash     = hash_string (data, len);
-    obj_string *interned = table_find_string (&vm.strings, data, len, hash);
-    if (interned != NULL) {
-        FREE_ARRAY (char, heap_data, len + 1);
-        return interned;
-    }
+    return copy_string_hashed (data, len, hash_string (data, len));
+}
 
-    return allocate_string (heap_data, len, hash);
+// Like copy_string, for callers that already know the hash of `data`, such
+// as the bytecode cache loader.
+obj_string *copy_string_hashed (const char *data, size len, uint32 hash) {
+    obj_string *interned = intern_set_find (&vm.strings, data, len, hash);
+    if (interned != NULL) return interned;
+
+    obj_string *str = allocate_string (len, hash);
+    memcpy (str->data, data, len);
+    add_string (str);
+
+    return str;
+}
+
+bool strings_equal (obj_string *a, obj_string *b) {
+    if (a == b) return true;
+    if (IS_INTERNED (a) && IS_INTERNED (b)) return false;
+
+    return a->len == b->len && memcmp (a->data, b->data, a->len) == 0;
 }
 
 obj_upvalue *new_upvalue (value *slot) {
@@ -154,6 +238,60 @@ static void print_func (obj_func *func) {
     }
 }
 
+static void print_f64_array (obj_f64_array *array) {
+    printf ("f64[");
+    for (size i = 0; i < array->count; i++) {
+        if (i > 0) printf (", ");
+        printf ("%g", array->data[i]);
+    }
+
+    printf ("]");
+}
+
+// Lists can contain themselves, so nesting is cut off at some depth.
+static void print_list (obj_list *list) {
+    static int32 depth = 0;
+    if (depth == 8) {
+        printf ("[...]");
+        return;
+    }
+
+    depth++;
+    printf ("[");
+    for (size i = 0; i < list->items.count; i++) {
+        if (i > 0) printf (", ");
+        print_value (list->items.values[i]);
+    }
+
+    printf ("]");
+    depth--;
+}
+
+// Same cut-off as for lists.
+static void print_map (obj_map *map) {
+    static int32 depth = 0;
+    if (depth == 8) {
+        printf ("{...}");
+        return;
+    }
+
+    depth++;
+    printf ("{");
+    bool first = true;
+    for (size i = 0; i < map->capacity; i++) {
+        if (map->hashes[i] == 0) continue;
+
+        if (!first) printf (", ");
+        first = false;
+        print_value (map->entries[i].key);
+        printf (": ");
+        print_value (map->entries[i].val);
+    }
+
+    printf ("}");
+    depth--;
+}
+
 void print_object (value val) {
     switch (OBJ_TYPE (val)) {
         case OBJ_BOUND_METHOD:
@@ -169,6 +307,13 @@ void print_object (value val) {
                     (void *) AS_CLASS (val));
             break;
         case OBJ_CLOSURE: print_func (AS_CLOSURE (val)->func); break;
+        case OBJ_F64_ARRAY: print_f64_array (AS_F64_ARRAY (val)); break;
+        case OBJ_LIST: print_list (AS_LIST (val)); break;
+        case OBJ_MAP: print_map (AS_MAP (val)); break;
+        case OBJ_MODULE:
+            printf ("<module %s>", AS_MODULE (val)->path->data);
+            break;
+        case OBJ_ROPE: rope_print (AS_ROPE (val)); break;
         case OBJ_STRING: printf ("%s", AS_CSTRING (val)); break;
         case OBJ_FUNC: print_func (AS_FUNC (val)); break;
         case OBJ_NATIVE:
@@ -11,47 +11,84 @@
 #define IS_BOUND_METHOD(val) (is_obj_type (val, OBJ_BOUND_METHOD))
 #define IS_CLASS(val) (is_obj_type (val, OBJ_CLASS))
 #define IS_CLOSURE(val) (is_obj_type (val, OBJ_CLOSURE))
+#define IS_F64_ARRAY(val) (is_obj_type (val, OBJ_F64_ARRAY))
 #define IS_FUNC(val) (is_obj_type (val, OBJ_FUNC))
 #define IS_INSTANCE(val) (is_obj_type (val, OBJ_INSTANCE))
+#define IS_LIST(val) (is_obj_type (val, OBJ_LIST))
+#define IS_MAP(val) (is_obj_type (val, OBJ_MAP))
+#define IS_MODULE(val) (is_obj_type (val, OBJ_MODULE))
 #define IS_NATIVE(val) (is_obj_type (val, OBJ_NATIVE))
+#define IS_ROPE(val) (is_obj_type (val, OBJ_ROPE))
 #define IS_STRING(val) (is_obj_type (val, OBJ_STRING))
-#define OBJ_TYPE(val) (AS_OBJ (val)->type)
+#define IS_TEXT(val) (IS_STRING (val) || IS_ROPE (val))
+#define IS_INTERNED(str) (OBJ_HAS_FLAG (&(str)->base_ref, OBJ_INTERNED))
+#define OBJ_TYPE(val) (OBJ_TYPEOF (AS_OBJ (val)))
 
 #define AS_BOUND_METHOD(val) ((obj_bound_method *) AS_OBJ (val))
 #define AS_CLASS(val) ((obj_class *) AS_OBJ (val))
 #define AS_CLOSURE(val) ((obj_closure *) AS_OBJ (val))
 #define AS_CSTRING(val) (AS_STRING (val)->data)
+#define AS_F64_ARRAY(val) ((obj_f64_array *) AS_OBJ (val))
 #define AS_FUNC(val) ((obj_func *) AS_OBJ (val))
 #define AS_INSTANCE(val) ((obj_instance *) AS_OBJ (val))
+#define AS_LIST(val) ((obj_list *) AS_OBJ (val))
+#define AS_MAP(val) ((obj_map *) AS_OBJ (val))
+#define AS_MODULE(val) ((obj_module *) AS_OBJ (val))
 #define AS_NATIVE(val) (((obj_native *) AS_OBJ (val))->callback)
+#define AS_ROPE(val) ((obj_rope *) AS_OBJ (val))
 #define AS_STRING(val) ((obj_string *) AS_OBJ (val))
 
 typedef enum {
     OBJ_BOUND_METHOD,
     OBJ_CLASS,
     OBJ_CLOSURE,
+    OBJ_F64_ARRAY,
     OBJ_FUNC,
     OBJ_INSTANCE,
+    OBJ_LIST,
+    OBJ_MAP,
+    OBJ_MODULE,
     OBJ_NATIVE,
+    OBJ_ROPE,
     OBJ_STRING,
     OBJ_UPVALUE,
 } obj_type;
 
+// Not an enum member, so switches over obj_type stay exhaustive.
+#define _OBJTYPE_COUNT (OBJ_UPVALUE + 1)
+
 #define OBJ_TYPESTR(objt) (_obj_types[objt])
-extern const char *const _obj_types[];
+extern const char *const _obj_types[_OBJTYPE_COUNT];
 
+// The header is a single 32-bit word: the type in the low byte, flag bits
+// above it. Mark bits live in the heap page descriptors (see heap.h), and
+// the heap itself knows where every object is, so there is no list pointer.
+// Every object type puts a 4-byte field right after the header so the two
+// share one 8-byte slot.
 struct _obj {
-    obj_type     type;
-    bool         marked;
-    struct _obj *next;
+    uint32 header;
 };
 
+#define OBJ_TYPE_MASK 0xffu
+#define OBJ_FLAG_SHIFT 8
+
+#define OBJ_INTERNED (1u << OBJ_FLAG_SHIFT)
+
+#define OBJ_TYPEOF(object) ((obj_type) ((object)->header & OBJ_TYPE_MASK))
+#define OBJ_HAS_FLAG(object, flag) (((object)->header & (flag)) != 0)
+#define OBJ_SET_FLAG(object, flag) ((object)->header |= (flag))
+
+typedef struct _obj_module obj_module;
+
+// `module` is the module the function was compiled from, NULL for the main
+// script.
 typedef struct {
     obj         base_ref;
     int32       arity;
     int32       upvalue_count;
     chunk       chk;
     obj_string *name;
+    obj_module *module;
 } obj_func;
 
 typedef value (*native_fn) (uint8 argc, value *args);
@@ -61,13 +98,72 @@ typedef struct {
     native_fn callback;
 } obj_native;
 
+// The bytes follow the header in the same cell, NUL-terminated. `hash` is
+// only valid once the string is interned (see LAZY_INTERN).
 struct _obj_string {
     obj    base_ref;
-    size   len;
-    char  *data;
     uint32 hash;
+    size   len;
+    char   data[];
 };
 
+typedef struct {
+    obj         base_ref;
+    value_array items;
+} obj_list;
+
+typedef struct {
+    value key;
+    value val;
+} map_entry;
+
+// See map.h. `entries` and `hashes` share one allocation.
+typedef struct {
+    obj        base_ref;
+    bool       stale;
+    size       count;
+    size       capacity;
+    map_entry *entries;
+    uint32    *hashes;
+} obj_map;
+
+// A source file loaded with `import`, keyed by its canonical `path` in
+// vm.modules. Its functions look globals up in `globals`, then in the
+// builtins. `executed` is set once its body has started running, so every
+// module runs once per process and cyclic imports terminate. `body` holds
+// the top-level function of a module compiled ahead of its import until
+// the import runs it.
+struct _obj_module {
+    obj         base_ref;
+    bool        executed;
+    obj_string *path;
+    obj_func   *body;
+    table       globals;
+};
+
+// Unboxed doubles, for the bulk kernels in vec.h. The elements are kept
+// outside the heap and hold no references.
+typedef struct {
+    obj     base_ref;
+    size    count;
+    double *data;
+} obj_f64_array;
+
+typedef struct _rope_buffer rope_buffer;
+
+// A concatenation whose bytes have not been needed yet, see rope.h. Either a
+// node with two children (strings or ropes), a leaf viewing the first `len`
+// bytes of a shared buffer, or, once flattened, a forward to `flat`.
+typedef struct {
+    obj          base_ref;
+    uint32       depth;
+    size         len;
+    obj         *left;
+    obj         *right;
+    rope_buffer *buffer;
+    obj_string  *flat;
+} obj_rope;
+
 typedef struct _obj_upvalue {
     obj                  base_ref;
     value               *location;
@@ -76,17 +172,20 @@ typedef struct _obj_upvalue {
 } obj_upvalue;
 
 typedef struct {
-    obj           base_ref;
-    obj_func     *func;
-    obj_upvalue **upvalues;
-    int32         upvalue_count;
+    obj          base_ref;
+    int32        upvalue_count;
+    obj_func    *func;
+    obj_upvalue *upvalues[];
 } obj_closure;
 
 // Call variables `klass`, not `class`.
+// `init` is the initializer from `methods`, kept aside so instantiation
+// does not have to look it up.
 typedef struct {
-    obj         base_ref;
-    obj_string *name;
-    table       methods;
+    obj          base_ref;
+    obj_string  *name;
+    obj_closure *init;
+    table        methods;
 } obj_class;
 
 typedef struct {
@@ -104,11 +203,20 @@ typedef struct {
 obj_bound_method *new_bound_method (value reciever, obj_closure *closure);
 obj_class        *new_klass (obj_string *name);
 obj_instance     *new_instance (obj_class *klass);
+obj_list         *new_list (void);
+obj_map          *new_map (void);
+obj_module       *new_module (obj_string *path);
 obj_closure      *new_closure (obj_func *func);
+obj_f64_array    *new_f64_array (size count);
 obj_func         *new_func (void);
 obj_native       *new_native (native_fn callback);
-obj_string       *take_string (char *data, size len);
+obj_rope         *new_rope (size len, uint32 depth);
+obj_string       *new_string (size len);
+obj_string       *finish_string (obj_string *str);
+obj_string       *intern_string (obj_string *str);
+bool              strings_equal (obj_string *a, obj_string *b);
 obj_string       *copy_string (const char *data, size len);
+obj_string       *copy_string_hashed (const char *data, size len, uint32 hash);
 obj_upvalue      *new_upvalue (value *slot);
 void              print_object (value val);
 
@@ -0,0 +1,170 @@
+// apachejuice, 18.10.2026
+// See LICENSE for details.
+#include "rope.h"
+#include "memory.h"
+#include "vm.h"
+
+#include <stdio.h>
+#include <string.h>
+
+extern VM vm;
+
+// Backing store of buffer leaves. A leaf sees the first `len` bytes, and the
+// bytes below `used` never change, so any number of leaves can share one
+// buffer. Only the leaf that ends exactly at `used` may append to it, which
+// makes `s = s + piece` in a loop amortized linear.
+struct _rope_buffer {
+    char  *data;
+    size   capacity;
+    size   used;
+    uint32 refs;
+    uint64 counted;
+};
+
+static size text_len (obj *text) {
+    if (OBJ_TYPEOF (text) == OBJ_STRING) return ((obj_string *) text)->len;
+    return ((obj_rope *) text)->len;
+}
+
+static uint32 text_depth (obj *text) {
+    if (OBJ_TYPEOF (text) == OBJ_STRING) return 0;
+    return ((obj_rope *) text)->depth;
+}
+
+static void write_text (obj *text, char *dest) {
+    if (OBJ_TYPEOF (text) == OBJ_STRING) {
+        obj_string *str = (obj_string *) text;
+        memcpy (dest, str->data, str->len);
+        return;
+    }
+
+    obj_rope *rope = (obj_rope *) text;
+    if (rope->flat != NULL) {
+        memcpy (dest, rope->flat->data, rope->len);
+    } else if (rope->buffer != NULL) {
+        memcpy (dest, rope->buffer->data, rope->len);
+    } else {
+        size left_len = text_len (rope->left);
+        write_text (rope->left, dest);
+        write_text (rope->right, dest + left_len);
+    }
+}
+
+static void reserve_buffer (rope_buffer *buffer, size needed) {
+    if (needed <= buffer->capacity) return;
+
+    size capacity = buffer->capacity < ROPE_MIN_LEN ? ROPE_MIN_LEN
+                                                     : buffer->capacity;
+    while (capacity < needed) capacity *= 2;
+
+    buffer->data     = GROW_ARRAY (char, buffer->data, buffer->capacity,
+                                   capacity);
+    buffer->capacity = capacity;
+}
+
+static obj *new_leaf (rope_buffer *buffer, size len) {
+    obj_rope *rope = new_rope (len, 0);
+    rope->buffer   = buffer;
+    buffer->refs++;
+    return (obj *) rope;
+}
+
+obj *rope_concat (obj *a, obj *b) {
+    size len = text_len (a) + text_len (b);
+
+    if (len < ROPE_MIN_LEN) {
+        obj_string *str = new_string (len);
+        write_text (a, str->data);
+        write_text (b, str->data + text_len (a));
+        return (obj *) finish_string (str);
+    }
+
+    if (OBJ_TYPEOF (a) == OBJ_ROPE) {
+        obj_rope *rope = (obj_rope *) a;
+        if (rope->buffer != NULL && rope->buffer->used == rope->len) {
+            rope_buffer *buffer = rope->buffer;
+            reserve_buffer (buffer, len);
+            write_text (b, buffer->data + buffer->used);
+            buffer->used = len;
+
+            return new_leaf (buffer, len);
+        }
+    }
+
+    uint32 depth = text_depth (a);
+    if (text_depth (b) > depth) depth = text_depth (b);
+    depth++;
+
+    if (depth <= ROPE_MAX_DEPTH) {
+        obj_rope *rope = new_rope (len, depth);
+        rope->left     = a;
+        rope->right    = b;
+        return (obj *) rope;
+    }
+
+    // Too deep: collapse into a buffer leaf that later appends can extend.
+    rope_buffer *buffer = ALLOCATE (rope_buffer, 1);
+    buffer->data        = NULL;
+    buffer->capacity    = 0;
+    buffer->used        = 0;
+    buffer->refs        = 1;
+    buffer->counted     = 0;
+    reserve_buffer (buffer, len * 2);
+
+    write_text (a, buffer->data);
+    write_text (b, buffer->data + text_len (a));
+    buffer->used = len;
+
+    obj *leaf = new_leaf (buffer, len);
+    buffer->refs--;
+    return leaf;
+}
+
+// Returns a flat string with the contents of `rope`, building it the
+// first time. The children are dropped afterwards, the rope only forwards to
+// its flat string from then on. `rope` must be reachable from the VM stack.
+obj_string *rope_flatten (obj_rope *rope) {
+    if (rope->flat != NULL) return rope->flat;
+
+    obj_string *str = new_string (rope->len);
+    write_text ((obj *) rope, str->data);
+    rope->flat = finish_string (str);
+
+    rope_release (rope);
+    rope->left  = NULL;
+    rope->right = NULL;
+    rope->depth = 0;
+
+    return rope->flat;
+}
+
+void rope_print (obj_rope *rope) {
+    if (rope->flat != NULL) {
+        fwrite (rope->flat->data, 1, rope->len, stdout);
+    } else if (rope->buffer != NULL) {
+        fwrite (rope->buffer->data, 1, rope->len, stdout);
+    } else {
+        print_value (OBJ_VAL (rope->left));
+        print_value (OBJ_VAL (rope->right));
+    }
+}
+
+// Drops the rope's reference to its buffer, if it has one.
+void rope_release (obj_rope *rope) {
+    rope_buffer *buffer = rope->buffer;
+    if (buffer == NULL) return;
+
+    rope->buffer = NULL;
+    if (--buffer->refs > 0) return;
+
+    FREE_ARRAY (char, buffer->data, buffer->capacity);
+    FREE (rope_buffer, buffer);
+}
+
+size rope_bytes (obj_rope *rope, uint64 cycle) {
+    rope_buffer *buffer = rope->buffer;
+    if (buffer == NULL || buffer->counted == cycle) return 0;
+
+    buffer->counted = cycle;
+    return buffer->capacity + sizeof (rope_buffer);
+}
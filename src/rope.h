@@ -0,0 +1,29 @@
+// apachejuice, 18.10.2026
+// See LICENSE for details.
+#ifndef __ALOXOTL_ROPE__
+#define __ALOXOTL_ROPE__
+
+#include "common.h"
+#include "obj.h"
+
+// Concatenation results shorter than this are built as flat strings right
+// away, a rope node would not be any smaller.
+#define ROPE_MIN_LEN 64
+
+// Ropes deeper than this are collapsed into a buffer leaf, which keeps
+// flattening and printing bounded in stack depth.
+#define ROPE_MAX_DEPTH 32
+
+// Both operands must be strings or ropes, and both must be reachable from
+// the VM stack while this runs.
+obj        *rope_concat (obj *a, obj *b);
+obj_string *rope_flatten (obj_rope *rope);
+void        rope_print (obj_rope *rope);
+void        rope_release (obj_rope *rope);
+
+// The size of the buffer `rope` views, the first time it is asked for
+// during collection `cycle`, and 0 after that: a buffer shared by several
+// leaves is counted once.
+size rope_bytes (obj_rope *rope, uint64 cycle);
+
+#endif
@@ -2,7 +2,6 @@
 // See LICENSE for details.
 #include "scanner.h"
 #include "common.h"
-#include "memory.h"
 
 #include <complex.h>
 #include <stdio.h>
@@ -10,18 +9,11 @@
 #include <stdarg.h>
 #include <stdlib.h>
 
-struct {
-    const char *start;
-    const char *current;
-    size        line;
-    size        column;
-} scanner;
-
-void init_scanner (const char *source) {
-    scanner.start   = source;
-    scanner.current = source;
-    scanner.line    = 1;
-    scanner.column  = 1;
+void init_scanner (scanner_t *scanner, const char *source) {
+    scanner->start   = source;
+    scanner->current = source;
+    scanner->line    = 1;
+    scanner->column  = 1;
 }
 
 static bool is_digit (char c) {
@@ -32,86 +24,100 @@ static bool is_alpha (char c) {
     return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
 }
 
-static bool is_at_end (void) {
-    return *scanner.current == 0;
+static bool is_at_end (scanner_t *scanner) {
+    return *scanner->current == 0;
 }
 
-static token make_token (token_type type) {
+static token make_token (scanner_t *scanner, token_type type) {
     token tok = {
         .type   = type,
-        .start  = scanner.start,
-        .len    = (size) (scanner.current - scanner.start -
+        .start  = scanner->start,
+        .len    = (size) (scanner->current - scanner->start -
                        (type == TOKEN_STRING ? 1 : 0)),
-        .line   = scanner.line,
-        .column = scanner.column,
+        .line   = scanner->line,
+        .column = scanner->column,
     };
 
     return tok;
 }
 
-// IF the token's type is TOKEN_ERROR, the lexeme needs to be freed.
-static token error_token (const char *format, ...) {
+// IF the token's type is TOKEN_ERROR, the lexeme needs to be freed with
+// free (). It is allocated outside the heap, so that scanning never touches
+// the VM.
+static token error_token (scanner_t *scanner, const char *format, ...) {
+    // Scanner messages are short, so format into a fixed buffer rather than
+    // measuring with vsnprintf (NULL, 0, ...), which some GCC versions warn
+    // about under -fsanitize=undefined.
+    char    buf[128];
     va_list ap;
     va_start (ap, format);
+    int n = vsnprintf (buf, sizeof (buf), format, ap);
+    va_end (ap);
 
-    size  len = vsnprintf (NULL, 0, format, ap);
-    char *msg = reallocate (NULL, 0, len + 1);
+    if (n < 0) n = 0;
+    if (n >= (int) sizeof (buf)) n = sizeof (buf) - 1;
 
-    vsprintf (msg, format, ap);
-    va_end (ap);
+    size  len = (size) n;
+    char *msg = malloc (len + 1);
+    if (msg == NULL) exit (1);
+
+    memcpy (msg, buf, len);
+    msg[len] = '\0';
 
     token tok = {
         .type   = TOKEN_ERROR,
         .start  = msg,
         .len    = len,
-        .line   = scanner.line,
-        .column = scanner.column,
+        .line   = scanner->line,
+        .column = scanner->column,
     };
 
     return tok;
 }
 
-static char advance (void) {
-    char c = *scanner.current++;
+static char advance (scanner_t *scanner) {
+    char c = *scanner->current++;
     if (c == '\n') {
-        scanner.line++;
-        scanner.column = 1;
+        scanner->line++;
+        scanner->column = 1;
     } else {
-        scanner.column++;
+        scanner->column++;
     }
 
-    return scanner.current[-1];
+    return scanner->current[-1];
 }
 
-static char peek (void) {
-    return *scanner.current;
+static char peek (scanner_t *scanner) {
+    return *scanner->current;
 }
 
-static bool match (char expected) {
-    if (is_at_end ()) return false;
-    if (*scanner.current != expected) return false;
+static bool match (scanner_t *scanner, char expected) {
+    if (is_at_end (scanner)) return false;
+    if (*scanner->current != expected) return false;
 
-    scanner.current++;
+    scanner->current++;
     return true;
 }
 
-static char peek_next (void) {
-    if (is_at_end ()) return '\0';
-    return scanner.current[1];
+static char peek_next (scanner_t *scanner) {
+    if (is_at_end (scanner)) return '\0';
+    return scanner->current[1];
 }
 
-static void skip_whitespace (void) {
+static void skip_whitespace (scanner_t *scanner) {
     while (1) {
-        char c = peek ();
+        char c = peek (scanner);
         switch (c) {
             case ' ':
             case '\r':
             case '\n':  // handled in advance ()
-            case '\t': advance (); break;
+            case '\t': advance (scanner); break;
             case '/':
-                if (peek_next () == '/') {
+                if (peek_next (scanner) == '/') {
                     // A comment goes until the end of the line.
-                    while (peek () != '\n' && !is_at_end ()) advance ();
+                    while (peek (scanner) != '\n' && !is_at_end (scanner)) {
+                        advance (scanner);
+                    }
                 } else {
                     return;
                 }
@@ -121,114 +127,170 @@ static void skip_whitespace (void) {
     }
 }
 
-static token string (void) {
-    while (peek () != '"' && !is_at_end ()) {
-        advance ();
+static token string (scanner_t *scanner) {
+    while (peek (scanner) != '"' && !is_at_end (scanner)) {
+        advance (scanner);
     }
 
-    if (is_at_end ()) return error_token ("Unterminated string");
+    if (is_at_end (scanner)) {
+        return error_token (scanner, "Unterminated string");
+    }
 
     // The closing quote.
-    advance ();
-    return make_token (TOKEN_STRING);
+    advance (scanner);
+    return make_token (scanner, TOKEN_STRING);
 }
 
-static token number (void) {
-    while (is_digit (peek ())) advance ();
+static bool is_hex_digit (char c) {
+    return is_digit (c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+static token number (scanner_t *scanner) {
+    if (scanner->start[0] == '0' &&
+        (peek (scanner) == 'x' || peek (scanner) == 'X') &&
+        is_hex_digit (peek_next (scanner))) {
+        advance (scanner);
+        while (is_hex_digit (peek (scanner))) advance (scanner);
+
+        return make_token (scanner, TOKEN_NUMBER);
+    }
+
+    while (is_digit (peek (scanner))) advance (scanner);
 
-    if (peek () == '.' && is_digit (peek_next ())) {
-        advance ();
+    if (peek (scanner) == '.' && is_digit (peek_next (scanner))) {
+        advance (scanner);
 
-        while (is_digit (peek ())) advance ();
+        while (is_digit (peek (scanner))) advance (scanner);
     }
 
-    return make_token (TOKEN_NUMBER);
+    return make_token (scanner, TOKEN_NUMBER);
 }
 
-static token_type check_keyword (size start, size length, const char *remain,
-                                 token_type type) {
-    if ((size) (scanner.current - scanner.start) == start + length &&
-        memcmp (scanner.start + start, remain, length) == 0) {
+static token_type check_keyword (scanner_t *scanner, size start, size length,
+                                 const char *remain, token_type type) {
+    if ((size) (scanner->current - scanner->start) == start + length &&
+        memcmp (scanner->start + start, remain, length) == 0) {
         return type;
     }
 
     return TOKEN_IDENTIFIER;
 }
 
-static token_type identifier_type (void) {
-    switch (*scanner.start) {
-        case 'a': return check_keyword (1, 2, "nd", TOKEN_AND);
-        case 'c': return check_keyword (1, 4, "lass", TOKEN_CLASS);
-        case 'e': return check_keyword (1, 3, "lse", TOKEN_ELSE);
+static token_type identifier_type (scanner_t *scanner) {
+    switch (*scanner->start) {
+        case 'a': return check_keyword (scanner, 1, 2, "nd", TOKEN_AND);
+        case 'c': return check_keyword (scanner, 1, 4, "lass", TOKEN_CLASS);
+        case 'e': return check_keyword (scanner, 1, 3, "lse", TOKEN_ELSE);
         case 'f':
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
-                    case 'a': return check_keyword (2, 3, "lse", TOKEN_FALSE);
-                    case 'o': return check_keyword (2, 1, "r", TOKEN_FOR);
-                    case 'u': return check_keyword (2, 1, "n", TOKEN_FUN);
+            if (scanner->current - scanner->start > 1) {
+                switch (scanner->start[1]) {
+                    case 'a':
+                        return check_keyword (scanner, 2, 3, "lse",
+                                              TOKEN_FALSE);
+                    case 'o':
+                        return check_keyword (scanner, 2, 1, "r", TOKEN_FOR);
+                    case 'u':
+                        return check_keyword (scanner, 2, 1, "n", TOKEN_FUN);
                 }
             }
 
             break;
-        case 'i': return check_keyword (1, 1, "f", TOKEN_IF);
-        case 'n': return check_keyword (1, 2, "il", TOKEN_NIL);
-        case 'o': return check_keyword (1, 1, "r", TOKEN_OR);
-        case 'p': return check_keyword (1, 4, "rint", TOKEN_PRINT);
-        case 'r': return check_keyword (1, 5, "eturn", TOKEN_RETURN);
-        case 's': return check_keyword (1, 4, "uper", TOKEN_SUPER);
+        case 'i':
+            if (scanner->current - scanner->start > 1) {
+                switch (scanner->start[1]) {
+                    case 'f':
+                        return check_keyword (scanner, 2, 0, "", TOKEN_IF);
+                    case 'm':
+                        return check_keyword (scanner, 2, 4, "port",
+                                              TOKEN_IMPORT);
+                }
+            }
+
+            break;
+        case 'n': return check_keyword (scanner, 1, 2, "il", TOKEN_NIL);
+        case 'o': return check_keyword (scanner, 1, 1, "r", TOKEN_OR);
+        case 'p': return check_keyword (scanner, 1, 4, "rint", TOKEN_PRINT);
+        case 'r': return check_keyword (scanner, 1, 5, "eturn", TOKEN_RETURN);
+        case 's': return check_keyword (scanner, 1, 4, "uper", TOKEN_SUPER);
         case 't':
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
-                    case 'h': return check_keyword (2, 2, "is", TOKEN_THIS);
-                    case 'r': return check_keyword (2, 2, "ue", TOKEN_TRUE);
+            if (scanner->current - scanner->start > 1) {
+                switch (scanner->start[1]) {
+                    case 'h':
+                        return check_keyword (scanner, 2, 2, "is", TOKEN_THIS);
+                    case 'r':
+                        return check_keyword (scanner, 2, 2, "ue", TOKEN_TRUE);
                 }
             }
 
             break;
-        case 'v': return check_keyword (1, 2, "ar", TOKEN_VAR);
-        case 'w': return check_keyword (1, 4, "hile", TOKEN_WHILE);
+        case 'v': return check_keyword (scanner, 1, 2, "ar", TOKEN_VAR);
+        case 'w': return check_keyword (scanner, 1, 4, "hile", TOKEN_WHILE);
     }
 
     return TOKEN_IDENTIFIER;
 }
 
-static token identifier (void) {
-    while (is_alpha (peek ()) || is_digit (peek ())) advance ();
-    return make_token (identifier_type ());
+static token identifier (scanner_t *scanner) {
+    while (is_alpha (peek (scanner)) || is_digit (peek (scanner))) {
+        advance (scanner);
+    }
+
+    return make_token (scanner, identifier_type (scanner));
 }
 
-token scan_token (void) {
-    skip_whitespace ();
-    scanner.start = scanner.current;
-    if (is_at_end ()) return make_token (TOKEN_EOF);
+token scan_token (scanner_t *scanner) {
+    skip_whitespace (scanner);
+    scanner->start = scanner->current;
+    if (is_at_end (scanner)) return make_token (scanner, TOKEN_EOF);
 
-    char c = advance ();
-    if (is_alpha (c)) return identifier ();
-    if (is_digit (c)) return number ();
+    char c = advance (scanner);
+    if (is_alpha (c)) return identifier (scanner);
+    if (is_digit (c)) return number (scanner);
 
     switch (c) {
-        case '(': return make_token (TOKEN_LEFT_PAREN);
-        case ')': return make_token (TOKEN_RIGHT_PAREN);
-        case '{': return make_token (TOKEN_LEFT_BRACE);
-        case '}': return make_token (TOKEN_RIGHT_BRACE);
-        case ';': return make_token (TOKEN_SEMICOLON);
-        case ',': return make_token (TOKEN_COMMA);
-        case '.': return make_token (TOKEN_DOT);
-        case '-': return make_token (TOKEN_MINUS);
-        case '+': return make_token (TOKEN_PLUS);
-        case '/': return make_token (TOKEN_SLASH);
-        case '*': return make_token (TOKEN_STAR);
+        case '(': return make_token (scanner, TOKEN_LEFT_PAREN);
+        case ')': return make_token (scanner, TOKEN_RIGHT_PAREN);
+        case '{': return make_token (scanner, TOKEN_LEFT_BRACE);
+        case '}': return make_token (scanner, TOKEN_RIGHT_BRACE);
+        case '[': return make_token (scanner, TOKEN_LEFT_BRACKET);
+        case ']': return make_token (scanner, TOKEN_RIGHT_BRACKET);
+        case ';': return make_token (scanner, TOKEN_SEMICOLON);
+        case ',': return make_token (scanner, TOKEN_COMMA);
+        case '.': return make_token (scanner, TOKEN_DOT);
+        case '-': return make_token (scanner, TOKEN_MINUS);
+        case '+': return make_token (scanner, TOKEN_PLUS);
+        case '/': return make_token (scanner, TOKEN_SLASH);
+        case '*': return make_token (scanner, TOKEN_STAR);
+        case '%': return make_token (scanner, TOKEN_PERCENT);
+        case '&': return make_token (scanner, TOKEN_AMPERSAND);
+        case '|': return make_token (scanner, TOKEN_PIPE);
+        case '^': return make_token (scanner, TOKEN_CARET);
+        case '~':
+            return make_token (scanner, match (scanner, '/') ? TOKEN_TILDE_SLASH
+                                                             : TOKEN_TILDE);
         case '!':
-            return make_token (match ('=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
+            return make_token (scanner, match (scanner, '=') ? TOKEN_BANG_EQUAL
+                                                             : TOKEN_BANG);
         case '=':
-            return make_token (match ('=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
+            return make_token (scanner, match (scanner, '=') ? TOKEN_EQUAL_EQUAL
+                                                             : TOKEN_EQUAL);
         case '<':
-            return make_token (match ('=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
+            if (match (scanner, '<')) {
+                return make_token (scanner, TOKEN_LESS_LESS);
+            }
+
+            return make_token (scanner, match (scanner, '=') ? TOKEN_LESS_EQUAL
+                                                             : TOKEN_LESS);
         case '>':
-            return make_token (match ('=') ? TOKEN_GREATER_EQUAL
-                                           : TOKEN_GREATER);
-        case '"': return string ();
+            if (match (scanner, '>')) {
+                return make_token (scanner, TOKEN_GREATER_GREATER);
+            }
+
+            return make_token (scanner, match (scanner, '=')
+                                            ? TOKEN_GREATER_EQUAL
+                                            : TOKEN_GREATER);
+        case '"': return string (scanner);
     }
 
-    return error_token ("Unexpected character %c", *scanner.current);
+    return error_token (scanner, "Unexpected character %c", *scanner->current);
 }
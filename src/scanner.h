@@ -10,6 +10,8 @@ typedef enum {
     TOKEN_RIGHT_PAREN,
     TOKEN_LEFT_BRACE,
     TOKEN_RIGHT_BRACE,
+    TOKEN_LEFT_BRACKET,
+    TOKEN_RIGHT_BRACKET,
     TOKEN_COMMA,
     TOKEN_DOT,
     TOKEN_MINUS,
@@ -17,6 +19,10 @@ typedef enum {
     TOKEN_SEMICOLON,
     TOKEN_SLASH,
     TOKEN_STAR,
+    TOKEN_PERCENT,
+    TOKEN_AMPERSAND,
+    TOKEN_PIPE,
+    TOKEN_CARET,
     // One or two character tokens.
     TOKEN_BANG,
     TOKEN_BANG_EQUAL,
@@ -26,6 +32,10 @@ typedef enum {
     TOKEN_GREATER_EQUAL,
     TOKEN_LESS,
     TOKEN_LESS_EQUAL,
+    TOKEN_LESS_LESS,
+    TOKEN_GREATER_GREATER,
+    TOKEN_TILDE,
+    TOKEN_TILDE_SLASH,
     // Literals.
     TOKEN_IDENTIFIER,
     TOKEN_STRING,
@@ -38,6 +48,7 @@ typedef enum {
     TOKEN_FOR,
     TOKEN_FUN,
     TOKEN_IF,
+    TOKEN_IMPORT,
     TOKEN_NIL,
     TOKEN_OR,
     TOKEN_PRINT,
@@ -60,7 +71,16 @@ typedef struct {
     size        column;
 } token;
 
-void  init_scanner (const char *source);
-token scan_token (void);
+// All scanning state lives here, so any number of scanners can run at once,
+// on any thread.
+typedef struct {
+    const char *start;
+    const char *current;
+    size        line;
+    size        column;
+} scanner_t;
+
+void  init_scanner (scanner_t *scanner, const char *source);
+token scan_token (scanner_t *scanner);
 
 #endif
@@ -3,94 +3,224 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "heap.h"
 #include "memory.h"
 #include "obj.h"
 #include "table.h"
 #include "value.h"
 
-#define TABLE_MAX_LOAD 0.75
+// Grow once more than 7/8 of the slots are used.
+#define TABLE_MAX_LOAD(capacity) ((capacity) - (capacity) / 8)
+
+#define CTRL_EMPTY 0x80
+#define CTRL_DELETED 0xfe
+
+// Slot and control byte of every entry share one block.
+#define TABLE_SLOT_SIZE (sizeof (table_entry) + 1)
+
+#define IS_SMALL(tab) ((tab)->ctrl == NULL)
 
 struct _table_entry {
     obj_string *key;
     value       val;
 };
 
+static inline uint8 hash_bits (uint32 hash) {
+    return hash & 0x7f;
+}
+
+static inline size home_group (uint32 hash, size groups) {
+    return (hash >> 7) & (groups - 1);
+}
+
+// Bit i is set if control byte i of the group equals `byte`.
+static inline uint32 group_match (const uint8 *group, uint8 byte) {
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128 ((const __m128i *) group);
+    return (uint32) _mm_movemask_epi8 (
+        _mm_cmpeq_epi8 (ctrl, _mm_set1_epi8 ((char) byte)));
+#else
+    uint32 mask = 0;
+    for (int i = 0; i < TABLE_GROUP; i++) {
+        if (group[i] == byte) mask |= 1u << i;
+    }
+
+    return mask;
+#endif
+}
+
+// Bit i is set if slot i of the group is empty or deleted, both of which
+// have the high bit set.
+static inline uint32 group_free (const uint8 *group) {
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128 ((const __m128i *) group);
+    return (uint32) _mm_movemask_epi8 (ctrl);
+#else
+    uint32 mask = 0;
+    for (int i = 0; i < TABLE_GROUP; i++) {
+        if (group[i] & 0x80) mask |= 1u << i;
+    }
+
+    return mask;
+#endif
+}
+
+// Groups are probed triangularly, which visits every group once when the
+// group count is a power of two.
+#define FOR_EACH_GROUP(tab, hash, group)                                  \
+    for (size _groups = (tab)->capacity / TABLE_GROUP,                    \
+              _probe  = 0,                                                \
+              group   = home_group (hash, _groups);                       \
+         _probe < _groups;                                                \
+         _probe++, group = (group + _probe) & (_groups - 1))
+
 void init_table (table *tab) {
     tab->count    = 0;
+    tab->used     = 0;
     tab->capacity = 0;
+    tab->ctrl     = NULL;
     tab->entries  = NULL;
 }
 
+static size block_size (const table *tab) {
+    if (IS_SMALL (tab)) return tab->capacity * sizeof (table_entry);
+    return tab->capacity * TABLE_SLOT_SIZE;
+}
+
+static inline bool is_live (const table *tab, size slot) {
+    if (IS_SMALL (tab)) return slot < tab->count;
+    return !(tab->ctrl[slot] & 0x80);
+}
+
 void free_table (table *tab) {
-    FREE_ARRAY (table_entry, tab->entries, tab->capacity);
+    FREE_ARRAY (uint8, tab->entries, block_size (tab));
     init_table (tab);
 }
 
-static table_entry *find_entry (table_entry *entries, size capacity,
-                                obj_string *key) {
-    uint32       index     = key->hash % capacity;
-    table_entry *tombstone = NULL;
-
-    while (1) {
-        table_entry *entry = &entries[index];
-        if (entry->key == NULL) {
-            if (IS_NIL (entry->val)) {
-                return tombstone != NULL ? tombstone : entry;
-            } else {
-                if (tombstone == NULL) tombstone = entry;
-            }
-        } else if (entry->key == key) {
-            return entry;
+size table_bytes (const table *tab) {
+    return block_size (tab);
+}
+
+static table_entry *find_entry (table *tab, obj_string *key) {
+    if (IS_SMALL (tab)) {
+        for (size i = 0; i < tab->count; i++) {
+            if (tab->entries[i].key == key) return &tab->entries[i];
+        }
+
+        return NULL;
+    }
+
+    uint8 bits = hash_bits (key->hash);
+
+    FOR_EACH_GROUP (tab, key->hash, group) {
+        const uint8 *ctrl = tab->ctrl + group * TABLE_GROUP;
+        for (uint32 match = group_match (ctrl, bits); match;
+             match &= match - 1) {
+            table_entry *entry =
+                &tab->entries[group * TABLE_GROUP + __builtin_ctz (match)];
+            if (entry->key == key) return entry;
         }
 
-        index = (index + 1) % capacity;
+        if (group_match (ctrl, CTRL_EMPTY)) return NULL;
     }
+
+    return NULL;
+}
+
+// The first empty or deleted slot on the probe sequence of `hash`.
+static size find_free_slot (table *tab, uint32 hash) {
+    FOR_EACH_GROUP (tab, hash, group) {
+        uint32 avail = group_free (tab->ctrl + group * TABLE_GROUP);
+        if (avail) return group * TABLE_GROUP + __builtin_ctz (avail);
+    }
+
+    return 0;  // Unreachable, the load limit leaves free slots.
 }
 
 static void adjust_capacity (table *tab, size capacity) {
-    table_entry *entries = ALLOCATE (table_entry, capacity);
-    for (size i = 0; i < capacity; i++) {
-        entries[i].key = NULL;
-        entries[i].val = NIL_VAL ();
+    bool   small     = capacity <= TABLE_SMALL;
+    size   slot_size = small ? sizeof (table_entry) : TABLE_SLOT_SIZE;
+    uint8 *block     = ALLOCATE (uint8, capacity * slot_size);
+
+    // The allocation may have collected, so only read the old slots now.
+    table old     = *tab;
+    tab->count    = 0;
+    tab->used     = 0;
+    tab->capacity = capacity;
+    tab->entries  = (table_entry *) block;
+    tab->ctrl     = NULL;
+
+    if (!small) {
+        tab->ctrl = block + capacity * sizeof (table_entry);
+        memset (tab->ctrl, CTRL_EMPTY, capacity);
     }
 
-    tab->count = 0;
-    for (size i = 0; i < tab->capacity; i++) {
-        table_entry *entry = &tab->entries[i];
-        if (entry->key == NULL) continue;
+    for (size i = 0; i < old.capacity; i++) {
+        if (!is_live (&old, i)) continue;
 
-        table_entry *dest = find_entry (entries, capacity, entry->key);
-        dest->key         = entry->key;
-        dest->val         = entry->val;
+        table_entry *entry = &old.entries[i];
+        size         slot  = tab->count;
+        if (!small) {
+            slot            = find_free_slot (tab, entry->key->hash);
+            tab->ctrl[slot] = hash_bits (entry->key->hash);
+        }
 
+        tab->entries[slot] = *entry;
         tab->count++;
+        tab->used++;
     }
 
-    FREE_ARRAY (table_entry, tab->entries, tab->capacity);
-    tab->entries  = entries;
-    tab->capacity = capacity;
+    FREE_ARRAY (uint8, old.entries, block_size (&old));
+}
+
+static size grown_capacity (table *tab) {
+    if (tab->capacity == 0) return 2;
+    if (IS_SMALL (tab)) {
+        return tab->capacity < TABLE_SMALL ? tab->capacity * 2 : TABLE_GROUP;
+    }
+
+    // Mostly tombstones: rehashing in place is enough.
+    if (tab->count + 1 <= tab->capacity / 2) return tab->capacity;
+    return tab->capacity * 2;
 }
 
 bool set_table (table *tab, obj_string *key, value val) {
-    if (tab->count + 1 > tab->capacity * TABLE_MAX_LOAD) {
-        size cap = GROW_CAPACITY (tab->capacity);
-        adjust_capacity (tab, cap);
+    if (tab->capacity != 0) {
+        table_entry *entry = find_entry (tab, key);
+        if (entry != NULL) {
+            entry->val = val;
+            return false;
+        }
     }
 
-    table_entry *entry  = find_entry (tab->entries, tab->capacity, key);
-    bool         is_new = entry->key == NULL;
-    if (is_new && IS_NIL (entry->val)) tab->count++;
+    size limit =
+        IS_SMALL (tab) ? tab->capacity : TABLE_MAX_LOAD (tab->capacity);
+    if (tab->used + 1 > limit) adjust_capacity (tab, grown_capacity (tab));
 
-    entry->key = key;
-    entry->val = val;
-    return is_new;
+    size slot = tab->count;
+    if (!IS_SMALL (tab)) {
+        slot = find_free_slot (tab, key->hash);
+        if (tab->ctrl[slot] == CTRL_EMPTY) tab->used++;
+        tab->ctrl[slot] = hash_bits (key->hash);
+    } else {
+        tab->used++;
+    }
+
+    tab->entries[slot].key = key;
+    tab->entries[slot].val = val;
+    tab->count++;
+    return true;
 }
 
 bool get_table (table *tab, obj_string *key, value *val) {
     if (tab->count == 0) return false;
 
-    table_entry *entry = find_entry (tab->entries, tab->capacity, key);
-    if (entry->key == NULL) return false;
+    table_entry *entry = find_entry (tab, key);
+    if (entry == NULL) return false;
 
     *val = entry->val;
     return true;
@@ -98,55 +228,95 @@ bool get_table (table *tab, obj_string *key, value *val) {
 
 void add_all_table (table *from, table *to) {
     for (size i = 0; i < from->capacity; i++) {
-        table_entry *entry = &from->entries[i];
-        if (entry->key != NULL) {
-            set_table (to, entry->key, entry->val);
-        }
+        if (!is_live (from, i)) continue;
+        set_table (to, from->entries[i].key, from->entries[i].val);
     }
 }
 
-bool delete_table (table *tab, obj_string *key) {
-    if (tab->count == 0) return false;
+// Steps `*slot` to the next live entry, starting from 0. Returns false once
+// there are none left. The table must not change during the walk.
+bool table_next (table *tab, size *slot, obj_string **key, value *val) {
+    for (; *slot < tab->capacity; (*slot)++) {
+        if (!is_live (tab, *slot)) continue;
 
-    table_entry *entry = find_entry (tab->entries, tab->capacity, key);
-    if (entry->key == NULL) return false;
+        *key = tab->entries[*slot].key;
+        *val = tab->entries[*slot].val;
+        (*slot)++;
+        return true;
+    }
 
-    entry->key = NULL;
-    entry->val = BOOL_VAL (true);
-    return true;
+    return false;
 }
 
-obj_string *table_find_string (table *tab, const char *data, size len,
-                               uint32 hash) {
-    if (tab->count == 0) return NULL;
+// Once a table is down to a quarter of its capacity, it is rebuilt at the
+// smallest size that leaves it half full, or in the dense layout.
+static void shrink (table *tab) {
+    if (tab->capacity <= TABLE_SMALL || tab->count * 4 >= tab->capacity) {
+        return;
+    }
 
-    uint32 index = hash % tab->capacity;
-    while (1) {
-        table_entry *entry = &tab->entries[index];
-        if (entry->key == NULL) {
-            if (IS_NIL (entry->val)) return NULL;
-        } else if (entry->key->len == len && entry->key->hash == hash &&
-                   memcmp (entry->key->data, data, len) == 0) {
-            return entry->key;
-        }
+    size capacity = TABLE_GROUP;
+    if (tab->count <= TABLE_SMALL / 2) {
+        capacity = TABLE_SMALL;
+    } else {
+        while (capacity < tab->count * 2) capacity *= 2;
+    }
+
+    adjust_capacity (tab, capacity);
+}
+
+bool delete_table (table *tab, obj_string *key) {
+    if (tab->count == 0) return false;
+
+    table_entry *entry = find_entry (tab, key);
+    if (entry == NULL) return false;
 
-        index = (index + 1) % tab->capacity;
+    if (IS_SMALL (tab)) {
+        *entry = tab->entries[--tab->count];
+        tab->used--;
+        return true;
     }
+
+    size         slot  = (size) (entry - tab->entries);
+    const uint8 *group = tab->ctrl + slot / TABLE_GROUP * TABLE_GROUP;
+
+    // Empty slots are never created outside a rehash, so a group that
+    // still has one was never full, and no probe went past it. The slot can
+    // become empty again instead of a tombstone.
+    if (group_match (group, CTRL_EMPTY)) {
+        tab->ctrl[slot] = CTRL_EMPTY;
+        tab->used--;
+    } else {
+        tab->ctrl[slot] = CTRL_DELETED;
+    }
+
+    entry->key = NULL;
+    entry->val = NIL_VAL ();
+    tab->count--;
+
+    shrink (tab);
+    return true;
 }
 
 void mark_table (table *tab) {
     for (size i = 0; i < tab->capacity; i++) {
+        if (!is_live (tab, i)) continue;
+
         table_entry *entry = &tab->entries[i];
         mark_object ((obj *) entry->key);
         mark_value (entry->val);
     }
 }
 
-void table_remove_white (table *tab) {
+// Keys keep their hashes when they move, so every entry stays in its slot.
+void relocate_table (table *tab) {
     for (size i = 0; i < tab->capacity; i++) {
+        if (!is_live (tab, i)) continue;
+
         table_entry *entry = &tab->entries[i];
-        if (entry->key && !entry->key->base_ref.marked) {
-            delete_table (tab, entry->key);
+        entry->key = (obj_string *) heap_forward ((obj *) entry->key);
+        if (IS_OBJ (entry->val)) {
+            entry->val.as.o = heap_forward (AS_OBJ (entry->val));
         }
     }
 }
@@ -7,21 +7,35 @@
 
 typedef struct _table_entry table_entry;
 
+// Up to TABLE_SMALL entries are kept densely in `entries[0..count)` and
+// found by comparing key pointers, with no control bytes (`ctrl` is NULL).
+// Past that the table switches to open addressing in groups of TABLE_GROUP
+// slots. Each slot has a control byte, kept in a separate array: empty,
+// deleted, or the low 7 bits of the key's hash. A lookup compares a whole
+// group of control bytes at once and only looks at the entries whose bits
+// match. `used` counts deleted slots too, since they lengthen probes just
+// like live ones. Tables shrink again, down to the dense layout, once most
+// of their entries are deleted.
+#define TABLE_SMALL 8
+#define TABLE_GROUP 16
+
 typedef struct {
     size         count;
+    size         used;
     size         capacity;
+    uint8       *ctrl;
     table_entry *entries;
 } table;
 
-void        init_table (table *tab);
-void        free_table (table *tab);
-bool        set_table (table *tab, obj_string *key, value val);
-bool        get_table (table *tab, obj_string *key, value *val);
-bool        delete_table (table *tab, obj_string *key);
-void        add_all_table (table *from, table *to);
-obj_string *table_find_string (table *tab, const char *data, size len,
-                               uint32 hash);
-void        table_remove_white (table *tab);
-void        mark_table (table *tab);
+void init_table (table *tab);
+void free_table (table *tab);
+size table_bytes (const table *tab);
+bool set_table (table *tab, obj_string *key, value val);
+bool get_table (table *tab, obj_string *key, value *val);
+bool delete_table (table *tab, obj_string *key);
+void add_all_table (table *from, table *to);
+bool table_next (table *tab, size *slot, obj_string **key, value *val);
+void mark_table (table *tab);
+void relocate_table (table *tab);
 
 #endif
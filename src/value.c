@@ -4,12 +4,14 @@
 #include "memory.h"
 #include "obj.h"
 
+#include <inttypes.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 
 const char *const _value_names[] = {
     "bool",
+    "int",
     "nil",
     "number",
     "object",
@@ -44,6 +46,7 @@ void free_value_array (value_array *array) {
 void print_value (value val) {
     switch (val.type) {
         case VALUE_BOOL: printf (AS_BOOL (val) ? "true" : "false"); break;
+        case VALUE_INT: printf ("%" PRId64, AS_INT (val)); break;
         case VALUE_NIL: printf ("<nil>"); break;
         case VALUE_NUMBER: printf ("%g", AS_NUMBER (val)); break;
         case VALUE_OBJ: print_object (val); break;
@@ -52,16 +55,34 @@ void print_value (value val) {
 
 #pragma GCC diagnostic pop
 
+// Whether `d` is exactly the integer `i`. Comparing (double) i == d alone
+// would round `i` first.
+bool int_equals_double (int64 i, double d) {
+    return d >= -0x1p63 && d < 0x1p63 && (int64) d == i && (double) i == d;
+}
+
 bool values_equal (value a, value b) {
     if (a.type != b.type) {
+        if (IS_INT (a) && IS_NUMBER (b)) {
+            return int_equals_double (AS_INT (a), AS_NUMBER (b));
+        } else if (IS_NUMBER (a) && IS_INT (b)) {
+            return int_equals_double (AS_INT (b), AS_NUMBER (a));
+        }
+
         return false;
     }
 
     switch (a.type) {
         case VALUE_BOOL: return AS_BOOL (a) == AS_BOOL (b);
         case VALUE_NIL: return true;
+        case VALUE_INT: return AS_INT (a) == AS_INT (b);
         case VALUE_NUMBER: return AS_NUMBER (a) == AS_NUMBER (b);
-        case VALUE_OBJ: return AS_OBJ (a) == AS_OBJ (b);
+        case VALUE_OBJ:
+            if (IS_STRING (a) && IS_STRING (b)) {
+                return strings_equal (AS_STRING (a), AS_STRING (b));
+            }
+
+            return AS_OBJ (a) == AS_OBJ (b);
 
         default: return false;
     }
@@ -10,6 +10,7 @@ typedef struct _obj_string obj_string;
 
 typedef enum {
     VALUE_BOOL,
+    VALUE_INT,
     VALUE_NIL,
     VALUE_NUMBER,
     VALUE_OBJ,
@@ -21,23 +22,27 @@ typedef struct _v {
     value_type type;
     union {
         bool   b;
+        int64  i;
         double n;
         obj   *o;
     } as;
 } value;
 
-#define VALUE_TYPESTR(val)                                    \
-    (val.type == VALUE_OBJ ? OBJ_TYPESTR (AS_OBJ (val)->type) \
+#define VALUE_TYPESTR(val)                                        \
+    (val.type == VALUE_OBJ ? OBJ_TYPESTR (OBJ_TYPEOF (AS_OBJ (val))) \
                            : _value_names[val.type])
 extern const char *const _value_names[_VALUETYPE_COUNT];
 
 #define IS_BOOL(val) ((val).type == VALUE_BOOL)
+#define IS_INT(val) ((val).type == VALUE_INT)
 #define IS_NIL(val) ((val).type == VALUE_NIL)
 #define IS_NUMBER(val) ((val).type == VALUE_NUMBER)
+#define IS_NUMERIC(val) (IS_INT (val) || IS_NUMBER (val))
 #define IS_OBJ(val) ((val).type == VALUE_OBJ)
 
 // struct _v because passing *_VAL(value) is an error
 #define BOOL_VAL(val) ((struct _v){.type = VALUE_BOOL, .as = {.b = val}})
+#define INT_VAL(val) ((struct _v){.type = VALUE_INT, .as = {.i = val}})
 #define NIL_VAL() ((struct _v){.type = VALUE_NIL, .as = {.n = 0}})
 #define NUMBER_VAL(val) ((struct _v){.type = VALUE_NUMBER, .as = {.n = val}})
 // This macro has '.o = (obj *) val' in the book.
@@ -47,7 +52,10 @@ extern const char *const _value_names[_VALUETYPE_COUNT];
 #define OBJ_VAL(val) ((struct _v){.type = VALUE_OBJ, .as = {.o = val}})
 
 #define AS_BOOL(val) ((val).as.b)
+#define AS_INT(val) ((val).as.i)
 #define AS_NUMBER(val) ((val).as.n)
+// Either kind of number, as a double.
+#define AS_FLOAT(val) (IS_INT (val) ? (double) AS_INT (val) : AS_NUMBER (val))
 #define AS_OBJ(val) ((val).as.o)
 
 typedef struct {
@@ -57,6 +65,7 @@ typedef struct {
 } value_array;
 
 bool values_equal (value a, value b);
+bool int_equals_double (int64 i, double d);
 
 void init_value_array (value_array *array);
 void write_value_array (value_array *array, value val);
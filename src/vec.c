@@ -0,0 +1,584 @@
+// apachejuice, 18.10.2026
+// See LICENSE for details.
+#include "vec.h"
+#include "common.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define VEC_X86
+#endif
+
+// Below this many elements sorting is done by insertion.
+#define VEC_SORT_SMALL 64
+
+// The per-ISA parts. Reductions only see whole blocks of VEC_LANES elements
+// and accumulate lane i of each block into acc[i]; elementwise kernels and
+// the prefix sum get the whole array. Min and max return whether they saw a
+// NaN, since the vector min/max instructions drop them.
+typedef struct {
+    void (*sum) (double *acc, const double *x, size blocks);
+    void (*dot) (double *acc, const double *x, const double *y, size blocks);
+    bool (*min) (double *acc, const double *x, size blocks);
+    bool (*max) (double *acc, const double *x, size blocks);
+    void (*axpy) (double a, const double *x, double *y, size n);
+    void (*add) (double *out, const double *x, const double *y, size n);
+    void (*mul) (double *out, const double *x, const double *y, size n);
+    void (*prefix_sum) (double *out, const double *x, size n);
+} vec_impl;
+
+static void sum_scalar (double *acc, const double *x, size blocks) {
+    for (size b = 0; b < blocks; b++, x += VEC_LANES) {
+        for (int l = 0; l < VEC_LANES; l++) acc[l] += x[l];
+    }
+}
+
+static void dot_scalar (double *acc, const double *x, const double *y,
+                        size blocks) {
+    for (size b = 0; b < blocks; b++, x += VEC_LANES, y += VEC_LANES) {
+        for (int l = 0; l < VEC_LANES; l++) acc[l] += x[l] * y[l];
+    }
+}
+
+// Written as `x < acc ? x : acc` to pick the same operand as minpd on ties
+// between zeros.
+static bool min_scalar (double *acc, const double *x, size blocks) {
+    bool nan = false;
+    for (size b = 0; b < blocks; b++, x += VEC_LANES) {
+        for (int l = 0; l < VEC_LANES; l++) {
+            nan    |= x[l] != x[l];
+            acc[l]  = x[l] < acc[l] ? x[l] : acc[l];
+        }
+    }
+
+    return nan;
+}
+
+static bool max_scalar (double *acc, const double *x, size blocks) {
+    bool nan = false;
+    for (size b = 0; b < blocks; b++, x += VEC_LANES) {
+        for (int l = 0; l < VEC_LANES; l++) {
+            nan    |= x[l] != x[l];
+            acc[l]  = x[l] > acc[l] ? x[l] : acc[l];
+        }
+    }
+
+    return nan;
+}
+
+static void axpy_scalar (double a, const double *x, double *y, size n) {
+    for (size i = 0; i < n; i++) y[i] += a * x[i];
+}
+
+static void add_scalar (double *out, const double *x, const double *y,
+                        size n) {
+    for (size i = 0; i < n; i++) out[i] = x[i] + y[i];
+}
+
+static void mul_scalar (double *out, const double *x, const double *y,
+                        size n) {
+    for (size i = 0; i < n; i++) out[i] = x[i] * y[i];
+}
+
+// Groups of four are scanned the way the vector code does it, by adding the
+// group shifted by one and then by two elements, before the running total is
+// added.
+static void prefix_sum_scalar (double *out, const double *x, size n) {
+    double carry = 0.0;
+    size   i     = 0;
+    for (; i + 4 <= n; i += 4) {
+        double p0 = x[i] + 0.0, p1 = x[i + 1] + x[i];
+        double p2 = x[i + 2] + x[i + 1], p3 = x[i + 3] + x[i + 2];
+
+        out[i]     = (p0 + 0.0) + carry;
+        out[i + 1] = (p1 + 0.0) + carry;
+        out[i + 2] = (p2 + p0) + carry;
+        out[i + 3] = (p3 + p1) + carry;
+        carry      = out[i + 3];
+    }
+
+    for (; i < n; i++) {
+        carry  += x[i];
+        out[i]  = carry;
+    }
+}
+
+static const vec_impl vec_scalar = {
+    sum_scalar, dot_scalar, min_scalar, max_scalar,
+    axpy_scalar, add_scalar, mul_scalar, prefix_sum_scalar,
+};
+
+#ifdef VEC_X86
+#define SSE2_REGS (VEC_LANES / 2)
+
+static void sum_sse2 (double *acc, const double *x, size blocks) {
+    __m128d a[SSE2_REGS];
+    for (int r = 0; r < SSE2_REGS; r++) a[r] = _mm_loadu_pd (acc + 2 * r);
+
+    for (size b = 0; b < blocks; b++, x += VEC_LANES) {
+        for (int r = 0; r < SSE2_REGS; r++) {
+            a[r] = _mm_add_pd (a[r], _mm_loadu_pd (x + 2 * r));
+        }
+    }
+
+    for (int r = 0; r < SSE2_REGS; r++) _mm_storeu_pd (acc + 2 * r, a[r]);
+}
+
+static void dot_sse2 (double *acc, const double *x, const double *y,
+                      size blocks) {
+    __m128d a[SSE2_REGS];
+    for (int r = 0; r < SSE2_REGS; r++) a[r] = _mm_loadu_pd (acc + 2 * r);
+
+    for (size b = 0; b < blocks; b++, x += VEC_LANES, y += VEC_LANES) {
+        for (int r = 0; r < SSE2_REGS; r++) {
+            __m128d prod =
+                _mm_mul_pd (_mm_loadu_pd (x + 2 * r), _mm_loadu_pd (y + 2 * r));
+            a[r] = _mm_add_pd (a[r], prod);
+        }
+    }
+
+    for (int r = 0; r < SSE2_REGS; r++) _mm_storeu_pd (acc + 2 * r, a[r]);
+}
+
+static bool min_sse2 (double *acc, const double *x, size blocks) {
+    __m128d a[SSE2_REGS];
+    __m128d nan = _mm_setzero_pd ();
+    for (int r = 0; r < SSE2_REGS; r++) a[r] = _mm_loadu_pd (acc + 2 * r);
+
+    for (size b = 0; b < blocks; b++, x += VEC_LANES) {
+        for (int r = 0; r < SSE2_REGS; r++) {
+            __m128d v = _mm_loadu_pd (x + 2 * r);
+            nan       = _mm_or_pd (nan, _mm_cmpunord_pd (v, v));
+            a[r]      = _mm_min_pd (v, a[r]);
+        }
+    }
+
+    for (int r = 0; r < SSE2_REGS; r++) _mm_storeu_pd (acc + 2 * r, a[r]);
+    return _mm_movemask_pd (nan) != 0;
+}
+
+static bool max_sse2 (double *acc, const double *x, size blocks) {
+    __m128d a[SSE2_REGS];
+    __m128d nan = _mm_setzero_pd ();
+    for (int r = 0; r < SSE2_REGS; r++) a[r] = _mm_loadu_pd (acc + 2 * r);
+
+    for (size b = 0; b < blocks; b++, x += VEC_LANES) {
+        for (int r = 0; r < SSE2_REGS; r++) {
+            __m128d v = _mm_loadu_pd (x + 2 * r);
+            nan       = _mm_or_pd (nan, _mm_cmpunord_pd (v, v));
+            a[r]      = _mm_max_pd (v, a[r]);
+        }
+    }
+
+    for (int r = 0; r < SSE2_REGS; r++) _mm_storeu_pd (acc + 2 * r, a[r]);
+    return _mm_movemask_pd (nan) != 0;
+}
+
+static void axpy_sse2 (double a, const double *x, double *y, size n) {
+    __m128d va = _mm_set1_pd (a);
+    size    i  = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d prod = _mm_mul_pd (va, _mm_loadu_pd (x + i));
+        _mm_storeu_pd (y + i, _mm_add_pd (_mm_loadu_pd (y + i), prod));
+    }
+
+    axpy_scalar (a, x + i, y + i, n - i);
+}
+
+static void add_sse2 (double *out, const double *x, const double *y,
+                      size n) {
+    size i = 0;
+    for (; i + 2 <= n; i += 2) {
+        _mm_storeu_pd (out + i,
+                       _mm_add_pd (_mm_loadu_pd (x + i), _mm_loadu_pd (y + i)));
+    }
+
+    add_scalar (out + i, x + i, y + i, n - i);
+}
+
+static void mul_sse2 (double *out, const double *x, const double *y,
+                      size n) {
+    size i = 0;
+    for (; i + 2 <= n; i += 2) {
+        _mm_storeu_pd (out + i,
+                       _mm_mul_pd (_mm_loadu_pd (x + i), _mm_loadu_pd (y + i)));
+    }
+
+    mul_scalar (out + i, x + i, y + i, n - i);
+}
+
+// A group of four is held in two registers, lo = [a, b] and hi = [c, d].
+static void prefix_sum_sse2 (double *out, const double *x, size n) {
+    __m128d zero  = _mm_setzero_pd ();
+    __m128d carry = zero;
+    size    i     = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128d lo = _mm_loadu_pd (x + i);
+        __m128d hi = _mm_loadu_pd (x + i + 2);
+
+        // [a, a + b], [b + c, c + d]
+        __m128d p_lo = _mm_add_pd (lo, _mm_unpacklo_pd (zero, lo));
+        __m128d p_hi = _mm_add_pd (hi, _mm_shuffle_pd (lo, hi, 1));
+
+        __m128d q_lo = _mm_add_pd (p_lo, zero);
+        __m128d q_hi = _mm_add_pd (p_hi, p_lo);
+
+        _mm_storeu_pd (out + i, _mm_add_pd (q_lo, carry));
+        __m128d last = _mm_add_pd (q_hi, carry);
+        _mm_storeu_pd (out + i + 2, last);
+        carry = _mm_unpackhi_pd (last, last);
+    }
+
+    double total = _mm_cvtsd_f64 (carry);
+    for (; i < n; i++) {
+        total  += x[i];
+        out[i]  = total;
+    }
+}
+
+static const vec_impl vec_sse2 = {
+    sum_sse2, dot_sse2, min_sse2, max_sse2,
+    axpy_sse2, add_sse2, mul_sse2, prefix_sum_sse2,
+};
+
+#define AVX2_REGS (VEC_LANES / 4)
+#define AVX2 __attribute__ ((target ("avx2")))
+
+AVX2 static void sum_avx2 (double *acc, const double *x, size blocks) {
+    __m256d a[AVX2_REGS];
+    for (int r = 0; r < AVX2_REGS; r++) a[r] = _mm256_loadu_pd (acc + 4 * r);
+
+    for (size b = 0; b < blocks; b++, x += VEC_LANES) {
+        for (int r = 0; r < AVX2_REGS; r++) {
+            a[r] = _mm256_add_pd (a[r], _mm256_loadu_pd (x + 4 * r));
+        }
+    }
+
+    for (int r = 0; r < AVX2_REGS; r++) _mm256_storeu_pd (acc + 4 * r, a[r]);
+}
+
+// No FMA: a fused multiply-add rounds once, and would disagree with the
+// other paths.
+AVX2 static void dot_avx2 (double *acc, const double *x, const double *y,
+                           size blocks) {
+    __m256d a[AVX2_REGS];
+    for (int r = 0; r < AVX2_REGS; r++) a[r] = _mm256_loadu_pd (acc + 4 * r);
+
+    for (size b = 0; b < blocks; b++, x += VEC_LANES, y += VEC_LANES) {
+        for (int r = 0; r < AVX2_REGS; r++) {
+            __m256d prod = _mm256_mul_pd (_mm256_loadu_pd (x + 4 * r),
+                                          _mm256_loadu_pd (y + 4 * r));
+            a[r]         = _mm256_add_pd (a[r], prod);
+        }
+    }
+
+    for (int r = 0; r < AVX2_REGS; r++) _mm256_storeu_pd (acc + 4 * r, a[r]);
+}
+
+AVX2 static bool min_avx2 (double *acc, const double *x, size blocks) {
+    __m256d a[AVX2_REGS];
+    __m256d nan = _mm256_setzero_pd ();
+    for (int r = 0; r < AVX2_REGS; r++) a[r] = _mm256_loadu_pd (acc + 4 * r);
+
+    for (size b = 0; b < blocks; b++, x += VEC_LANES) {
+        for (int r = 0; r < AVX2_REGS; r++) {
+            __m256d v = _mm256_loadu_pd (x + 4 * r);
+            nan  = _mm256_or_pd (nan, _mm256_cmp_pd (v, v, _CMP_UNORD_Q));
+            a[r] = _mm256_min_pd (v, a[r]);
+        }
+    }
+
+    for (int r = 0; r < AVX2_REGS; r++) _mm256_storeu_pd (acc + 4 * r, a[r]);
+    return _mm256_movemask_pd (nan) != 0;
+}
+
+AVX2 static bool max_avx2 (double *acc, const double *x, size blocks) {
+    __m256d a[AVX2_REGS];
+    __m256d nan = _mm256_setzero_pd ();
+    for (int r = 0; r < AVX2_REGS; r++) a[r] = _mm256_loadu_pd (acc + 4 * r);
+
+    for (size b = 0; b < blocks; b++, x += VEC_LANES) {
+        for (int r = 0; r < AVX2_REGS; r++) {
+            __m256d v = _mm256_loadu_pd (x + 4 * r);
+            nan  = _mm256_or_pd (nan, _mm256_cmp_pd (v, v, _CMP_UNORD_Q));
+            a[r] = _mm256_max_pd (v, a[r]);
+        }
+    }
+
+    for (int r = 0; r < AVX2_REGS; r++) _mm256_storeu_pd (acc + 4 * r, a[r]);
+    return _mm256_movemask_pd (nan) != 0;
+}
+
+AVX2 static void axpy_avx2 (double a, const double *x, double *y, size n) {
+    __m256d va = _mm256_set1_pd (a);
+    size    i  = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d prod = _mm256_mul_pd (va, _mm256_loadu_pd (x + i));
+        _mm256_storeu_pd (y + i, _mm256_add_pd (_mm256_loadu_pd (y + i), prod));
+    }
+
+    axpy_scalar (a, x + i, y + i, n - i);
+}
+
+AVX2 static void add_avx2 (double *out, const double *x, const double *y,
+                           size n) {
+    size i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd (out + i, _mm256_add_pd (_mm256_loadu_pd (x + i),
+                                                  _mm256_loadu_pd (y + i)));
+    }
+
+    add_scalar (out + i, x + i, y + i, n - i);
+}
+
+AVX2 static void mul_avx2 (double *out, const double *x, const double *y,
+                           size n) {
+    size i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd (out + i, _mm256_mul_pd (_mm256_loadu_pd (x + i),
+                                                  _mm256_loadu_pd (y + i)));
+    }
+
+    mul_scalar (out + i, x + i, y + i, n - i);
+}
+
+AVX2 static void prefix_sum_avx2 (double *out, const double *x, size n) {
+    __m256d zero  = _mm256_setzero_pd ();
+    __m256d carry = zero;
+    size    i     = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d v = _mm256_loadu_pd (x + i);
+
+        // Shifted up by one lane, [0, a, b, c], then by two.
+        __m256d s1 = _mm256_blend_pd (
+            _mm256_permute4x64_pd (v, _MM_SHUFFLE (2, 1, 0, 0)), zero, 0x1);
+        __m256d p  = _mm256_add_pd (v, s1);
+        __m256d s2 = _mm256_blend_pd (
+            _mm256_permute4x64_pd (p, _MM_SHUFFLE (1, 0, 0, 0)), zero, 0x3);
+        __m256d q = _mm256_add_pd (p, s2);
+
+        __m256d res = _mm256_add_pd (q, carry);
+        _mm256_storeu_pd (out + i, res);
+        carry = _mm256_permute4x64_pd (res, _MM_SHUFFLE (3, 3, 3, 3));
+    }
+
+    double total = _mm256_cvtsd_f64 (carry);
+    for (; i < n; i++) {
+        total  += x[i];
+        out[i]  = total;
+    }
+}
+
+static const vec_impl vec_avx2 = {
+    sum_avx2, dot_avx2, min_avx2, max_avx2,
+    axpy_avx2, add_avx2, mul_avx2, prefix_sum_avx2,
+};
+#endif
+
+static const vec_impl *impl = NULL;
+
+bool vec_set_isa (vec_isa isa) {
+    switch (isa) {
+        case VEC_ISA_SCALAR: impl = &vec_scalar; return true;
+
+#ifdef VEC_X86
+        case VEC_ISA_SSE2: impl = &vec_sse2; return true;
+        case VEC_ISA_AVX2:
+            __builtin_cpu_init ();
+            if (!__builtin_cpu_supports ("avx2")) return false;
+            impl = &vec_avx2;
+            return true;
+#else
+        case VEC_ISA_SSE2:
+        case VEC_ISA_AVX2: return false;
+#endif
+    }
+
+    return false;
+}
+
+static const vec_impl *get_impl (void) {
+    if (impl == NULL && !vec_set_isa (VEC_ISA_AVX2) &&
+        !vec_set_isa (VEC_ISA_SSE2)) {
+        vec_set_isa (VEC_ISA_SCALAR);
+    }
+
+    return impl;
+}
+
+// Folds the lanes pairwise, always in the same order.
+static double fold_sum (double *acc) {
+    for (int width = VEC_LANES / 2; width > 0; width /= 2) {
+        for (int l = 0; l < width; l++) acc[l] += acc[l + width];
+    }
+
+    return acc[0];
+}
+
+double vec_sum (const double *x, size n) {
+    double acc[VEC_LANES] = {0};
+    size   blocks         = n / VEC_LANES;
+
+    get_impl ()->sum (acc, x, blocks);
+    for (size i = blocks * VEC_LANES; i < n; i++) acc[i % VEC_LANES] += x[i];
+
+    return fold_sum (acc);
+}
+
+double vec_dot (const double *x, const double *y, size n) {
+    double acc[VEC_LANES] = {0};
+    size   blocks         = n / VEC_LANES;
+
+    get_impl ()->dot (acc, x, y, blocks);
+    for (size i = blocks * VEC_LANES; i < n; i++) {
+        acc[i % VEC_LANES] += x[i] * y[i];
+    }
+
+    return fold_sum (acc);
+}
+
+double vec_min (const double *x, size n) {
+    double acc[VEC_LANES];
+    size   blocks = n / VEC_LANES;
+    for (int l = 0; l < VEC_LANES; l++) acc[l] = x[0];
+
+    bool nan = get_impl ()->min (acc, x, blocks);
+    for (size i = blocks * VEC_LANES; i < n; i++) {
+        nan     |= x[i] != x[i];
+        double a = acc[i % VEC_LANES];
+        acc[i % VEC_LANES] = x[i] < a ? x[i] : a;
+    }
+
+    if (nan) return (double) NAN;
+
+    for (int width = VEC_LANES / 2; width > 0; width /= 2) {
+        for (int l = 0; l < width; l++) {
+            acc[l] = acc[l + width] < acc[l] ? acc[l + width] : acc[l];
+        }
+    }
+
+    return acc[0];
+}
+
+double vec_max (const double *x, size n) {
+    double acc[VEC_LANES];
+    size   blocks = n / VEC_LANES;
+    for (int l = 0; l < VEC_LANES; l++) acc[l] = x[0];
+
+    bool nan = get_impl ()->max (acc, x, blocks);
+    for (size i = blocks * VEC_LANES; i < n; i++) {
+        nan     |= x[i] != x[i];
+        double a = acc[i % VEC_LANES];
+        acc[i % VEC_LANES] = x[i] > a ? x[i] : a;
+    }
+
+    if (nan) return (double) NAN;
+
+    for (int width = VEC_LANES / 2; width > 0; width /= 2) {
+        for (int l = 0; l < width; l++) {
+            acc[l] = acc[l + width] > acc[l] ? acc[l + width] : acc[l];
+        }
+    }
+
+    return acc[0];
+}
+
+void vec_axpy (double a, const double *x, double *y, size n) {
+    get_impl ()->axpy (a, x, y, n);
+}
+
+void vec_add (double *out, const double *x, const double *y, size n) {
+    get_impl ()->add (out, x, y, n);
+}
+
+void vec_mul (double *out, const double *x, const double *y, size n) {
+    get_impl ()->mul (out, x, y, n);
+}
+
+void vec_prefix_sum (double *out, const double *x, size n) {
+    get_impl ()->prefix_sum (out, x, n);
+}
+
+// Sorting works on the bit patterns, flipped so that unsigned order is
+// numeric order: all bits of negatives, only the sign bit of the rest.
+static inline uint64 sort_key (double d) {
+    uint64 bits;
+    memcpy (&bits, &d, sizeof (bits));
+    return bits >> 63 ? ~bits : bits | (1ull << 63);
+}
+
+static inline double sort_value (uint64 key) {
+    uint64 bits = key >> 63 ? key & ~(1ull << 63) : ~key;
+    double d;
+    memcpy (&d, &bits, sizeof (d));
+    return d;
+}
+
+static void insertion_sort (uint64 *keys, size n) {
+    for (size i = 1; i < n; i++) {
+        uint64 key = keys[i];
+        size   j   = i;
+        for (; j > 0 && keys[j - 1] > key; j--) keys[j] = keys[j - 1];
+        keys[j] = key;
+    }
+}
+
+// LSD radix sort, a byte per pass. All histograms are counted in one pass
+// over the keys, and bytes that are the same in every key are skipped.
+static void radix_sort (uint64 *keys, uint64 *tmp, size n) {
+    size counts[8][256] = {{0}};
+
+    for (size i = 0; i < n; i++) {
+        for (int d = 0; d < 8; d++) counts[d][(keys[i] >> (8 * d)) & 0xff]++;
+    }
+
+    uint64 *src = keys, *dst = tmp;
+    for (int d = 0; d < 8; d++) {
+        size *count = counts[d];
+        if (count[(keys[0] >> (8 * d)) & 0xff] == n) continue;
+
+        size offset = 0;
+        for (int b = 0; b < 256; b++) {
+            size c   = count[b];
+            count[b] = offset;
+            offset  += c;
+        }
+
+        for (size i = 0; i < n; i++) {
+            dst[count[(src[i] >> (8 * d)) & 0xff]++] = src[i];
+        }
+
+        uint64 *swap = src;
+        src          = dst;
+        dst          = swap;
+    }
+
+    if (src != keys) memcpy (keys, src, n * sizeof (uint64));
+}
+
+// Not vectorized: a radix sort is already linear, and its passes are bound by
+// memory rather than arithmetic.
+void vec_sort (double *x, size n) {
+    if (n < 2) return;
+
+    uint64  small[VEC_SORT_SMALL];
+    uint64 *keys = small;
+    if (n >= VEC_SORT_SMALL) {
+        keys = malloc (2 * n * sizeof (uint64));
+        if (keys == NULL) exit (1);
+    }
+
+    for (size i = 0; i < n; i++) keys[i] = sort_key (x[i]);
+
+    if (n < VEC_SORT_SMALL) {
+        insertion_sort (keys, n);
+    } else {
+        radix_sort (keys, keys + n, n);
+    }
+
+    for (size i = 0; i < n; i++) x[i] = sort_value (keys[i]);
+    if (keys != small) free (keys);
+}
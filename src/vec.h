@@ -0,0 +1,39 @@
+// apachejuice, 18.10.2026
+// See LICENSE for details.
+#ifndef __ALOXOTL_VEC__
+#define __ALOXOTL_VEC__
+
+#include "common.h"
+
+// Bulk kernels over arrays of doubles, vectorized with SSE2 or AVX2 where
+// the CPU has them. Reductions keep VEC_LANES partial results, folded in a
+// fixed order, and the scalar path mimics that exactly: every path produces
+// the same bits, though sums and dots are not rounded like a plain loop.
+#define VEC_LANES 16
+
+// Reductions. min and max propagate NaN; `n` must not be 0 for them.
+double vec_sum (const double *x, size n);
+double vec_min (const double *x, size n);
+double vec_max (const double *x, size n);
+double vec_dot (const double *x, const double *y, size n);
+
+// Elementwise. `out` may alias the inputs.
+void vec_axpy (double a, const double *x, double *y, size n);  // y += a * x
+void vec_add (double *out, const double *x, const double *y, size n);
+void vec_mul (double *out, const double *x, const double *y, size n);
+void vec_prefix_sum (double *out, const double *x, size n);
+
+// Ascending, in place. NaNs go to either end, by sign bit.
+void vec_sort (double *x, size n);
+
+typedef enum {
+    VEC_ISA_SCALAR,
+    VEC_ISA_SSE2,
+    VEC_ISA_AVX2,
+} vec_isa;
+
+// Forces every kernel onto one implementation, for benchmarks. Returns false
+// if this CPU or build does not have it.
+bool vec_set_isa (vec_isa isa);
+
+#endif
@@ -1,13 +1,23 @@
 // apachejuice, 27.02.2024
 // See LICENSE for details.
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <math.h>
 
+#include "bcache.h"
+#include "f64array.h"
+#include "hash.h"
+#include "image.h"
+#include "list.h"
+#include "map.h"
 #include "memory.h"
+#include "module.h"
 #include "obj.h"
+#include "rope.h"
 #include "table.h"
 #include "vm.h"
 #include "chunk.h"
@@ -39,7 +49,7 @@ static void runtime_errorv (const char *msg, va_list ap) {
         call_frame *frame       = &vm.frames[i];
         obj_func   *func        = frame->closure->func;
         size_t      instruction = frame->ip - func->chk.code - 1;
-        fprintf (stderr, "[line %zu] in ", func->chk.lines[instruction]);
+        fprintf (stderr, "[line %zu] in ", get_line (&func->chk, instruction));
         if (func->name == NULL) {
             fprintf (stderr, "script\n");
         } else {
@@ -58,45 +68,153 @@ static void runtime_error (const char *msg, ...) {
     reset_stack ();
 }
 
+// Reports an error from inside a native. The call fails once the native
+// returns; whatever it returns is discarded.
+value native_error (const char *msg, ...) {
+    va_list ap;
+    va_start (ap, msg);
+
+    runtime_errorv (msg, ap);
+    va_end (ap);
+
+    vm.native_failed = true;
+    return NIL_VAL ();
+}
+
 static value native_clock (uint8 argc, value *args) {
     return NUMBER_VAL ((double) clock () / CLOCKS_PER_SEC);
 }
 
-static void define_native (const char *name, native_fn callback) {
+void define_native (const char *name, native_fn callback) {
     push (OBJ_VAL ((obj *) copy_string (name, (int32) strlen (name))));
     push (OBJ_VAL ((obj *) new_native (callback)));
-    set_table (&vm.globals, AS_STRING (vm.stack[0]), vm.stack[1]);
+    set_table (&vm.builtins, AS_STRING (vm.stack[0]), vm.stack[1]);
     dpop ();
 }
 
+static value native_gc_compact (uint8 argc, value *args) {
+    compact_heap ();
+    return NIL_VAL ();
+}
+
+// Sets a field on the instance right below the top of the stack.
+static void set_stats_field (const char *name, value val) {
+    push (val);
+    push (OBJ_VAL ((obj *) copy_string (name, strlen (name))));
+    set_table (&AS_INSTANCE (vm.stack_top[-3])->fields,
+               AS_STRING (vm.stack_top[-1]), vm.stack_top[-2]);
+    dpop ();
+}
+
+// Counters are reported through plain instances of a throwaway class.
+static void push_stats_instance (const char *name) {
+    push (OBJ_VAL ((obj *) copy_string (name, strlen (name))));
+    obj_class *klass = new_klass (AS_STRING (vm.stack_top[-1]));
+    vm.stack_top[-1] = OBJ_VAL ((obj *) klass);
+
+    obj_instance *instance = new_instance (klass);
+    vm.stack_top[-1]       = OBJ_VAL ((obj *) instance);
+}
+
+static void set_type_counts (const char *name, size *counts) {
+    push_stats_instance (name);
+    for (int32 i = 0; i < _OBJTYPE_COUNT; i++) {
+        set_stats_field (OBJ_TYPESTR (i), NUMBER_VAL ((double) counts[i]));
+    }
+
+    set_stats_field (name, pop ());
+}
+
+static value native_gc_stats (uint8 argc, value *args) {
+    push_stats_instance ("gc_stats");
+
+    set_stats_field ("collections",
+                     NUMBER_VAL ((double) vm.stats.collections));
+    set_stats_field ("compactions",
+                     NUMBER_VAL ((double) vm.stats.compactions));
+    set_stats_field ("bytes_allocated",
+                     NUMBER_VAL ((double) vm.stats.bytes_allocated));
+    set_stats_field ("bytes_freed",
+                     NUMBER_VAL ((double) vm.stats.bytes_freed));
+    set_stats_field ("heap_size", NUMBER_VAL ((double) vm.heap_size));
+    set_stats_field ("gc_treshold", NUMBER_VAL ((double) vm.gc_treshold));
+    set_stats_field ("grow_factor", NUMBER_VAL (vm.policy.grow_factor));
+    set_stats_field ("pause_total_us",
+                     NUMBER_VAL ((double) vm.stats.pause_total_ns / 1000));
+    set_stats_field ("pause_max_us",
+                     NUMBER_VAL ((double) vm.stats.pause_max_ns / 1000));
+    set_stats_field ("mutator_total_us",
+                     NUMBER_VAL ((double) vm.stats.mutator_total_ns / 1000));
+
+    set_type_counts ("live_objects", vm.stats.live_objects);
+    set_type_counts ("live_bytes", vm.stats.live_bytes);
+
+    // Bucket names are their exclusive upper bound: lt_1us, lt_2us, ...
+    push_stats_instance ("pause_histogram");
+    for (int32 b = 0; b < GC_PAUSE_BUCKETS; b++) {
+        char name[32];
+        if (b == GC_PAUSE_BUCKETS - 1) {
+            snprintf (name, sizeof (name), "longer");
+        } else {
+            snprintf (name, sizeof (name), "lt_%lluus", 1ull << b);
+        }
+
+        set_stats_field (name, NUMBER_VAL ((double) vm.stats.pauses[b]));
+    }
+
+    set_stats_field ("pause_histogram", pop ());
+    return pop ();
+}
+
 static void register_natives (void) {
     define_native ("clock", &native_clock);
+    define_native ("gc_compact", &native_gc_compact);
+    define_native ("gc_stats", &native_gc_stats);
+    register_f64_natives ();
+    register_list_natives ();
+    register_map_natives ();
 }
 
 void init_vm (void) {
     reset_stack ();
-    vm.objects = NULL;
+    init_memory ();
+    init_hash ();
 
     vm.gray_capacity = 0;
     vm.gray_count    = 0;
     vm.gray_stack    = NULL;
 
-    vm.heap_size   = 0;
-    vm.gc_treshold = 1024 * 1024;
+    vm.heap_size         = 0;
+    vm.marked_bytes      = 0;
+    vm.compact_requested = false;
+    vm.native_failed     = false;
+    memset (&vm.stats, 0, sizeof (vm.stats));
 
-    init_table (&vm.strings);
+    init_gc_policy (&vm.policy);
+    vm.gc_treshold = vm.policy.min_heap;
+
+    init_intern_set (&vm.strings);
     vm.init_string = NULL;
     vm.init_string = copy_string ("init", 4);
 
     init_table (&vm.globals);
+    init_table (&vm.builtins);
+    init_table (&vm.modules);
+    vm.main_path = NULL;
+    vm.use_cache = false;
+    flush_method_cache ();
     register_natives ();
 }
 
 void free_vm (void) {
-    free_table (&vm.strings);
+    free_intern_set (&vm.strings);
     free_table (&vm.globals);
+    free_table (&vm.builtins);
+    free_table (&vm.modules);
     vm.init_string = NULL;
     free_objects ();
+    bcache_release ();
+    image_release ();
 }
 
 void push (value val) {
@@ -122,6 +240,11 @@ static bool call (obj_closure *closure, int argc) {
         return false;
     }
 
+    if (func->chk.count == 0 && !compile_lazy (func)) {
+        runtime_error ("Could not compile function %s", func->name->data);
+        return false;
+    }
+
     if (vm.frame_count == FRAMES_MAX) {
         runtime_error ("Stack overflow!");
         return false;
@@ -130,17 +253,36 @@ static bool call (obj_closure *closure, int argc) {
     call_frame *frame = &vm.frames[vm.frame_count++];
     frame->closure    = closure;
     frame->ip         = func->chk.code;
-    frame->slots      = vm.stack_top - argc;
+    frame->slots      = vm.stack_top - argc - 1;
     return true;
 }
 
+// Replaces a rope in a stack slot by its flat string, for code that needs
+// contiguous bytes.
+static void flatten (value *slot) {
+    if (IS_ROPE (*slot)) {
+        *slot = OBJ_VAL ((obj *) rope_flatten (AS_ROPE (*slot)));
+    }
+}
+
 static bool call_value (value callee, uint8 argc) {
     if (IS_OBJ (callee)) {
         switch (OBJ_TYPE (callee)) {
             case OBJ_CLOSURE: return call (AS_CLOSURE (callee), argc);
             case OBJ_NATIVE: {
                 native_fn native = AS_NATIVE (callee);
+                for (value *arg = vm.stack_top - argc; arg < vm.stack_top;
+                     arg++) {
+                    flatten (arg);
+                }
+
                 value     result = native (argc, vm.stack_top - argc);
+                if (vm.native_failed) {
+                    vm.native_failed = false;
+                    reset_stack ();
+                    return false;
+                }
+
                 vm.stack_top -= argc + 1;
                 push (result);
 
@@ -151,9 +293,8 @@ static bool call_value (value callee, uint8 argc) {
                 obj_class *klass = AS_CLASS (callee);
                 vm.stack_top[-argc - 1] =
                     OBJ_VAL ((obj *) new_instance (klass));
-                value initializer;
-                if (get_table (&klass->methods, vm.init_string, &initializer)) {
-                    return call (AS_CLOSURE (initializer), argc);
+                if (klass->init != NULL) {
+                    return call (klass->init, argc);
                 } else if (argc != 0) {
                     runtime_error (
                         "Class with no initializer must recieve zero args: "
@@ -183,15 +324,34 @@ static bool call_value (value callee, uint8 argc) {
     return false;
 }
 
-static bool bind_method (obj_class *klass, obj_string *name) {
+void flush_method_cache (void) {
+    memset (vm.method_cache, 0, sizeof (vm.method_cache));
+}
+
+static obj_closure *find_method (obj_class *klass, obj_string *name) {
+    uint32 index = ((uint32) ((uintptr_t) klass >> 4) ^ name->hash) &
+                   (METHOD_CACHE_SIZE - 1);
+    method_cache_entry *entry = &vm.method_cache[index];
+    if (entry->klass == klass && entry->name == name) return entry->method;
+
     value method;
-    if (!get_table (&klass->methods, name, &method)) {
-        runtime_error ("Class %s has no property %s", klass->name->data,
-                       name->data);
+    if (!get_table (&klass->methods, name, &method)) return NULL;
+
+    entry->klass  = klass;
+    entry->name   = name;
+    entry->method = AS_CLOSURE (method);
+    return entry->method;
+}
+
+static bool bind_method (obj_class *klass, obj_string *name) {
+    obj_closure *method = find_method (klass, name);
+    if (method == NULL) {
+        runtime_error ("No property %s defined for class %s", name->data,
+                       klass->name->data);
         return false;
     }
 
-    obj_bound_method *bound = new_bound_method (peek (0), AS_CLOSURE (method));
+    obj_bound_method *bound = new_bound_method (peek (0), method);
     pop ();
     push (OBJ_VAL ((obj *) bound));
     return true;
@@ -236,27 +396,73 @@ static inline void define_method (obj_string *name) {
     obj_class *klass  = AS_CLASS (peek (1));
 
     set_table (&klass->methods, name, method);
+    if (name == vm.init_string) klass->init = AS_CLOSURE (method);
+
+    flush_method_cache ();
     pop ();
 }
 
+// The namespace globals of the running code live in: its module's, or the
+// main one.
+static inline table *frame_globals (call_frame *frame) {
+    obj_module *module = frame->closure->func->module;
+    return module != NULL ? &module->globals : &vm.globals;
+}
+
+// Checks that `target` can be indexed and `index` is an integer in bounds.
+static bool check_index (value target, value index, size *out) {
+    size count;
+    if (IS_LIST (target)) {
+        count = AS_LIST (target)->items.count;
+    } else if (IS_F64_ARRAY (target)) {
+        count = AS_F64_ARRAY (target)->count;
+    } else {
+        runtime_error ("Can only index lists, maps and f64 arrays, not %s",
+                       VALUE_TYPESTR (target));
+        return false;
+    }
+
+    if (IS_INT (index)) {
+        if (AS_INT (index) < 0 || (uint64) AS_INT (index) >= count) {
+            runtime_error ("Index %" PRId64 " out of bounds for length %zu",
+                           AS_INT (index), count);
+            return false;
+        }
+
+        *out = (size) AS_INT (index);
+        return true;
+    }
+
+    if (!IS_NUMBER (index)) {
+        runtime_error ("Index must be a number, not %s",
+                       VALUE_TYPESTR (index));
+        return false;
+    }
+
+    double num = AS_NUMBER (index);
+    if (num != floor (num)) {
+        runtime_error ("Index %g is not an integer", num);
+        return false;
+    }
+
+    if (num < 0 || num >= (double) count) {
+        runtime_error ("Index %g out of bounds for length %zu", num, count);
+        return false;
+    }
+
+    *out = (size) num;
+    return true;
+}
+
 static bool is_falsey (value val) {
     return IS_NIL (val) || (IS_BOOL (val) && !AS_BOOL (val));
 }
 
 static void concatenate (void) {
-    obj_string *b = AS_STRING (peek (0));
-    obj_string *a = AS_STRING (peek (1));
-
-    size  len  = a->len + b->len;
-    char *data = ALLOCATE (char, len + 1);
-    memcpy (data, a->data, a->len);
-    memcpy (data + a->len, b->data, b->len);
-    data[len] = 0;
-
-    obj_string *result = take_string (data, len);
+    obj *result = rope_concat (AS_OBJ (peek (1)), AS_OBJ (peek (0)));
     dpop ();
 
-    push (OBJ_VAL ((obj *) result));
+    push (OBJ_VAL (result));
 }
 
 #pragma GCC diagnostic push
@@ -270,15 +476,52 @@ static interpret_result run (void) {
 #define READ_SHORT() \
     (frame->ip += 2, (uint16) ((frame->ip[-2] << 8) | frame->ip[-1]))
 #define READ_STRING() AS_STRING (READ_CONSTANT ())
-#define BINARY_OP(vt, op)                                     \
-    do {                                                      \
-        if (!IS_NUMBER (peek (0)) || !IS_NUMBER (peek (1))) { \
-            runtime_error ("Operands must be numbers.");      \
-            return INTERPRET_RUNTIME_ERROR;                   \
-        }                                                     \
-        double b = AS_NUMBER (pop ());                        \
-        double a = AS_NUMBER (pop ());                        \
-        push (vt (a op b));                                   \
+// Two ints give an int, unless `int_op` reports an overflow. Then, and for
+// any other mix of numbers, the result is computed in doubles.
+#define ARITH_OP(int_op, op)                                              \
+    do {                                                                  \
+        value b = peek (0);                                               \
+        value a = peek (1);                                               \
+        int64 res;                                                        \
+        if (IS_INT (a) && IS_INT (b) &&                                   \
+            !int_op (AS_INT (a), AS_INT (b), &res)) {                     \
+            vm.stack_top--;                                               \
+            vm.stack_top[-1] = INT_VAL (res);                             \
+        } else if (IS_NUMERIC (a) && IS_NUMERIC (b)) {                    \
+            vm.stack_top--;                                               \
+            vm.stack_top[-1] = NUMBER_VAL (AS_FLOAT (a) op AS_FLOAT (b)); \
+        } else {                                                          \
+            runtime_error ("Operands must be numbers.");                  \
+            return INTERPRET_RUNTIME_ERROR;                               \
+        }                                                                 \
+    } while (false)
+
+// Mixed comparisons convert the int, so they are exact below 2^53 only.
+#define COMPARE_OP(op)                                                  \
+    do {                                                                \
+        value b = peek (0);                                             \
+        value a = peek (1);                                             \
+        if (IS_INT (a) && IS_INT (b)) {                                 \
+            vm.stack_top--;                                             \
+            vm.stack_top[-1] = BOOL_VAL (AS_INT (a) op AS_INT (b));     \
+        } else if (IS_NUMERIC (a) && IS_NUMERIC (b)) {                  \
+            vm.stack_top--;                                             \
+            vm.stack_top[-1] = BOOL_VAL (AS_FLOAT (a) op AS_FLOAT (b)); \
+        } else {                                                        \
+            runtime_error ("Operands must be numbers.");                \
+            return INTERPRET_RUNTIME_ERROR;                             \
+        }                                                               \
+    } while (false)
+
+#define BITWISE_OP(op)                                    \
+    do {                                                  \
+        if (!IS_INT (peek (0)) || !IS_INT (peek (1))) {   \
+            runtime_error ("Operands must be integers."); \
+            return INTERPRET_RUNTIME_ERROR;               \
+        }                                                 \
+        int64 b = AS_INT (pop ());                        \
+        int64 a = AS_INT (pop ());                        \
+        push (INT_VAL (a op b));                          \
     } while (false)
 
     while (1) {
@@ -309,22 +552,34 @@ static interpret_result run (void) {
             case OP_TRUE: push (BOOL_VAL (true)); break;
             case OP_FALSE: push (BOOL_VAL (false)); break;
 
-            case OP_NEGATE:
-                if (!IS_NUMBER (peek (0))) {
+            case OP_NEGATE: {
+                value val = pop ();
+                if (IS_INT (val) && AS_INT (val) != INT64_MIN) {
+                    push (INT_VAL (-AS_INT (val)));
+                } else if (IS_NUMERIC (val)) {
+                    push (NUMBER_VAL (-AS_FLOAT (val)));
+                } else {
                     runtime_error ("Operand must be a number");
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
-                push (NUMBER_VAL (-AS_NUMBER (pop ())));
+                break;
+            }
+
+            case OP_BIT_NOT:
+                if (!IS_INT (peek (0))) {
+                    runtime_error ("Operand must be an integer");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                push (INT_VAL (~AS_INT (pop ())));
                 break;
 
             case OP_ADD:
-                if (IS_STRING (peek (0)) && IS_STRING (peek (1))) {
+                if (IS_TEXT (peek (0)) && IS_TEXT (peek (1))) {
                     concatenate ();
-                } else if (IS_NUMBER (peek (0)) && IS_NUMBER (peek (1))) {
-                    double b = AS_NUMBER (pop ());
-                    double a = AS_NUMBER (pop ());
-                    push (NUMBER_VAL (a + b));
+                } else if (IS_NUMERIC (peek (0)) && IS_NUMERIC (peek (1))) {
+                    ARITH_OP (__builtin_add_overflow, +);
                 } else {
                     runtime_error (
                         "Operands must be two numbers or two strings.");
@@ -332,12 +587,91 @@ static interpret_result run (void) {
                 }
                 break;
 
-            case OP_SUBTRACT: BINARY_OP (NUMBER_VAL, -); break;
-            case OP_MULTIPLY: BINARY_OP (NUMBER_VAL, *); break;
-            case OP_DIVIDE: BINARY_OP (NUMBER_VAL, /); break;
+            case OP_SUBTRACT: ARITH_OP (__builtin_sub_overflow, -); break;
+            case OP_MULTIPLY: ARITH_OP (__builtin_mul_overflow, *); break;
+
+            // `/` always divides exactly, so ints give a double.
+            case OP_DIVIDE: {
+                if (!IS_NUMERIC (peek (0)) || !IS_NUMERIC (peek (1))) {
+                    runtime_error ("Operands must be numbers.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                value b = pop ();
+                value a = pop ();
+                push (NUMBER_VAL (AS_FLOAT (a) / AS_FLOAT (b)));
+                break;
+            }
+
+            // `~/` and `%` truncate towards zero, like C.
+            case OP_INT_DIVIDE:
+            case OP_MODULO: {
+                value b = peek (0);
+                value a = peek (1);
+                if (!IS_NUMERIC (a) || !IS_NUMERIC (b)) {
+                    runtime_error ("Operands must be numbers.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                bool  modulo = frame->ip[-1] == OP_MODULO;
+                value res;
+                if (IS_INT (a) && IS_INT (b)) {
+                    int64 x = AS_INT (a), y = AS_INT (b);
+                    if (y == 0) {
+                        runtime_error ("Integer division by zero");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+
+                    // INT64_MIN ~/ -1 is the one quotient that does not fit.
+                    if (y == -1) {
+                        res = modulo            ? INT_VAL (0)
+                              : x == INT64_MIN ? NUMBER_VAL (-(double) x)
+                                               : INT_VAL (-x);
+                    } else {
+                        res = INT_VAL (modulo ? x % y : x / y);
+                    }
+                } else {
+                    double x = AS_FLOAT (a), y = AS_FLOAT (b);
+                    res = NUMBER_VAL (modulo ? fmod (x, y) : trunc (x / y));
+                }
+
+                dpop ();
+                push (res);
+                break;
+            }
+
+            case OP_BIT_AND: BITWISE_OP (&); break;
+            case OP_BIT_OR: BITWISE_OP (|); break;
+            case OP_BIT_XOR: BITWISE_OP (^); break;
+
+            // Shifting left drops bits off the top, shifting right keeps the
+            // sign.
+            case OP_SHIFT_LEFT:
+            case OP_SHIFT_RIGHT: {
+                if (!IS_INT (peek (0)) || !IS_INT (peek (1))) {
+                    runtime_error ("Operands must be integers.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                int64 count = AS_INT (pop ());
+                int64 val   = AS_INT (pop ());
+                if (count < 0 || count > 63) {
+                    runtime_error ("Shift count %" PRId64 " out of range",
+                                   count);
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                push (INT_VAL (frame->ip[-1] == OP_SHIFT_LEFT
+                                   ? (int64) ((uint64) val << count)
+                                   : val >> count));
+                break;
+            }
 
             case OP_NOT: push (BOOL_VAL (is_falsey (pop ()))); break;
             case OP_EQUAL: {
+                flatten (vm.stack_top - 1);
+                flatten (vm.stack_top - 2);
+
                 value b = pop ();
                 value a = pop ();
 
@@ -345,13 +679,13 @@ static interpret_result run (void) {
                 break;
             }
 
-            case OP_GREATER: BINARY_OP (BOOL_VAL, >); break;
-            case OP_LESS: BINARY_OP (BOOL_VAL, <); break;
+            case OP_GREATER: COMPARE_OP (>); break;
+            case OP_LESS: COMPARE_OP (<); break;
             case OP_POP: pop (); break;
 
             case OP_DEFINE_GLOBAL: {
                 obj_string *name = READ_STRING ();
-                set_table (&vm.globals, name, peek (0));
+                set_table (frame_globals (frame), name, peek (0));
                 pop ();
                 break;
             }
@@ -359,7 +693,8 @@ static interpret_result run (void) {
             case OP_GET_GLOBAL: {
                 obj_string *name = READ_STRING ();
                 value       val;
-                if (!get_table (&vm.globals, name, &val)) {
+                if (!get_table (frame_globals (frame), name, &val) &&
+                    !get_table (&vm.builtins, name, &val)) {
                     runtime_error ("Undefined variable '%s'", name->data);
                     return INTERPRET_RUNTIME_ERROR;
                 }
@@ -370,8 +705,9 @@ static interpret_result run (void) {
 
             case OP_SET_GLOBAL: {
                 obj_string *name = READ_STRING ();
-                if (set_table (&vm.globals, name, peek (0))) {
-                    delete_table (&vm.globals, name);
+                table      *globals = frame_globals (frame);
+                if (set_table (globals, name, peek (0))) {
+                    delete_table (globals, name);
                     runtime_error ("Reference to undefined variable '%s'",
                                    name->data);
                     return INTERPRET_RUNTIME_ERROR;
@@ -407,6 +743,8 @@ static interpret_result run (void) {
             case OP_LOOP: {
                 uint16 offset = READ_SHORT ();
                 frame->ip -= offset;
+
+                if (vm.compact_requested) compact_heap ();
                 break;
             }
 
@@ -417,6 +755,8 @@ static interpret_result run (void) {
             }
 
             case OP_CALL: {
+                if (vm.compact_requested) compact_heap ();
+
                 uint8 argc = READ_BYTE ();
                 if (!call_value (peek (argc), argc)) {
                     return INTERPRET_RUNTIME_ERROR;
@@ -490,9 +830,7 @@ static interpret_result run (void) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
-                runtime_error ("No property %s defined for class %s",
-                               name->data, instance->klass->name->data);
-                return INTERPRET_RUNTIME_ERROR;
+                break;
             }
 
             case OP_SET_PROPERTY: {
@@ -514,6 +852,182 @@ static interpret_result run (void) {
 
             case OP_METHOD: define_method (READ_STRING ()); break;
 
+            case OP_BUILD_LIST: {
+                uint8     count = READ_BYTE ();
+                obj_list *list  = new_list ();
+
+                // The elements stay on the stack while the list grows.
+                push (OBJ_VAL ((obj *) list));
+                for (value *item = vm.stack_top - count - 1;
+                     item < vm.stack_top - 1; item++) {
+                    write_value_array (&list->items, *item);
+                }
+
+                vm.stack_top -= count + 1;
+                push (OBJ_VAL ((obj *) list));
+                break;
+            }
+
+            case OP_GET_INDEX: {
+                if (IS_MAP (peek (1))) {
+                    if (!map_prepare_key (&vm.stack_top[-1])) {
+                        runtime_error ("NaN cannot be used as a map key");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+
+                    value val;
+                    if (!map_get (AS_MAP (peek (1)), peek (0), &val)) {
+                        val = NIL_VAL ();
+                    }
+
+                    dpop ();
+                    push (val);
+                    break;
+                }
+
+                size index;
+                if (!check_index (peek (1), peek (0), &index)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                value target = peek (1);
+                value val =
+                    IS_LIST (target)
+                        ? AS_LIST (target)->items.values[index]
+                        : NUMBER_VAL (AS_F64_ARRAY (target)->data[index]);
+                dpop ();
+                push (val);
+                break;
+            }
+
+            case OP_SET_INDEX: {
+                if (IS_MAP (peek (2))) {
+                    if (!map_prepare_key (&vm.stack_top[-2])) {
+                        runtime_error ("NaN cannot be used as a map key");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+
+                    map_set (AS_MAP (peek (2)), peek (1), peek (0));
+                    value val = pop ();
+                    dpop ();
+                    push (val);
+                    break;
+                }
+
+                size index;
+                if (!check_index (peek (2), peek (1), &index)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                if (IS_LIST (peek (2))) {
+                    AS_LIST (peek (2))->items.values[index] = peek (0);
+                } else if (IS_NUMERIC (peek (0))) {
+                    AS_F64_ARRAY (peek (2))->data[index] = AS_FLOAT (peek (0));
+                } else {
+                    runtime_error (
+                        "Can only store numbers in f64 arrays, not %s",
+                        VALUE_TYPESTR (peek (0)));
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                value val = pop ();
+                dpop ();
+                push (val);
+                break;
+            }
+
+            case OP_IMPORT: {
+                obj_string *spec = READ_STRING ();
+                obj_module *module;
+                obj_func   *body;
+
+                switch (import_module (spec, frame->closure->func->module,
+                                       &module, &body)) {
+                    case IMPORT_OK: break;
+                    case IMPORT_NOT_FOUND:
+                        runtime_error ("Cannot find module '%s'", spec->data);
+                        return INTERPRET_RUNTIME_ERROR;
+                    case IMPORT_COMPILE_ERROR:
+                        runtime_error ("Could not compile module '%s'",
+                                       spec->data);
+                        return INTERPRET_RUNTIME_ERROR;
+                }
+
+                // The body leaves its result above the module like any
+                // call, so OP_BIND_MODULE finds the same stack either way.
+                push (OBJ_VAL ((obj *) module));
+                if (body == NULL) {
+                    push (NIL_VAL ());
+                    break;
+                }
+
+                push (OBJ_VAL ((obj *) body));
+                obj_closure *closure = new_closure (body);
+                vm.stack_top[-1]     = OBJ_VAL ((obj *) closure);
+                if (!call (closure, 0)) return INTERPRET_RUNTIME_ERROR;
+
+                frame = &vm.frames[vm.frame_count - 1];
+                break;
+            }
+
+            case OP_BIND_MODULE: {
+                add_all_table (&AS_MODULE (peek (1))->globals,
+                               frame_globals (frame));
+                dpop ();
+                break;
+            }
+
+            case OP_INHERIT: {
+                if (!IS_CLASS (peek (1))) {
+                    runtime_error ("Superclass must be a class, not %s",
+                                   VALUE_TYPESTR (peek (1)));
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                // Copy-down: the subclass starts out with all inherited
+                // methods, so lookups never walk up the hierarchy. Methods
+                // it defines itself overwrite them afterwards.
+                obj_class *superclass = AS_CLASS (peek (1));
+                obj_class *subclass   = AS_CLASS (peek (0));
+                add_all_table (&superclass->methods, &subclass->methods);
+                subclass->init = superclass->init;
+
+                flush_method_cache ();
+                pop ();
+                break;
+            }
+
+            case OP_GET_SUPER: {
+                obj_string *name       = READ_STRING ();
+                obj_class  *superclass = AS_CLASS (pop ());
+
+                if (!bind_method (superclass, name)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                break;
+            }
+
+            case OP_SUPER_INVOKE: {
+                if (vm.compact_requested) compact_heap ();
+
+                obj_string  *name       = READ_STRING ();
+                uint8        argc       = READ_BYTE ();
+                obj_class   *superclass = AS_CLASS (pop ());
+                obj_closure *method     = find_method (superclass, name);
+
+                if (method == NULL) {
+                    runtime_error ("No property %s defined for class %s",
+                                   name->data, superclass->name->data);
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                if (!call (method, argc)) return INTERPRET_RUNTIME_ERROR;
+
+                frame = &vm.frames[vm.frame_count - 1];
+                break;
+            }
+
             case OP_RETURN: {
                 value result = pop ();
                 close_upvalues (frame->slots);
@@ -523,7 +1037,7 @@ static interpret_result run (void) {
                     return INTERPRET_OK;
                 }
 
-                vm.stack_top = frame->slots - 1;
+                vm.stack_top = frame->slots;
                 push (result);
                 frame = &vm.frames[vm.frame_count - 1];
 
@@ -536,13 +1050,12 @@ static interpret_result run (void) {
 #undef READ_CONSTANT
 #undef READ_SHORT
 #undef READ_STRING
-#undef BINARY_OP
+#undef ARITH_OP
+#undef COMPARE_OP
+#undef BITWISE_OP
 }
 
-interpret_result interpret (const char *source) {
-    obj_func *func = compile (source);
-    if (func == NULL) return INTERPRET_COMPILE_ERROR;
-
+static interpret_result run_script (obj_func *func) {
     push (OBJ_VAL ((obj *) func));
     obj_closure *closure = new_closure (func);
     pop ();
@@ -551,3 +1064,41 @@ interpret_result interpret (const char *source) {
 
     return run ();
 }
+
+interpret_result interpret (const char *source) {
+    obj_func *func = compile (source, NULL);
+    if (func == NULL) return INTERPRET_COMPILE_ERROR;
+
+    return run_script (func);
+}
+
+// Like interpret, but imports are resolved relative to `path`. With
+// `use_cache`, the script and its modules are loaded from their bytecode
+// cache files if those are up to date, and the files are written after
+// compiling otherwise.
+interpret_result interpret_file (const char *source, const char *path,
+                                 bool use_cache) {
+    size      len        = strlen (source);
+    char     *cache_path = NULL;
+    obj_func *func       = NULL;
+
+    vm.main_path = path;
+    vm.use_cache = use_cache;
+    prefetch_modules (source, path);
+    if (use_cache) {
+        cache_path = bcache_path (path, source, len);
+        func       = bcache_load (cache_path, source, len, NULL);
+    }
+
+    if (func == NULL) {
+        func = compile (source, NULL);
+        if (func != NULL && cache_path != NULL) {
+            bcache_store (cache_path, source, len, func);
+        }
+    }
+
+    free (cache_path);
+    if (func == NULL) return INTERPRET_COMPILE_ERROR;
+
+    return run_script (func);
+}
@@ -5,7 +5,9 @@
 
 #include "chunk.h"
 #include "common.h"
+#include "memory.h"
 #include "obj.h"
+#include "intern.h"
 #include "table.h"
 #include "value.h"
 
@@ -18,6 +20,17 @@ typedef struct {
     value       *slots;
 } call_frame;
 
+// Resolved methods, indexed by a hash of the class and the method name.
+// Holds no references the collector knows about, so it is flushed on every
+// collection, and whenever a method is defined.
+#define METHOD_CACHE_SIZE 256
+
+typedef struct {
+    obj_class   *klass;
+    obj_string  *name;
+    obj_closure *method;
+} method_cache_entry;
+
 typedef struct {
     int32      frame_count;
     call_frame frames[FRAMES_MAX];
@@ -26,16 +39,27 @@ typedef struct {
     uint8       *ip;
     value        stack[STACK_MAX];
     value       *stack_top;
-    obj         *objects;
     size         gray_count;
     size         gray_capacity;
     obj        **gray_stack;
-    table        strings;
+    intern_set   strings;
     obj_string  *init_string;
     table        globals;
+    table        builtins;
+    table        modules;
     obj_upvalue *open_upvalues;
+    const char  *main_path;
+    bool         use_cache;
+
+    method_cache_entry method_cache[METHOD_CACHE_SIZE];
+
     size         heap_size;
+    size         marked_bytes;
     size         gc_treshold;
+    bool         compact_requested;
+    bool         native_failed;
+    gc_policy    policy;
+    gc_stats     stats;
 } VM;
 
 typedef enum {
@@ -47,6 +71,11 @@ typedef enum {
 void             init_vm (void);
 void             free_vm (void);
 interpret_result interpret (const char *source);
+interpret_result interpret_file (const char *source, const char *path,
+                                 bool use_cache);
+void             flush_method_cache (void);
+void             define_native (const char *name, native_fn callback);
+value            native_error (const char *msg, ...);
 void             push (value val);
 value            pop (void);
 